@@ -0,0 +1,1039 @@
+/* -*- C -*- */
+
+/* fslogstat.c */
+
+/*
+ * Prominent copyright and license message is at the end of this file, please
+ * read it.
+ */
+
+/*
+ * "fslogstat" is a compiled, multi-threaded replacement for fslog.awk.
+ *
+ * It reads fslog output (raw records by default, text produced by fslog -p
+ * with -p) and produces the same files as fslog.awk:
+ *
+ *     fslog.stat  - total, missed, unique pages and files counts;
+ *     fslog.dev   - number of accesses to each device;
+ *     fslog.file  - number of accesses to each file, and its number;
+ *     fslog.err   - records missing from the sequence of record numbers;
+ *     fslog.trace - dense trace for "replacement".
+ *
+ * and writes input records annotated with file and page numbers to the
+ * standard output. Optionally, dense trace is also written in the binary
+ * format (see trace.h).
+ *
+ * Devices and files are listed in order of their first appearance rather
+ * than in the unspecified order of awk associative arrays. Text input is
+ * parsed by column positions, as fslog.awk does for name, index and type.
+ *
+ * Input is processed in windows of WINDOW records. Within a window:
+ *
+ *     - records are parsed in parallel, one chunk per thread. Each record
+ *       is assigned to a shard of the page table and a shard of the file
+ *       table by key hash;
+ *
+ *     - each thread owns one shard of each table, and inserts keys of
+ *       records assigned to its shard, chunk by chunk, so that the first
+ *       occurrence of every key within the window is found;
+ *
+ *     - dense numbers are handed out to new keys in record order. This is
+ *       the only sequential step and it only touches new keys;
+ *
+ *     - output lines are formatted in parallel, one chunk per thread, and
+ *       written in order.
+ *
+ * Memory consumption is proportional to the number of unique pages and files
+ * plus the window size, independent of the trace length.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+
+#include "trace.h"
+
+#define sizeof_array(a) (sizeof(a)/sizeof((a)[0]))
+
+static size_t min_size(size_t a, size_t b)
+{
+	return a < b ? a : b;
+}
+
+static size_t max_size(size_t a, size_t b)
+{
+	return a > b ? a : b;
+}
+
+enum {
+	/*
+	 * number of records processed at once.
+	 */
+	WINDOW    = 1 << 18,
+	/*
+	 * maximal number of threads.
+	 */
+	NR_THREADS_MAX = 256,
+	/*
+	 * initial number of slots in a hash table shard.
+	 */
+	SHARD_SIZE0 = 1 << 10,
+	/*
+	 * bytes per text record up to and including the type column.
+	 */
+	TEXT_MIN  = 94,
+	/*
+	 * upper bound on the length of an annotated line produced from a raw
+	 * record.
+	 */
+	RAW_LINE  = 160
+};
+
+/*
+ * Page state bits in ->fr_bits.
+ */
+enum {
+	FR_DIR,
+	FR_HIT,
+	FR_UPTODATE,
+	FR_DIRTY,
+	FR_REF,
+	FR_ACTIVE,
+	FR_WRITEBACK,
+	FR_RECLAIM
+};
+
+/*
+ * Identity of a page. Files are identified by keys with zero ->k_index.
+ */
+struct key {
+	u_int32_t k_dev;
+	u_int32_t k_ino;
+	u_int32_t k_gen;
+	u_int32_t k_index;
+	/*
+	 * file name, right aligned and padded with spaces, as printed by fslog.
+	 */
+	char      k_name[16];
+};
+
+struct entry {
+	struct key e_key;
+	/*
+	 * dense number, assigned in order of first appearance.
+	 */
+	u_int32_t  e_id;
+	/*
+	 * number of accesses.
+	 */
+	u_int32_t  e_count;
+};
+
+/*
+ * Part of a hash table, owned by a single thread. Entries are never moved
+ * within ->sh_entries, so that they can be referenced by index while the
+ * table grows.
+ */
+struct shard {
+	struct entry *sh_entries;
+	u_int32_t     sh_nr;
+	u_int32_t     sh_alloc;
+	/*
+	 * open-addressing table: entry index plus one, zero for an empty slot.
+	 */
+	u_int32_t    *sh_slots;
+	u_int32_t     sh_size;
+};
+
+struct table {
+	struct shard sh[NR_THREADS_MAX];
+	/*
+	 * number of dense numbers handed out.
+	 */
+	u_int32_t    t_nr;
+};
+
+/*
+ * Parsed input record.
+ */
+struct rec {
+	struct key  r_key;
+	u_int64_t   r_phash;
+	u_int64_t   r_fhash;
+	u_int32_t   r_no;
+	/*
+	 * text of the record (text input) or the record itself (raw input).
+	 */
+	const char *r_text;
+	u_int32_t   r_len;
+	/*
+	 * page and file entries: shard in the upper half, index in the lower.
+	 */
+	u_int64_t   r_page;
+	u_int64_t   r_file;
+	u_int8_t    r_pnew;
+	u_int8_t    r_fnew;
+	char        r_type;
+};
+
+/*
+ * Growable vector of record numbers within a window.
+ */
+struct bucket {
+	u_int32_t *b_rec;
+	u_int32_t  b_nr;
+	u_int32_t  b_alloc;
+};
+
+struct device {
+	u_int32_t d_dev;
+	u_int64_t d_count;
+};
+
+/*
+ * Per-thread state.
+ */
+struct chunk {
+	/*
+	 * records [c_start, c_end) of the window.
+	 */
+	u_int32_t            c_start;
+	u_int32_t            c_end;
+	/*
+	 * records of the chunk, bucketed by page and file shards.
+	 */
+	struct bucket        c_pbucket[NR_THREADS_MAX];
+	struct bucket        c_fbucket[NR_THREADS_MAX];
+	/*
+	 * devices seen in the chunk, in order of first appearance.
+	 */
+	struct device       *c_dev;
+	u_int32_t            c_dev_nr;
+	u_int32_t            c_dev_alloc;
+	/*
+	 * formatted output.
+	 */
+	char                *c_out;
+	size_t               c_out_len;
+	size_t               c_out_alloc;
+	char                *c_trace;
+	size_t               c_trace_len;
+	struct trace_record *c_bin;
+	int                  c_result;
+};
+
+static int parse = 0;
+static int annotate = 1;
+static u_int32_t nr_threads;
+
+static struct table pages;
+static struct table files;
+
+static struct rec   window[WINDOW];
+static u_int32_t    window_nr;
+static struct chunk chunks[NR_THREADS_MAX];
+
+static struct device *devs;
+static u_int32_t      devs_nr;
+static u_int32_t      devs_alloc;
+
+/*
+ * Input buffer. Bytes [in_pos, in_len) are not consumed yet.
+ */
+static char  *in;
+static size_t in_pos;
+static size_t in_len;
+static size_t in_alloc;
+static int    in_eof;
+
+static FILE *trace;
+static FILE *bin;
+static FILE *err;
+
+static u_int64_t total;
+static u_int64_t missed;
+static u_int32_t lastno;
+
+static void *grow(void *area, u_int32_t *alloc, u_int32_t nr, size_t size)
+{
+	if (nr >= *alloc) {
+		u_int32_t n;
+
+		n = *alloc != 0 ? *alloc * 2 : 16;
+		area = realloc(area, n * size);
+		if (area == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(ENOMEM);
+		}
+		*alloc = n;
+	}
+	return area;
+}
+
+static u_int64_t key_hash(const struct key *key)
+{
+	u_int64_t w[sizeof *key / sizeof(u_int64_t)];
+	u_int64_t h;
+	u_int32_t i;
+
+	memcpy(w, key, sizeof w);
+	for (h = 0, i = 0; i < sizeof_array(w); ++i) {
+		h ^= w[i];
+		h *= 0x9e3779b97f4a7c15ULL;
+		h ^= h >> 29;
+	}
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 32;
+	return h;
+}
+
+static u_int32_t hash_shard(u_int64_t hash)
+{
+	return (hash >> 40) % nr_threads;
+}
+
+static u_int32_t *shard_slot(u_int32_t *slots, u_int32_t size,
+			     const struct entry *entries,
+			     const struct key *key, u_int64_t hash)
+{
+	u_int32_t i;
+
+	for (i = hash & (size - 1);; i = (i + 1) & (size - 1)) {
+		if (slots[i] == 0 ||
+		    !memcmp(&entries[slots[i] - 1].e_key, key, sizeof *key))
+			return &slots[i];
+	}
+}
+
+static void shard_grow(struct shard *sh)
+{
+	u_int32_t *slots;
+	u_int32_t  size;
+	u_int32_t  i;
+
+	size  = sh->sh_size != 0 ? sh->sh_size * 2 : SHARD_SIZE0;
+	slots = calloc(size, sizeof slots[0]);
+	if (slots == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(ENOMEM);
+	}
+	for (i = 0; i < sh->sh_nr; ++i) {
+		struct key *key;
+
+		key = &sh->sh_entries[i].e_key;
+		*shard_slot(slots, size, sh->sh_entries, key,
+			    key_hash(key)) = i + 1;
+	}
+	free(sh->sh_slots);
+	sh->sh_slots = slots;
+	sh->sh_size  = size;
+}
+
+/*
+ * Finds or inserts @key. Returns index of its entry, sets *@new if inserted.
+ */
+static u_int32_t shard_get(struct shard *sh, const struct key *key,
+			   u_int64_t hash, u_int8_t *new)
+{
+	u_int32_t *slot;
+
+	if (2 * (sh->sh_nr + 1) > sh->sh_size)
+		shard_grow(sh);
+	slot = shard_slot(sh->sh_slots, sh->sh_size, sh->sh_entries, key, hash);
+	if (*slot == 0) {
+		struct entry *e;
+
+		sh->sh_entries = grow(sh->sh_entries, &sh->sh_alloc,
+				      sh->sh_nr, sizeof sh->sh_entries[0]);
+		e = &sh->sh_entries[sh->sh_nr];
+		e->e_key   = *key;
+		e->e_id    = 0;
+		e->e_count = 0;
+		*slot = ++sh->sh_nr;
+		*new = 1;
+	} else
+		*new = 0;
+	return *slot - 1;
+}
+
+static struct entry *table_entry(struct table *t, u_int64_t ref)
+{
+	return &t->sh[ref >> 32].sh_entries[(u_int32_t)ref];
+}
+
+static int hex_parse(const char *s, u_int32_t *val)
+{
+	u_int32_t v;
+	int       i;
+
+	for (v = 0, i = 0; i < 8; ++i) {
+		char c;
+
+		c = s[i];
+		if (c >= '0' && c <= '9')
+			v = v * 16 + c - '0';
+		else if (c >= 'a' && c <= 'f')
+			v = v * 16 + c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F')
+			v = v * 16 + c - 'A' + 10;
+		else
+			return EINVAL;
+	}
+	*val = v;
+	return 0;
+}
+
+/*
+ * printf("%*.*x", width, width, val)
+ */
+static char *hex_putn(char *s, u_int32_t val, int width)
+{
+	static const char digits[] = "0123456789abcdef";
+	int i;
+
+	for (i = width - 1; i >= 0; --i, val >>= 4)
+		s[i] = digits[val & 0xf];
+	return s + width;
+}
+
+static char *hex_put(char *s, u_int32_t val)
+{
+	return hex_putn(s, val, 8);
+}
+
+/*
+ * Copies NUL-terminated @src of at most 16 bytes into @dst, right aligned
+ * and padded with spaces, as printf("%16.16s") does.
+ */
+static void name_put(char *dst, const char *src)
+{
+	size_t len;
+
+	len = strnlen(src, 16);
+	memset(dst, ' ', 16 - len);
+	memcpy(dst + 16 - len, src, len);
+}
+
+static int text_parse(struct rec *r)
+{
+	const char *s;
+
+	s = r->r_text;
+	if (r->r_len < TEXT_MIN ||
+	    hex_parse(s +  0, &r->r_no) != 0 ||
+	    hex_parse(s + 40, &r->r_key.k_dev) != 0 ||
+	    hex_parse(s + 49, &r->r_key.k_ino) != 0 ||
+	    hex_parse(s + 58, &r->r_key.k_gen) != 0 ||
+	    hex_parse(s + 84, &r->r_key.k_index) != 0)
+		return EINVAL;
+	memcpy(r->r_key.k_name, s + 67, sizeof r->r_key.k_name);
+	r->r_type = s[93];
+	return 0;
+}
+
+static void raw_parse(struct rec *r)
+{
+	const struct fslog_record *fr;
+
+	fr = (const struct fslog_record *)r->r_text;
+	r->r_no          = fr->fr_no;
+	r->r_key.k_dev   = fr->fr_dev;
+	r->r_key.k_ino   = fr->fr_ino;
+	r->r_key.k_gen   = fr->fr_gen;
+	r->r_key.k_index = fr->fr_index;
+	name_put(r->r_key.k_name, fr->fr_name);
+	r->r_type = fr->fr_type;
+}
+
+static void bucket_add(struct bucket *b, u_int32_t rno)
+{
+	b->b_rec = grow(b->b_rec, &b->b_alloc, b->b_nr, sizeof b->b_rec[0]);
+	b->b_rec[b->b_nr++] = rno;
+}
+
+static void device_add(struct device **area, u_int32_t *nr, u_int32_t *alloc,
+		       u_int32_t dev, u_int64_t count)
+{
+	u_int32_t i;
+
+	for (i = *nr; i > 0; --i) {
+		if ((*area)[i - 1].d_dev == dev) {
+			(*area)[i - 1].d_count += count;
+			return;
+		}
+	}
+	*area = grow(*area, alloc, *nr, sizeof **area);
+	(*area)[*nr].d_dev   = dev;
+	(*area)[*nr].d_count = count;
+	++*nr;
+}
+
+/*
+ * Phase 1: parse records of the chunk and bucket them by shard.
+ */
+static void chunk_parse(struct chunk *c)
+{
+	u_int32_t i;
+
+	for (i = 0; i < nr_threads; ++i) {
+		c->c_pbucket[i].b_nr = 0;
+		c->c_fbucket[i].b_nr = 0;
+	}
+	c->c_dev_nr = 0;
+	for (i = c->c_start; i < c->c_end; ++i) {
+		struct rec *r;
+		struct key  fkey;
+
+		r = &window[i];
+		if (parse) {
+			if (text_parse(r) != 0) {
+				fprintf(stderr, "Malformed input: `%.*s'\n",
+					(int)r->r_len, r->r_text);
+				c->c_result = EINVAL;
+				return;
+			}
+		} else
+			raw_parse(r);
+		fkey = r->r_key;
+		fkey.k_index = 0;
+		r->r_phash = key_hash(&r->r_key);
+		r->r_fhash = key_hash(&fkey);
+		bucket_add(&c->c_pbucket[hash_shard(r->r_phash)], i);
+		bucket_add(&c->c_fbucket[hash_shard(r->r_fhash)], i);
+		device_add(&c->c_dev, &c->c_dev_nr, &c->c_dev_alloc,
+			   r->r_key.k_dev, 1);
+	}
+}
+
+/*
+ * Phase 2: insert keys of the shard, in record order.
+ */
+static void shard_insert(u_int32_t s)
+{
+	u_int32_t t;
+	u_int32_t i;
+
+	for (t = 0; t < nr_threads; ++t) {
+		struct bucket *b;
+
+		b = &chunks[t].c_pbucket[s];
+		for (i = 0; i < b->b_nr; ++i) {
+			struct rec *r;
+
+			r = &window[b->b_rec[i]];
+			r->r_page = (u_int64_t)s << 32 |
+				shard_get(&pages.sh[s], &r->r_key,
+					  r->r_phash, &r->r_pnew);
+		}
+		b = &chunks[t].c_fbucket[s];
+		for (i = 0; i < b->b_nr; ++i) {
+			struct rec *r;
+			struct key  fkey;
+
+			r = &window[b->b_rec[i]];
+			fkey = r->r_key;
+			fkey.k_index = 0;
+			r->r_file = (u_int64_t)s << 32 |
+				shard_get(&files.sh[s], &fkey,
+					  r->r_fhash, &r->r_fnew);
+			table_entry(&files, r->r_file)->e_count++;
+		}
+	}
+}
+
+/*
+ * Phase 3: hand out dense numbers and check record sequence. Sequential.
+ */
+static void window_assign(void)
+{
+	u_int32_t i;
+
+	for (i = 0; i < window_nr; ++i) {
+		struct rec *r;
+
+		r = &window[i];
+		if (r->r_pnew)
+			table_entry(&pages, r->r_page)->e_id = pages.t_nr++;
+		if (r->r_fnew)
+			table_entry(&files, r->r_file)->e_id = files.t_nr++;
+		if (total > 0 && lastno + 1 != r->r_no) {
+			fprintf(err, "record %u missed\n", lastno + 1);
+			missed++;
+		}
+		lastno = r->r_no;
+		total++;
+	}
+}
+
+static void *out_reserve(struct chunk *c, size_t len)
+{
+	if (c->c_out_len + len > c->c_out_alloc) {
+		c->c_out_alloc = max_size(c->c_out_alloc * 2,
+					  c->c_out_len + len);
+		c->c_out = realloc(c->c_out, c->c_out_alloc);
+		if (c->c_out == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(ENOMEM);
+		}
+	}
+	return c->c_out + c->c_out_len;
+}
+
+/*
+ * Formats @fr as fslog -p does, without the trailing newline.
+ */
+static size_t raw_format(char *s, const struct fslog_record *fr)
+{
+	static const char bits[] = "D+udrawc";
+	char *start;
+	int   i;
+
+	start = s;
+	s = hex_put(s, fr->fr_no);
+	*s++ = ' ';
+	s = hex_put(s, fr->fr_time);
+	*s++ = ' ';
+	s = hex_putn(s, fr->fr_pid, 4);
+	*s++ = ' ';
+	name_put(s, fr->fr_comm);
+	s += 16;
+	*s++ = ' ';
+	s = hex_put(s, fr->fr_dev);
+	*s++ = ' ';
+	s = hex_put(s, fr->fr_ino);
+	*s++ = ' ';
+	s = hex_put(s, fr->fr_gen);
+	*s++ = ' ';
+	name_put(s, fr->fr_name);
+	s += 16;
+	*s++ = ' ';
+	s = hex_put(s, fr->fr_index);
+	*s++ = ' ';
+	*s++ = fr->fr_type;
+	*s++ = ' ';
+	for (i = FR_DIR; i <= FR_RECLAIM; ++i)
+		*s++ = fr->fr_bits & (1 << i) ? bits[i] : '.';
+	return s - start;
+}
+
+/*
+ * Phase 4: format output of the chunk.
+ */
+static void chunk_format(struct chunk *c)
+{
+	u_int32_t i;
+	char     *t;
+
+	c->c_out_len = 0;
+	t = c->c_trace;
+	for (i = c->c_start; i < c->c_end; ++i) {
+		struct rec          *r;
+		struct trace_record *tr;
+		u_int32_t            page;
+		u_int32_t            file;
+
+		r = &window[i];
+		page = table_entry(&pages, r->r_page)->e_id;
+		file = table_entry(&files, r->r_file)->e_id;
+		if (annotate) {
+			char *s;
+
+			s = out_reserve(c, (parse ? r->r_len : RAW_LINE) + 19);
+			if (parse) {
+				memcpy(s, r->r_text, r->r_len);
+				s += r->r_len;
+			} else
+				s += raw_format(s, (const void *)r->r_text);
+			*s++ = ' ';
+			s = hex_put(s, file);
+			*s++ = ' ';
+			s = hex_put(s, page);
+			*s++ = '\n';
+			c->c_out_len = s - c->c_out;
+		}
+		/*
+		 * "%8.8x %8.8x %8.8s %c\n"
+		 */
+		t = hex_put(t, page);
+		*t++ = ' ';
+		t = hex_put(t, file);
+		*t++ = ' ';
+		if (parse)
+			memcpy(t, r->r_text + 84, 8), t += 8;
+		else
+			t = hex_put(t, r->r_key.k_index);
+		*t++ = ' ';
+		*t++ = r->r_type;
+		*t++ = '\n';
+		if (bin != NULL) {
+			tr = &c->c_bin[i - c->c_start];
+			memset(tr, 0, sizeof *tr);
+			tr->tr_page   = page;
+			tr->tr_object = file;
+			tr->tr_index  = r->r_key.k_index;
+			tr->tr_type   = r->r_type;
+		}
+	}
+	c->c_trace_len = t - c->c_trace;
+}
+
+enum phase {
+	PH_PARSE,
+	PH_INSERT,
+	PH_FORMAT
+};
+
+struct worker {
+	pthread_t  w_thread;
+	u_int32_t  w_idx;
+	enum phase w_phase;
+};
+
+static void *worker(void *arg)
+{
+	struct worker *w;
+
+	w = arg;
+	switch (w->w_phase) {
+	case PH_PARSE:
+		chunk_parse(&chunks[w->w_idx]);
+		break;
+	case PH_INSERT:
+		shard_insert(w->w_idx);
+		break;
+	case PH_FORMAT:
+		chunk_format(&chunks[w->w_idx]);
+		break;
+	}
+	return NULL;
+}
+
+static void run(enum phase phase)
+{
+	struct worker w[NR_THREADS_MAX];
+	u_int32_t     i;
+
+	for (i = 0; i < nr_threads; ++i) {
+		w[i].w_idx   = i;
+		w[i].w_phase = phase;
+		if (i > 0 && pthread_create(&w[i].w_thread, NULL,
+					    worker, &w[i]) != 0) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	worker(&w[0]);
+	for (i = 1; i < nr_threads; ++i)
+		pthread_join(w[i].w_thread, NULL);
+}
+
+/*
+ * Makes sure that input buffer has at least @len unconsumed bytes, unless
+ * at the end of input.
+ */
+static void in_fill(FILE *f, size_t len)
+{
+	if (in_len - in_pos >= len || in_eof)
+		return;
+	memmove(in, in + in_pos, in_len - in_pos);
+	in_len -= in_pos;
+	in_pos  = 0;
+	if (len > in_alloc) {
+		in_alloc = len;
+		in = realloc(in, in_alloc);
+		if (in == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(ENOMEM);
+		}
+	}
+	while (in_len < in_alloc && !in_eof) {
+		size_t nr;
+
+		nr = fread(in + in_len, 1, in_alloc - in_len, f);
+		in_len += nr;
+		if (nr == 0)
+			in_eof = 1;
+	}
+}
+
+/*
+ * Reads next window of records. Records point into the input buffer, which
+ * is not modified until the next call.
+ */
+static void window_read(FILE *f)
+{
+	window_nr = 0;
+	if (parse) {
+		in_fill(f, max_size(in_alloc, (size_t)WINDOW * 128));
+		while (window_nr < WINDOW && in_pos < in_len) {
+			struct rec *r;
+			char       *eol;
+
+			eol = memchr(in + in_pos, '\n', in_len - in_pos);
+			if (eol == NULL) {
+				if (!in_eof) {
+					/*
+					 * Partial line. Leave it to the next
+					 * window, unless it is the only line,
+					 * in which case it is longer than the
+					 * buffer.
+					 */
+					if (window_nr > 0)
+						break;
+					in_fill(f, (in_len - in_pos) * 2);
+					continue;
+				}
+				eol = in + in_len;
+			}
+			r = &window[window_nr++];
+			r->r_text = in + in_pos;
+			r->r_len  = eol - r->r_text;
+			in_pos = min_size(eol + 1 - in, in_len);
+		}
+	} else {
+		size_t size;
+
+		size = sizeof(struct fslog_record);
+		in_fill(f, (size_t)WINDOW * size);
+		while (window_nr < WINDOW && in_len - in_pos >= size) {
+			window[window_nr++].r_text = in + in_pos;
+			in_pos += size;
+		}
+	}
+}
+
+static int window_write(void)
+{
+	u_int32_t t;
+	u_int32_t i;
+
+	for (t = 0; t < nr_threads; ++t) {
+		struct chunk *c;
+
+		c = &chunks[t];
+		for (i = 0; i < c->c_dev_nr; ++i)
+			device_add(&devs, &devs_nr, &devs_alloc,
+				   c->c_dev[i].d_dev, c->c_dev[i].d_count);
+		if (annotate && fwrite(c->c_out, 1, c->c_out_len,
+				       stdout) != c->c_out_len)
+			return EIO;
+		if (fwrite(c->c_trace, 1, c->c_trace_len,
+			   trace) != c->c_trace_len)
+			return EIO;
+		if (bin != NULL &&
+		    fwrite(c->c_bin, sizeof c->c_bin[0], c->c_end - c->c_start,
+			   bin) != c->c_end - c->c_start)
+			return EIO;
+	}
+	return 0;
+}
+
+static int process(FILE *f)
+{
+	u_int32_t t;
+	int       result;
+
+	for (t = 0; t < nr_threads; ++t) {
+		chunks[t].c_trace = malloc(WINDOW / nr_threads * 29 + 29);
+		chunks[t].c_bin   = malloc((WINDOW / nr_threads + 1) *
+					   sizeof(struct trace_record));
+		if (chunks[t].c_trace == NULL || chunks[t].c_bin == NULL)
+			return ENOMEM;
+	}
+	for (result = 0; result == 0; ) {
+		window_read(f);
+		if (window_nr == 0)
+			break;
+		for (t = 0; t < nr_threads; ++t) {
+			chunks[t].c_start = (u_int64_t)window_nr * t / nr_threads;
+			chunks[t].c_end   = (u_int64_t)window_nr *
+				(t + 1) / nr_threads;
+			chunks[t].c_result = 0;
+		}
+		run(PH_PARSE);
+		for (t = 0; t < nr_threads; ++t) {
+			if (chunks[t].c_result != 0)
+				return chunks[t].c_result;
+		}
+		run(PH_INSERT);
+		window_assign();
+		run(PH_FORMAT);
+		result = window_write();
+	}
+	if (result == 0 && ferror(f))
+		result = EIO;
+	return result;
+}
+
+static int report(void)
+{
+	struct entry **byid;
+	FILE          *out;
+	u_int32_t      s;
+	u_int32_t      i;
+
+	out = fopen("fslog.stat", "w");
+	if (out == NULL)
+		return errno;
+	fprintf(out, "total:  %llu\n", (unsigned long long)total);
+	fprintf(out, "missed: %llu\n", (unsigned long long)missed);
+	fprintf(out, "unique pages: %u\n", pages.t_nr);
+	fprintf(out, "unique files: %u\n", files.t_nr);
+	fclose(out);
+
+	out = fopen("fslog.dev", "w");
+	if (out == NULL)
+		return errno;
+	for (i = 0; i < devs_nr; ++i)
+		fprintf(out, "%8.8llx %8.8x\n",
+			(unsigned long long)devs[i].d_count, devs[i].d_dev);
+	fclose(out);
+
+	byid = malloc(files.t_nr * sizeof byid[0] + 1);
+	if (byid == NULL)
+		return ENOMEM;
+	for (s = 0; s < nr_threads; ++s) {
+		for (i = 0; i < files.sh[s].sh_nr; ++i) {
+			struct entry *e;
+
+			e = &files.sh[s].sh_entries[i];
+			byid[e->e_id] = e;
+		}
+	}
+	out = fopen("fslog.file", "w");
+	if (out == NULL)
+		return errno;
+	for (i = 0; i < files.t_nr; ++i) {
+		struct entry *e;
+
+		e = byid[i];
+		fprintf(out, "%8.8x %8.8x %8.8x %8.8x %8.8x %.16s\n",
+			e->e_count, e->e_id, e->e_key.k_dev, e->e_key.k_ino,
+			e->e_key.k_gen, e->e_key.k_name);
+	}
+	fclose(out);
+	free(byid);
+	return 0;
+}
+
+static void usage(void)
+{
+	printf("fslogstat [ -h | -p | -n | -j <threads> | -b <binary trace> ] "
+	       "[ <input> ]\n\n"
+	       "\t-p\tinput is text produced by fslog -p (default: raw)\n"
+	       "\t-n\tdo not write annotated records to the standard output\n"
+	       "\t-j\tnumber of threads (default: number of processors)\n"
+	       "\t-b\talso write dense trace in binary format\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct trace_header hdr;
+	FILE               *f;
+	int                 result;
+	int                 opt;
+
+	nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	f = stdin;
+	do {
+		opt = getopt(argc, argv, "hpnj:b:");
+		switch (opt) {
+		case -1:
+			break;
+		case '?':
+		default:
+			fprintf(stderr, "Unable to parse options.\n");
+		case 'h':
+			usage();
+			return 0;
+		case 'p':
+			parse = 1;
+			break;
+		case 'n':
+			annotate = 0;
+			break;
+		case 'j':
+			nr_threads = atoi(optarg);
+			break;
+		case 'b':
+			bin = fopen(optarg, "w");
+			if (bin == NULL) {
+				fprintf(stderr, "Cannot open `%s': %s\n",
+					optarg, strerror(errno));
+				return 1;
+			}
+			break;
+		}
+	} while (opt != -1);
+	nr_threads = min_size(max_size(nr_threads, 1), NR_THREADS_MAX);
+
+	if (optind < argc) {
+		f = fopen(argv[optind], "r");
+		if (f == NULL) {
+			fprintf(stderr, "Cannot open `%s': %s\n",
+				argv[optind], strerror(errno));
+			return 1;
+		}
+	}
+	err   = fopen("fslog.err", "w");
+	trace = fopen("fslog.trace", "w");
+	if (err == NULL || trace == NULL) {
+		perror("fopen");
+		return 1;
+	}
+
+	memset(&hdr, 0, sizeof hdr);
+	hdr.th_magic   = TRACE_MAGIC;
+	hdr.th_version = TRACE_VERSION;
+	hdr.th_recsize = sizeof(struct trace_record);
+	if (bin != NULL)
+		fwrite(&hdr, sizeof hdr, 1, bin);
+
+	result = process(f);
+	if (result == 0)
+		result = report();
+	if (bin != NULL) {
+		hdr.th_nr_records = total;
+		hdr.th_nr_vpages  = pages.t_nr;
+		hdr.th_nr_objects = files.t_nr;
+		if (result == 0 && (fseek(bin, 0, SEEK_SET) != 0 ||
+				    fwrite(&hdr, sizeof hdr, 1, bin) != 1))
+			result = EIO;
+		fclose(bin);
+	}
+	fclose(trace);
+	fclose(err);
+	if (result != 0)
+		fprintf(stderr, "fslogstat: %s\n", strerror(result));
+	return result;
+}
+
+/*
+ * Author: Nikita Danilov <Danilov@Gmail.COM>
+ * Keywords: VM page replacement simulation tracing
+ *
+ * Copyright (C) 2006 Nikita Danilov <Danilov@Gmail.COM>
+ *
+ * This file is a part of itself.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
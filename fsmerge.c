@@ -0,0 +1,487 @@
+/* -*- C -*- */
+
+/* fsmerge.c */
+
+/*
+ * Prominent copyright and license message is at the end of this file, please
+ * read it.
+ */
+
+/*
+ * "fsmerge" merges several raw fslog outputs, e.g., one per CPU or per relay
+ * channel, into a single raw trace ordered by record number:
+ *
+ *     fsmerge cpu0.raw cpu1.raw cpu2.raw cpu3.raw > fslog.raw
+ *     replacement -i raw -M 1024 < fslog.raw
+ *
+ * Each input is expected to be (nearly) ordered. Inputs are merged with a
+ * heap keyed by the record at the head of every input. With -t records are
+ * ordered by time-stamp instead, for captures where record numbers are only
+ * sequential within each input. Both record numbers and time-stamps are 32
+ * bit counters and are compared modulo 2^32, so the merge continues across
+ * the wrap.
+ *
+ * Records that are out of order within their input are passed through a
+ * reorder window (-w) of the given number of records, also a heap, which
+ * restores the order of records displaced by less than the window size.
+ *
+ * The following is reported to the standard error at the end:
+ *
+ *     - records missing from the sequence of record numbers (globally, or
+ *       within each input with -t), and the number of gaps, as seen when
+ *       records are written. With -e each of these gaps is listed in the
+ *       given file, so that the list adds up to the missed count;
+ *
+ *     - records filling one of these gaps late, i.e., displaced by more than
+ *       the window. Records actually lost are the missed ones less the late
+ *       ones;
+ *
+ *     - duplicate record numbers;
+ *
+ *     - records out of order within their input, and those still late in
+ *       the output;
+ *
+ *     - time reversals: records with time-stamp smaller than the one of the
+ *       preceding output record.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <sys/types.h>
+
+#include "trace.h"
+
+enum {
+	/*
+	 * number of records read from an input at once.
+	 */
+	IN_NR  = 1024,
+	/*
+	 * number of records written at once.
+	 */
+	OUT_NR = 1024
+};
+
+struct input {
+	const char          *i_name;
+	FILE                *i_file;
+	struct fslog_record  i_buf[IN_NR];
+	u_int32_t            i_pos;
+	u_int32_t            i_nr;
+	/*
+	 * key of the last record read from the input.
+	 */
+	u_int32_t            i_last;
+	/*
+	 * highest record number emitted from the input, for per-input gap
+	 * detection.
+	 */
+	u_int32_t            i_high;
+	/*
+	 * number of records read from and emitted from the input.
+	 */
+	u_int64_t            i_total;
+	u_int64_t            i_out;
+};
+
+/*
+ * heap element: a record and the input it came from.
+ */
+struct item {
+	struct fslog_record  it_rec;
+	u_int32_t            it_input;
+};
+
+/*
+ * binary min-heap of items.
+ */
+struct heap {
+	struct item *h_item;
+	u_int32_t    h_nr;
+	u_int32_t    h_size;
+};
+
+static int by_time = 0;
+
+static struct input *inputs;
+static u_int32_t     nr_inputs;
+
+static FILE               *out;
+static FILE               *err;
+static struct fslog_record outbuf[OUT_NR];
+static u_int32_t           out_nr;
+
+static u_int64_t total;
+static u_int64_t missed;
+static u_int64_t gaps;
+static u_int64_t late;
+static u_int64_t duplicates;
+static u_int64_t in_disorder;
+static u_int64_t out_disorder;
+static u_int64_t reversals;
+
+/*
+ * Compares 32 bit counters modulo 2^32.
+ */
+static int serial_cmp(u_int32_t a, u_int32_t b)
+{
+	return a == b ? 0 : (int32_t)(a - b) < 0 ? -1 : +1;
+}
+
+static u_int32_t rec_key(const struct fslog_record *rec)
+{
+	return by_time ? rec->fr_time : rec->fr_no;
+}
+
+static int item_lt(const struct item *a, const struct item *b)
+{
+	int cmp;
+
+	cmp = serial_cmp(rec_key(&a->it_rec), rec_key(&b->it_rec));
+	if (cmp == 0)
+		cmp = by_time ? serial_cmp(a->it_rec.fr_no, b->it_rec.fr_no) :
+			serial_cmp(a->it_rec.fr_time, b->it_rec.fr_time);
+	return cmp != 0 ? cmp < 0 : a->it_input < b->it_input;
+}
+
+static int heap_init(struct heap *h, u_int32_t size)
+{
+	h->h_nr   = 0;
+	h->h_size = size;
+	h->h_item = malloc((size + 1) * sizeof h->h_item[0]);
+	return h->h_item != NULL ? 0 : ENOMEM;
+}
+
+static void heap_fini(struct heap *h)
+{
+	free(h->h_item);
+}
+
+static void heap_push(struct heap *h, const struct item *it)
+{
+	u_int32_t i;
+
+	assert(h->h_nr < h->h_size);
+	for (i = h->h_nr++; i > 0; i = (i - 1) / 2) {
+		if (!item_lt(it, &h->h_item[(i - 1) / 2]))
+			break;
+		h->h_item[i] = h->h_item[(i - 1) / 2];
+	}
+	h->h_item[i] = *it;
+}
+
+static void heap_pop(struct heap *h, struct item *it)
+{
+	struct item *last;
+	u_int32_t    i;
+	u_int32_t    child;
+
+	*it  = h->h_item[0];
+	last = &h->h_item[--h->h_nr];
+	for (i = 0; (child = 2 * i + 1) < h->h_nr; i = child) {
+		if (child + 1 < h->h_nr &&
+		    item_lt(&h->h_item[child + 1], &h->h_item[child]))
+			child++;
+		if (!item_lt(&h->h_item[child], last))
+			break;
+		h->h_item[i] = h->h_item[child];
+	}
+	h->h_item[i] = *last;
+}
+
+/*
+ * Reads the next record of input @no into @it. Returns ENOENT at the end of
+ * the input.
+ */
+static int input_next(u_int32_t no, struct item *it)
+{
+	struct input *in;
+
+	in = &inputs[no];
+	if (in->i_pos == in->i_nr) {
+		in->i_pos = 0;
+		in->i_nr  = fread(in->i_buf, sizeof in->i_buf[0], IN_NR,
+				  in->i_file);
+		if (in->i_nr == 0) {
+			if (ferror(in->i_file)) {
+				fprintf(stderr, "Cannot read `%s': %s\n",
+					in->i_name, strerror(errno));
+				return EIO;
+			}
+			return ENOENT;
+		}
+	}
+	it->it_rec   = in->i_buf[in->i_pos++];
+	it->it_input = no;
+	if (in->i_total++ > 0 &&
+	    serial_cmp(rec_key(&it->it_rec), in->i_last) < 0)
+		in_disorder++;
+	in->i_last = rec_key(&it->it_rec);
+	return 0;
+}
+
+static void gap(const char *name, u_int32_t from, u_int32_t to)
+{
+	missed += to - from;
+	gaps++;
+	if (err != NULL) {
+		if (name != NULL)
+			fprintf(err, "%s: ", name);
+		fprintf(err, "records %8.8x-%8.8x missed\n", from, to - 1);
+	}
+}
+
+static int flush(void)
+{
+	if (out_nr > 0 && fwrite(outbuf, sizeof outbuf[0],
+				 out_nr, out) != out_nr) {
+		perror("write");
+		return EIO;
+	}
+	out_nr = 0;
+	return 0;
+}
+
+/*
+ * Checks record number @no against the highest number @high seen so far in
+ * the same sequence. A record below @high arrived late: it is counted out of
+ * order, and as filling one of the gaps already reported.
+ */
+static void sequence(const char *name, u_int32_t *high, u_int64_t nr,
+		     u_int32_t no)
+{
+	int cmp;
+
+	cmp = nr > 0 ? serial_cmp(no, *high) : 1;
+	if (cmp > 0) {
+		if (nr > 0 && no != *high + 1)
+			gap(name, *high + 1, no);
+		*high = no;
+	} else if (cmp == 0)
+		duplicates++;
+	else {
+		out_disorder++;
+		late++;
+	}
+}
+
+/*
+ * Writes @it to the output, checking the sequence of record numbers and
+ * time-stamps.
+ */
+static int emit(const struct item *it)
+{
+	static u_int32_t           high;
+	static u_int32_t           time;
+	const struct fslog_record *rec;
+	struct input              *in;
+
+	rec = &it->it_rec;
+	in  = &inputs[it->it_input];
+	if (total > 0 && serial_cmp(rec->fr_time, time) < 0)
+		reversals++;
+	time = rec->fr_time;
+	if (by_time)
+		sequence(in->i_name, &in->i_high, in->i_out, rec->fr_no);
+	else
+		sequence(NULL, &high, total, rec->fr_no);
+	in->i_out++;
+	total++;
+	outbuf[out_nr++] = *rec;
+	return out_nr == OUT_NR ? flush() : 0;
+}
+
+static int merge(u_int32_t window)
+{
+	struct heap heads;
+	struct heap reorder;
+	struct item it;
+	u_int32_t   no;
+	int         result;
+
+	result = heap_init(&heads, nr_inputs);
+	if (result == 0)
+		result = heap_init(&reorder, window);
+	if (result != 0)
+		return result;
+	for (no = 0; no < nr_inputs && result == 0; ++no) {
+		result = input_next(no, &it);
+		if (result == 0)
+			heap_push(&heads, &it);
+		else if (result == ENOENT)
+			result = 0;
+	}
+	while (result == 0 && heads.h_nr > 0) {
+		heap_pop(&heads, &it);
+		no = it.it_input;
+		if (window > 0) {
+			struct item old;
+
+			if (reorder.h_nr == window) {
+				heap_pop(&reorder, &old);
+				result = emit(&old);
+			}
+			heap_push(&reorder, &it);
+		} else
+			result = emit(&it);
+		if (result == 0) {
+			result = input_next(no, &it);
+			if (result == 0)
+				heap_push(&heads, &it);
+			else if (result == ENOENT)
+				result = 0;
+		}
+	}
+	while (result == 0 && reorder.h_nr > 0) {
+		heap_pop(&reorder, &it);
+		result = emit(&it);
+	}
+	if (result == 0)
+		result = flush();
+	heap_fini(&heads);
+	heap_fini(&reorder);
+	return result;
+}
+
+static void report(void)
+{
+	u_int32_t i;
+
+	fprintf(stderr, "records:        %llu\n", (unsigned long long)total);
+	for (i = 0; i < nr_inputs; ++i)
+		fprintf(stderr, "    %-24s %llu\n", inputs[i].i_name,
+			(unsigned long long)inputs[i].i_total);
+	fprintf(stderr, "missed:         %llu in %llu gaps\n",
+		(unsigned long long)missed, (unsigned long long)gaps);
+	fprintf(stderr, "filled late:    %llu\n", (unsigned long long)late);
+	fprintf(stderr, "duplicates:     %llu\n",
+		(unsigned long long)duplicates);
+	fprintf(stderr, "out of order:   %llu in input, %llu in output\n",
+		(unsigned long long)in_disorder,
+		(unsigned long long)out_disorder);
+	fprintf(stderr, "time reversals: %llu\n",
+		(unsigned long long)reversals);
+}
+
+static void usage(void)
+{
+	printf("fsmerge [ -h | -t | -w <window> | -o <output> | "
+	       "-e <gaps> ] <input> ...\n\n"
+	       "\t-t\tmerge by time-stamp rather than record number\n"
+	       "\t-w\tsize of the reorder window, in records (default 0)\n"
+	       "\t-o\toutput file (default: standard output)\n"
+	       "\t-e\tfile to list gaps in record numbers in\n");
+}
+
+int main(int argc, char **argv)
+{
+	u_int32_t window;
+	u_int32_t i;
+	int       result;
+	int       opt;
+
+	window = 0;
+	out    = stdout;
+	do {
+		opt = getopt(argc, argv, "htw:o:e:");
+		switch (opt) {
+		case -1:
+			break;
+		case '?':
+		default:
+			fprintf(stderr, "Unable to parse options.\n");
+		case 'h':
+			usage();
+			return 0;
+		case 't':
+			by_time = 1;
+			break;
+		case 'w':
+			window = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			out = fopen(optarg, "w");
+			if (out == NULL) {
+				fprintf(stderr, "Cannot open `%s': %s\n",
+					optarg, strerror(errno));
+				return 1;
+			}
+			break;
+		case 'e':
+			err = fopen(optarg, "w");
+			if (err == NULL) {
+				fprintf(stderr, "Cannot open `%s': %s\n",
+					optarg, strerror(errno));
+				return 1;
+			}
+			break;
+		}
+	} while (opt != -1);
+
+	nr_inputs = argc - optind;
+	if (nr_inputs == 0) {
+		usage();
+		return 1;
+	}
+	inputs = calloc(nr_inputs, sizeof inputs[0]);
+	if (inputs == NULL) {
+		perror("calloc");
+		return 1;
+	}
+	for (i = 0; i < nr_inputs; ++i) {
+		inputs[i].i_name = argv[optind + i];
+		inputs[i].i_file = !strcmp(inputs[i].i_name, "-") ? stdin :
+			fopen(inputs[i].i_name, "r");
+		if (inputs[i].i_file == NULL) {
+			fprintf(stderr, "Cannot open `%s': %s\n",
+				inputs[i].i_name, strerror(errno));
+			return 1;
+		}
+	}
+
+	result = merge(window);
+	if (result == 0)
+		report();
+	for (i = 0; i < nr_inputs; ++i)
+		fclose(inputs[i].i_file);
+	free(inputs);
+	if (err != NULL)
+		fclose(err);
+	if (fclose(out) != 0 && result == 0) {
+		perror("close");
+		result = EIO;
+	}
+	if (result != 0)
+		fprintf(stderr, "fsmerge: %s\n", strerror(result));
+	return result;
+}
+
+/*
+ * Author: Nikita Danilov <Danilov@Gmail.COM>
+ * Keywords: VM page replacement simulation tracing
+ *
+ * Copyright (C) 2006 Nikita Danilov <Danilov@Gmail.COM>
+ *
+ * This file is a part of itself.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
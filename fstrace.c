@@ -0,0 +1,550 @@
+/* -*- C -*- */
+
+/* fstrace.c */
+
+/*
+ * Prominent copyright and license message is at the end of this file, please
+ * read it.
+ */
+
+/*
+ * "fstrace" converts file system access traces between formats understood by
+ * "replacement".
+ *
+ * By default, text trace (fslog.trace, as produced by fslog.awk) is read
+ * from the standard input and binary trace (see trace.h) is written to the
+ * standard output:
+ *
+ *     fstrace < fslog.trace > fslog.bin
+ *     replacement -i bin -M 1024 < fslog.bin
+ *
+ * With -z, compressed binary trace is written instead:
+ *
+ *     fstrace -z < fslog.trace > fslog.zbin
+ *     replacement -i zbin -M 1024 < fslog.zbin
+ *
+ * With -d, binary or compressed trace is converted back to text. -s and -n
+ * select a range of records; in a compressed trace only the blocks of the
+ * range are decompressed.
+ *
+ * If output is seekable, the header of binary trace is updated with the
+ * number of records, pages and files, so that "replacement" does not need
+ * -V and -f options.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+
+#include <zlib.h>
+
+#include "trace.h"
+
+/*
+ * Writer of binary, or compressed binary, trace.
+ */
+struct writer {
+	FILE                *w_out;
+	int                  w_zip;
+	struct trace_zheader w_hdr;
+	/*
+	 * offset of the header in the output, or -1 if output is not
+	 * seekable.
+	 */
+	off_t                w_start;
+	/*
+	 * number of bytes written so far.
+	 */
+	u_int64_t            w_pos;
+	/*
+	 * buffered records.
+	 */
+	struct trace_record *w_buf;
+	u_int32_t            w_nr;
+	/*
+	 * block index of compressed trace.
+	 */
+	u_int64_t           *w_index;
+	u_int64_t            w_nr_blocks;
+	u_int64_t            w_alloc;
+	unsigned char       *w_col;
+	unsigned char       *w_zbuf;
+	uLong                w_zsize;
+};
+
+/*
+ * Reader of binary, or compressed binary, trace.
+ */
+struct reader {
+	FILE                *r_in;
+	int                  r_zip;
+	struct trace_zheader r_hdr;
+	off_t                r_start;
+	struct trace_record *r_buf;
+	u_int32_t            r_pos;
+	u_int32_t            r_nr;
+	unsigned char       *r_col;
+	unsigned char       *r_zbuf;
+	uLong                r_zsize;
+};
+
+static int out(struct writer *w, const void *buf, size_t size)
+{
+	if (fwrite(buf, 1, size, w->w_out) != size) {
+		perror("write");
+		return EIO;
+	}
+	w->w_pos += size;
+	return 0;
+}
+
+static int writer_init(struct writer *w, FILE *f, int zip)
+{
+	struct trace_header *hdr;
+
+	memset(w, 0, sizeof *w);
+	w->w_out   = f;
+	w->w_zip   = zip;
+	w->w_start = ftello(f);
+	hdr = &w->w_hdr.tz_hdr;
+	hdr->th_magic   = zip ? TRACE_ZMAGIC : TRACE_MAGIC;
+	hdr->th_version = TRACE_VERSION;
+	hdr->th_recsize = sizeof(struct trace_record);
+	w->w_hdr.tz_block = TRACE_ZBLOCK;
+	w->w_buf = malloc(TRACE_ZBLOCK * sizeof w->w_buf[0]);
+	if (w->w_buf == NULL)
+		return ENOMEM;
+	if (zip) {
+		w->w_zsize = compressBound(TRACE_ZBLOCK * TRACE_ZRECSIZE);
+		w->w_col   = malloc(TRACE_ZBLOCK * TRACE_ZRECSIZE);
+		w->w_zbuf  = malloc(w->w_zsize);
+		if (w->w_col == NULL || w->w_zbuf == NULL)
+			return ENOMEM;
+		return out(w, &w->w_hdr, sizeof w->w_hdr);
+	} else
+		return out(w, hdr, sizeof *hdr);
+}
+
+static int writer_flush(struct writer *w)
+{
+	struct trace_zblock blk;
+	uLong               size;
+	int                 result;
+
+	if (w->w_nr == 0)
+		return 0;
+	if (!w->w_zip) {
+		result = out(w, w->w_buf, w->w_nr * sizeof w->w_buf[0]);
+		w->w_nr = 0;
+		return result;
+	}
+	if (w->w_nr_blocks == w->w_alloc) {
+		w->w_alloc = w->w_alloc != 0 ? w->w_alloc * 2 : 64;
+		w->w_index = realloc(w->w_index,
+				     w->w_alloc * sizeof w->w_index[0]);
+		if (w->w_index == NULL)
+			return ENOMEM;
+	}
+	w->w_index[w->w_nr_blocks++] = w->w_pos;
+	trace_zpack(w->w_buf, w->w_nr, w->w_col);
+	size = w->w_zsize;
+	if (compress2(w->w_zbuf, &size, w->w_col,
+		      w->w_nr * TRACE_ZRECSIZE, Z_DEFAULT_COMPRESSION) != Z_OK) {
+		fprintf(stderr, "Compression failed\n");
+		return EIO;
+	}
+	blk.tb_size = size;
+	blk.tb_nr   = w->w_nr;
+	w->w_nr = 0;
+	result = out(w, &blk, sizeof blk);
+	if (result == 0)
+		result = out(w, w->w_zbuf, size);
+	return result;
+}
+
+static int writer_add(struct writer *w, const struct trace_record *rec)
+{
+	struct trace_header *hdr;
+
+	hdr = &w->w_hdr.tz_hdr;
+	hdr->th_nr_records++;
+	if (rec->tr_page >= hdr->th_nr_vpages)
+		hdr->th_nr_vpages = rec->tr_page + 1ULL;
+	if (rec->tr_object >= hdr->th_nr_objects)
+		hdr->th_nr_objects = rec->tr_object + 1ULL;
+	w->w_buf[w->w_nr++] = *rec;
+	return w->w_nr == TRACE_ZBLOCK ? writer_flush(w) : 0;
+}
+
+static int writer_fini(struct writer *w)
+{
+	int result;
+
+	result = writer_flush(w);
+	if (result == 0 && w->w_zip) {
+		struct trace_zblock   end = { 0, 0 };
+		struct trace_ztrailer trailer;
+
+		memset(&trailer, 0, sizeof trailer);
+		result = out(w, &end, sizeof end);
+		trailer.tt_index     = w->w_pos;
+		trailer.tt_nr_blocks = w->w_nr_blocks;
+		trailer.tt_magic     = TRACE_ZMAGIC;
+		if (result == 0)
+			result = out(w, w->w_index,
+				     w->w_nr_blocks * sizeof w->w_index[0]);
+		if (result == 0)
+			result = out(w, &trailer, sizeof trailer);
+	}
+	if (result == 0 && w->w_start >= 0) {
+		/*
+		 * Output is seekable: fill in the header.
+		 */
+		if (fseeko(w->w_out, w->w_start, SEEK_SET) != 0 ||
+		    fwrite(&w->w_hdr, w->w_zip ? sizeof w->w_hdr :
+			   sizeof w->w_hdr.tz_hdr, 1, w->w_out) != 1) {
+			perror("header");
+			result = EIO;
+		}
+	}
+	free(w->w_buf);
+	free(w->w_index);
+	free(w->w_col);
+	free(w->w_zbuf);
+	return result;
+}
+
+static int reader_init(struct reader *r, FILE *f)
+{
+	struct trace_header *hdr;
+
+	memset(r, 0, sizeof *r);
+	r->r_in    = f;
+	r->r_start = ftello(f);
+	hdr = &r->r_hdr.tz_hdr;
+	if (fread(hdr, sizeof *hdr, 1, f) != 1 ||
+	    (hdr->th_magic != TRACE_MAGIC && hdr->th_magic != TRACE_ZMAGIC) ||
+	    hdr->th_version != TRACE_VERSION ||
+	    hdr->th_recsize != sizeof(struct trace_record)) {
+		fprintf(stderr, "Not a binary trace\n");
+		return EINVAL;
+	}
+	r->r_zip = hdr->th_magic == TRACE_ZMAGIC;
+	if (!r->r_zip)
+		r->r_hdr.tz_block = TRACE_ZBLOCK;
+	else if (fread(&r->r_hdr.tz_block, sizeof r->r_hdr -
+		       sizeof r->r_hdr.tz_hdr, 1, f) != 1 ||
+		   r->r_hdr.tz_block == 0) {
+		fprintf(stderr, "Malformed compressed trace header\n");
+		return EINVAL;
+	}
+	r->r_buf = malloc(r->r_hdr.tz_block * sizeof r->r_buf[0]);
+	if (r->r_buf == NULL)
+		return ENOMEM;
+	if (r->r_zip) {
+		r->r_zsize = compressBound(r->r_hdr.tz_block * TRACE_ZRECSIZE);
+		r->r_col   = malloc(r->r_hdr.tz_block * TRACE_ZRECSIZE);
+		r->r_zbuf  = malloc(r->r_zsize);
+		if (r->r_col == NULL || r->r_zbuf == NULL)
+			return ENOMEM;
+	}
+	return 0;
+}
+
+static void reader_fini(struct reader *r)
+{
+	free(r->r_buf);
+	free(r->r_col);
+	free(r->r_zbuf);
+}
+
+/*
+ * Reads next block of records into ->r_buf.
+ */
+static int reader_block(struct reader *r)
+{
+	r->r_pos = 0;
+	if (r->r_zip) {
+		struct trace_zblock blk;
+		uLong               size;
+
+		if (fread(&blk, sizeof blk, 1, r->r_in) != 1) {
+			fprintf(stderr, "Truncated compressed trace\n");
+			return EIO;
+		}
+		if (blk.tb_nr == 0)
+			return ENOENT;
+		size = blk.tb_nr * TRACE_ZRECSIZE;
+		if (blk.tb_nr > r->r_hdr.tz_block || blk.tb_size > r->r_zsize ||
+		    fread(r->r_zbuf, blk.tb_size, 1, r->r_in) != 1 ||
+		    uncompress(r->r_col, &size, r->r_zbuf,
+			       blk.tb_size) != Z_OK ||
+		    size != blk.tb_nr * TRACE_ZRECSIZE) {
+			fprintf(stderr, "Corrupted compressed block\n");
+			return EIO;
+		}
+		trace_zunpack(r->r_col, blk.tb_nr, r->r_buf);
+		r->r_nr = blk.tb_nr;
+	} else {
+		r->r_nr = fread(r->r_buf, sizeof r->r_buf[0],
+				r->r_hdr.tz_block, r->r_in);
+		if (r->r_nr == 0)
+			return ferror(r->r_in) ? EIO : ENOENT;
+	}
+	return 0;
+}
+
+/*
+ * Reads past @nr blocks of records, for input that cannot seek. Compressed
+ * blocks are not decompressed.
+ */
+static int reader_skip(struct reader *r, u_int64_t nr)
+{
+	for (; nr > 0; --nr) {
+		if (r->r_zip) {
+			struct trace_zblock blk;
+
+			if (fread(&blk, sizeof blk, 1, r->r_in) != 1) {
+				fprintf(stderr, "Truncated compressed trace\n");
+				return EIO;
+			}
+			if (blk.tb_nr == 0)
+				return ENOENT;
+			if (blk.tb_size > r->r_zsize ||
+			    fread(r->r_zbuf, blk.tb_size, 1, r->r_in) != 1) {
+				fprintf(stderr, "Corrupted compressed block\n");
+				return EIO;
+			}
+		} else if (fread(r->r_buf, sizeof r->r_buf[0],
+				 r->r_hdr.tz_block, r->r_in) !=
+			   r->r_hdr.tz_block)
+			return ferror(r->r_in) ? EIO : ENOENT;
+	}
+	return 0;
+}
+
+/*
+ * Finds the offset of block number @block of a seekable trace.
+ */
+static int reader_offset(struct reader *r, u_int64_t block, off_t *offset)
+{
+	if (r->r_zip) {
+		struct trace_ztrailer trailer;
+		u_int64_t             at;
+
+		if (fseeko(r->r_in, -(off_t)sizeof trailer, SEEK_END) != 0 ||
+		    fread(&trailer, sizeof trailer, 1, r->r_in) != 1 ||
+		    trailer.tt_magic != TRACE_ZMAGIC) {
+			fprintf(stderr, "Cannot read block index\n");
+			return EIO;
+		}
+		if (block >= trailer.tt_nr_blocks)
+			return ENOENT;
+		if (fseeko(r->r_in, r->r_start + trailer.tt_index +
+			   block * sizeof at, SEEK_SET) != 0 ||
+		    fread(&at, sizeof at, 1, r->r_in) != 1)
+			return EIO;
+		*offset = r->r_start + at;
+	} else
+		*offset = r->r_start + sizeof r->r_hdr.tz_hdr +
+			block * r->r_hdr.tz_block * sizeof(struct trace_record);
+	return 0;
+}
+
+/*
+ * Positions @r at record number @recno. A pipe is read up to the block of
+ * @recno instead.
+ */
+static int reader_seek(struct reader *r, u_int64_t recno)
+{
+	u_int64_t block;
+	off_t     offset;
+	int       result;
+
+	block = recno / r->r_hdr.tz_block;
+	if (r->r_start < 0)
+		result = reader_skip(r, block);
+	else {
+		result = reader_offset(r, block, &offset);
+		if (result == 0 && fseeko(r->r_in, offset, SEEK_SET) != 0) {
+			perror("seek");
+			result = EIO;
+		}
+	}
+	if (result == 0)
+		result = reader_block(r);
+	if (result == 0) {
+		r->r_pos = recno % r->r_hdr.tz_block;
+		if (r->r_pos >= r->r_nr)
+			result = ENOENT;
+	}
+	return result;
+}
+
+static int record_parse(const char *line, struct trace_record *rec)
+{
+	unsigned int page;
+	unsigned int object;
+	unsigned int index;
+	char         type;
+
+	if (sscanf(line, "%x %x %x %c", &page, &object, &index, &type) != 4)
+		return EINVAL;
+	memset(rec, 0, sizeof *rec);
+	rec->tr_page   = page;
+	rec->tr_object = object;
+	rec->tr_index  = index;
+	rec->tr_type   = type;
+	return 0;
+}
+
+static int encode(FILE *in, FILE *out, int zip)
+{
+	struct writer w;
+	char          line[64];
+	int           result;
+
+	result = writer_init(&w, out, zip);
+	while (result == 0 && fgets(line, sizeof line, in) != NULL) {
+		struct trace_record rec;
+
+		if (record_parse(line, &rec) != 0) {
+			fprintf(stderr, "Malformed input: `%s'\n", line);
+			result = EINVAL;
+		} else
+			result = writer_add(&w, &rec);
+	}
+	if (result == 0)
+		result = writer_fini(&w);
+	return result;
+}
+
+static int decode(FILE *in, FILE *out, u_int64_t start, u_int64_t nr)
+{
+	struct reader r;
+	int           result;
+
+	result = reader_init(&r, in);
+	if (result == 0)
+		result = start > 0 ? reader_seek(&r, start) : reader_block(&r);
+	for (; result == 0 && nr > 0; result = reader_block(&r)) {
+		for (; r.r_pos < r.r_nr && nr > 0; ++r.r_pos, --nr) {
+			struct trace_record *rec;
+
+			rec = &r.r_buf[r.r_pos];
+			fprintf(out, "%8.8x %8.8x %8.8x %c\n",
+				rec->tr_page, rec->tr_object,
+				rec->tr_index, rec->tr_type);
+		}
+	}
+	reader_fini(&r);
+	return result == ENOENT ? 0 : result;
+}
+
+static void usage(void)
+{
+	printf("fstrace [ -h | -z | -d | -s <first> | -n <count> | "
+	       "-o <output> ] [ <input> ]\n\n"
+	       "\t-z\twrite compressed binary trace\n"
+	       "\t-d\tconvert binary or compressed trace to text\n"
+	       "\t-s\twith -d, start from the given record\n"
+	       "\t-n\twith -d, convert at most the given number of records\n"
+	       "\t-o\toutput file (default: standard output)\n");
+}
+
+int main(int argc, char **argv)
+{
+	int        result;
+	int        opt;
+	int        todo;
+	int        zip;
+	u_int64_t  start;
+	u_int64_t  nr;
+	FILE      *in;
+	FILE      *out;
+
+	todo  = 0;
+	zip   = 0;
+	start = 0;
+	nr    = ~0ULL;
+	in    = stdin;
+	out   = stdout;
+	do {
+		opt = getopt(argc, argv, "hzds:n:o:");
+		switch (opt) {
+		case -1:
+			break;
+		case '?':
+		default:
+			fprintf(stderr, "Unable to parse options.\n");
+		case 'h':
+			usage();
+			return 0;
+		case 'z':
+			zip = 1;
+			break;
+		case 'd':
+			todo = 1;
+			break;
+		case 's':
+			start = strtoull(optarg, NULL, 0);
+			break;
+		case 'n':
+			nr = strtoull(optarg, NULL, 0);
+			break;
+		case 'o':
+			out = fopen(optarg, "w");
+			if (out == NULL) {
+				fprintf(stderr, "Cannot open `%s': %s\n",
+					optarg, strerror(errno));
+				return 1;
+			}
+			break;
+		}
+	} while (opt != -1);
+
+	if (optind < argc) {
+		in = fopen(argv[optind], "r");
+		if (in == NULL) {
+			fprintf(stderr, "Cannot open `%s': %s\n",
+				argv[optind], strerror(errno));
+			return 1;
+		}
+	}
+
+	result = todo ? decode(in, out, start, nr) : encode(in, out, zip);
+	if (fclose(out) != 0 && result == 0) {
+		perror("close");
+		result = EIO;
+	}
+	return result;
+}
+
+/*
+ * Author: Nikita Danilov <Danilov@Gmail.COM>
+ * Keywords: VM page replacement simulation tracing
+ *
+ * Copyright (C) 2006 Nikita Danilov <Danilov@Gmail.COM>
+ *
+ * This file is a part of itself.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
@@ -20,14 +20,26 @@
 #include <errno.h>
 #include <assert.h>
 #include <time.h>
+#include <pthread.h>
+#include <stdint.h>
 
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include <zlib.h>
 
 #include "list.h"
 
+#include "trace.h"
+
 #define ergo(a, b) (!(a) || (b))
 #define equi(a, b) (!!(a) == !!(b))
 #define sizeof_array(a) (sizeof(a)/sizeof((a)[0]))
+#ifndef __always_inline
+#define __always_inline inline __attribute__((always_inline))
+#endif
 
 /*
  * min()/max() macros that also do
@@ -83,45 +95,74 @@ struct frame;
 struct mm;
 struct repalg;
 struct object;
+struct source;
+struct reuse;
 
 /*
  * virtual page.
  *
  * One of these exist for every page in every file accessed in the given
- * trace.
+ * trace. Fields touched on every access are packed here, in 32 bytes, with
+ * 32 bit page, frame and file numbers. Fields needed only when the page is
+ * first seen or truncated are in struct vpage_cold.
  *
  */
 struct vpage {
 	/*
-	 * page number
+	 * physical frame this page resides in, or NULL if not resident
 	 */
-	vpage_no_t       v_no;
+	struct frame    *v_frame;
 	/*
-	 * logical offset of page within file
+	 * page number
 	 */
-	pgoff_t          v_index;
+	u_int32_t        v_no;
 	/*
 	 * flags from enum vpage_flags
 	 */
 	u_int32_t        v_flags;
 	/*
-	 * file object this page belongs to
+	 * reserved for replacement policy use: linkage into a list of pages,
+	 * see struct vlist. Currently used by 2Q algorithm to keep track of
+	 * A1out list, and by CAR and ARC algorithms.
 	 */
-	struct object   *v_object;
+	u_int32_t        v_next;
+	u_int32_t        v_prev;
 	/*
-	 * physical frame this page resides in, or NULL if not resident
+	 * slot of this page in the stack (plus one), or 0 if the page is not
+	 * on the stack. Used by miss ratio curve computation (-C).
 	 */
-	struct frame    *v_frame;
+	u_int32_t        v_slot;
+	/*
+	 * number of the file object this page belongs to
+	 */
+	u_int32_t        v_object;
+};
+
+/*
+ * rarely used part of virtual page, kept apart from struct vpage, at the
+ * same position in ->m_vpages_cold.
+ */
+struct vpage_cold {
 	/*
-	 * linkage into list of pages belonging to the same file object
+	 * logical offset of page within file
 	 */
-	struct list_head v_pages;
+	pgoff_t          vc_index;
+};
+
+/*
+ * list of pages, linked through ->v_next and ->v_prev. Pages are referred to
+ * by their number plus one, 0 terminates the list.
+ */
+struct vlist {
+	u_int32_t        vl_first;
+	u_int32_t        vl_last;
+};
+
+enum {
 	/*
-	 * reserved for replacement policy use. Currently used by OPT
-	 * algorithm to keep time-sorted list of future access times, and by
-	 * 2Q algorithm to keep track of A1out list, and by CAR algorithm.
+	 * maximal number of pages, frames and files.
 	 */
-	struct list_head v_stuff;
+	MM_MAX = 0xffffffffU
 };
 
 /*
@@ -140,7 +181,13 @@ enum vpage_flags {
 	VP_PBIT1 = 1 << (VP_PSHIFT + 1),
 	VP_PBIT2 = 1 << (VP_PSHIFT + 2),
 	VP_PBIT3 = 1 << (VP_PSHIFT + 3),
-	VP_PMASK = VP_PBIT0|VP_PBIT1|VP_PBIT2|VP_PBIT3
+	VP_PMASK = VP_PBIT0|VP_PBIT1|VP_PBIT2|VP_PBIT3,
+	/*
+	 * Low bits of the page index, checked on every access against the
+	 * record, without touching struct vpage_cold.
+	 */
+	VP_ISHIFT = 16,
+	VP_IMASK = 0x7fff << VP_ISHIFT
 };
 
 /*
@@ -152,7 +199,7 @@ struct frame {
 	/*
 	 * frame number.
 	 */
-	frame_no_t       f_no;
+	u_int32_t        f_no;
 	/*
 	 * frame flags, taken from enum frame_flags
 	 */
@@ -201,9 +248,23 @@ struct object {
 	 */
 	inode_no_t       o_no;
 	/*
-	 * list of pages, linked through ->v_pages.
+	 * pages of the file, by index: radix tree of height ->o_height, or
+	 * NULL. Slots of leaf nodes hold page numbers plus one.
 	 */
-	struct list_head o_pages;
+	struct radix_node *o_pages;
+	u_int32_t        o_height;
+};
+
+/*
+ * node of the radix tree of file pages.
+ */
+enum {
+	RADIX_SHIFT = 6,
+	RADIX_NR    = 1 << RADIX_SHIFT
+};
+
+struct radix_node {
+	void            *rn_slot[RADIX_NR];
 };
 
 /*
@@ -228,11 +289,423 @@ struct access {
 	 */
 	char             a_type;
 	/*
-	 * linkage into list. This is used by access look-ahead functions to
-	 * allow certain "clairvoyant" replacement policies (OPT and WORST
-	 * currently) to look at the future accesses.
+	 * number of trace records read for this access, that is, one plus
+	 * the number of records rejected since the previous one. Used by
+	 * warm-up and windows (see SERIES). Kept in 32 bits, in a hole of the
+	 * structure.
+	 */
+	u_int32_t        a_skip;
+	/*
+	 * fields from ->a_time to ->a_comm are only known for raw traces, and
+	 * are zero otherwise.
+	 */
+	/*
+	 * time of the access, in microseconds since the start of the trace.
+	 */
+	u_int64_t        a_time;
+	/*
+	 * process that made the access.
+	 */
+	u_int16_t        a_pid;
+	/*
+	 * device and inode number of the accessed file.
+	 */
+	u_int32_t        a_dev;
+	u_int32_t        a_ino;
+	/*
+	 * command name of the process.
+	 */
+	char             a_comm[16];
+	/*
+	 * fields below are set for every format. They follow ->a_comm to fill
+	 * its tail hole.
+	 */
+	/*
+	 * increase of ->s_nr_seen of the source, over the records read for
+	 * this access.
+	 */
+	u_int32_t        a_seen;
+	/*
+	 * sequential number of the access, counting from the first replayed
+	 * one.
+	 */
+	u_int64_t        a_no;
+};
+
+/*
+ * input trace format.
+ */
+struct srcfmt {
+	/*
+	 * name, used to select format on the command line.
+	 */
+	const char *sf_name;
+	/*
+	 * called once before the first record is read. Can consume trace
+	 * header.
+	 */
+	int       (*sf_open )(struct source *src);
+	/*
+	 * releases resources allocated by ->sf_open().
+	 */
+	void      (*sf_close)(struct source *src);
+	/*
+	 * reads next record from the trace. Returns ENOENT at the end of the
+	 * trace.
+	 */
+	int       (*sf_read )(struct source *src, struct access *access);
+	/*
+	 * positions the source so that the next ->sf_read() returns record
+	 * number @recno. Optional: formats without it are skipped through by
+	 * reading. Returns ESPIPE if the trace is not seekable.
+	 */
+	int       (*sf_seek )(struct source *src, u_int64_t recno);
+	/*
+	 * true if records carry time-stamps, process ids, command names,
+	 * devices and inodes (see struct access).
+	 */
+	int         sf_meta;
+};
+
+/*
+ * fields that accesses can be filtered on.
+ */
+enum filter_field {
+	FF_PID,
+	FF_COMM,
+	FF_DEV,
+	FF_INO,
+	FF_TIME,
+	FF_TYPE,
+	FF_NR
+};
+
+/*
+ * set of accepted values of a 32 bit field.
+ */
+struct filter_set {
+	u_int32_t *fs_val;
+	u_int32_t  fs_nr;
+};
+
+/*
+ * Filter, applied to accesses as they are read from the source. An access
+ * passes if it matches the predicate on every field in ->fl_fields. Multiple
+ * values of the same field are alternatives.
+ */
+struct filter {
+	/*
+	 * bitmask of fields with predicates, (1 << FF_*).
+	 */
+	unsigned int      fl_fields;
+	/*
+	 * accepted process ids, one bit per pid.
+	 */
+	unsigned char     fl_pid[(1 << 16) / 8];
+	struct filter_set fl_dev;
+	struct filter_set fl_ino;
+	/*
+	 * accepted command names.
+	 */
+	char            (*fl_comm)[16];
+	u_int32_t         fl_nr_comm;
+	/*
+	 * accepted time intervals [start, end), in microseconds since the
+	 * start of the trace.
+	 */
+	u_int64_t       (*fl_time)[2];
+	u_int32_t         fl_nr_time;
+	/*
+	 * accepted access types.
+	 */
+	unsigned char     fl_type[256];
+};
+
+/*
+ * open-addressing hash table mapping 4-word keys to dense identifiers,
+ * assigned in order of first appearance.
+ */
+struct idmap_entry {
+	u_int32_t ie_key[4];
+	/*
+	 * identifier plus one. Zero marks an empty slot.
+	 */
+	u_int32_t ie_id;
+};
+
+struct idmap {
+	struct idmap_entry *im_table;
+	/*
+	 * number of slots, a power of two.
+	 */
+	u_int64_t           im_size;
+	/*
+	 * number of occupied slots, also the next identifier to be assigned.
+	 */
+	u_int64_t           im_nr;
+};
+
+/*
+ * state of a source once a given number of records is read, taken by the
+ * reader for a checkpoint (see CHECKPOINT). This is what determines page and
+ * file numbers, and time-stamps, of the following records.
+ */
+struct source_mark {
+	/*
+	 * the state is taken once ->s_recno reaches ->sm_recno.
+	 */
+	u_int64_t            sm_recno;
+	/*
+	 * number of accesses returned by access_read() before the mark, or
+	 * ~0ULL until the state is taken.
+	 */
+	u_int64_t            sm_access;
+	/*
+	 * error taking the state.
+	 */
+	int                  sm_result;
+	u_int64_t            sm_time;
+	u_int32_t            sm_time_raw;
+	int                  sm_time_set;
+	u_int64_t            sm_nr_seen;
+	struct idmap         sm_pages;
+	struct idmap         sm_files;
+	struct idmap         sm_sampled;
+};
+
+/*
+ * source of accesses: an input trace in some format.
+ */
+struct source {
+	/*
+	 * format of the trace.
+	 */
+	struct srcfmt       *s_fmt;
+	/*
+	 * stream the trace is read from.
+	 */
+	FILE                *s_file;
+	/*
+	 * trace header, for formats that have it. Zeroed otherwise.
+	 */
+	struct trace_header  s_hdr;
+	/*
+	 * offset of the trace in ->s_file, or -1 if the stream is not seekable.
+	 */
+	off_t                s_start;
+	/*
+	 * buffer of binary or raw records. Records [s_pos, s_nr) are not yet
+	 * consumed.
+	 */
+	void                *s_buf;
+	size_t               s_pos;
+	size_t               s_nr;
+	/*
+	 * memory mapped trace: bytes [s_cur, s_end) are not yet consumed.
+	 */
+	char                *s_map;
+	size_t               s_map_size;
+	const char          *s_cur;
+	const char          *s_end;
+	/*
+	 * dense page and file numbers assigned to raw records.
+	 */
+	struct idmap         s_pages;
+	struct idmap         s_files;
+	/*
+	 * compressed trace: records in a full block, buffers for column-wise
+	 * and compressed block.
+	 */
+	u_int32_t            s_zblock;
+	unsigned char       *s_col;
+	unsigned char       *s_zbuf;
+	uLong                s_zsize;
+	/*
+	 * time of the last raw record, in microseconds since the start of the
+	 * trace, and its raw time-stamp.
+	 */
+	u_int64_t            s_time;
+	u_int32_t            s_time_raw;
+	int                  s_time_set;
+	/*
+	 * filter, or NULL if all accesses are accepted.
+	 */
+	struct filter       *s_filter;
+	/*
+	 * spatial sampling: pages whose hash is below ->s_sample (out of
+	 * SAMPLE_MOD) are kept, or all pages if ->s_sample is 0. Kept pages
+	 * are renumbered densely through ->s_sampled.
+	 */
+	u_int64_t            s_sample;
+	struct idmap         s_sampled;
+	/*
+	 * number of page references (reads, read-aheads and faults) seen by
+	 * the sampling.
+	 */
+	u_int64_t            s_nr_seen;
+	/*
+	 * number of records read from the start of the trace, including
+	 * skipped and rejected ones.
+	 */
+	u_int64_t            s_recno;
+	/*
+	 * number of accesses returned by access_read() since the source was
+	 * positioned.
+	 */
+	u_int64_t            s_nr_access;
+	/*
+	 * checkpoint to take the state for, or NULL.
+	 */
+	struct source_mark  *s_mark;
+};
+
+/*
+ * batch of consecutive accesses, decoded by the reader thread.
+ */
+enum {
+	BATCH_NR = 1024
+};
+
+struct batch {
+	/*
+	 * linkage into window->w_batches.
+	 */
+	struct list_head b_linkage;
+	/*
+	 * ->a_no of the first access in the batch.
+	 */
+	u_int64_t        b_first;
+	u_int32_t        b_nr;
+	struct access    b_rec[BATCH_NR];
+};
+
+/*
+ * whole decoded trace, kept in memory and shared read-only by simulations
+ * running in parallel (-j). All batches but the last one are full.
+ */
+struct replay {
+	struct batch   **rp_batch;
+	u_int64_t        rp_nr;
+	/*
+	 * what the ring returned after the last batch.
+	 */
+	int              rp_result;
+};
+
+/*
+ * stream of accesses, fed to all simulated memories in lockstep.
+ */
+struct window {
+	/*
+	 * ring, accesses are read from.
+	 */
+	struct ring     *w_ring;
+	/*
+	 * if not NULL, accesses are taken from the decoded trace instead,
+	 * and ->w_batches is unused.
+	 */
+	const struct replay *w_replay;
+	/*
+	 * batches taken from the ring and not yet completely consumed, in
+	 * order. Accesses that are looked ahead at stay here until
+	 * access_get() returns them.
+	 */
+	struct list_head w_batches;
+	/*
+	 * ->a_no of the next access returned by access_get().
+	 */
+	u_int64_t        w_next;
+	/*
+	 * batch of the last looked up access, to make sequential look-ahead
+	 * cheap.
+	 */
+	struct batch    *w_peek;
+};
+
+/*
+ * next reads of pages, for clairvoyant algorithms. See future_add().
+ */
+struct future {
+	/*
+	 * ->fu_next[i] is the number of the first read of the page of access
+	 * i + 1 after it, or FUTURE_NEVER. Accesses are numbered from 1, as
+	 * in ->m_total. While the array is built, it holds page numbers
+	 * instead, see future_add().
+	 */
+	u_int64_t       *fu_next;
+	u_int64_t        fu_nr;
+	/*
+	 * allocated size of ->fu_next, while it is in memory.
+	 */
+	u_int64_t        fu_size;
+	/*
+	 * temporary file, or -1 if the array is in memory. Once the array is
+	 * complete, ->fu_next is mapped from the file.
+	 */
+	int              fu_fd;
+	/*
+	 * while the array is built in the file: the chunk being written, or
+	 * rewritten by future_done().
+	 */
+	u_int64_t       *fu_buf;
+	u_int64_t        fu_buf_nr;
+	/*
+	 * largest page number seen, plus one.
+	 */
+	u_int64_t        fu_nr_pages;
+	/*
+	 * number of accesses simulated before the first one in the array,
+	 * when resuming from a checkpoint. Next reads returned by
+	 * future_next() are numbered from the start of the original run.
+	 */
+	u_int64_t        fu_base;
+};
+
+#define FUTURE_NEVER (~0ULL - 1)
+
+/*
+ * Single-producer single-consumer ring of batches.
+ *
+ * The reader thread decodes the trace from the source into batches and
+ * publishes them by advancing ->r_tail. The simulation consumes them by
+ * advancing ->r_head. Both indices only grow, and each is written by one
+ * side only, so the fast path takes no locks. A side that finds the ring
+ * full (empty) sleeps on ->r_wait, after announcing itself in ->r_full
+ * (->r_empty), so that the other side knows to wake it up.
+ *
+ * Consumed batches go back to the reader through ->r_free, a second ring in
+ * the opposite direction, so that in the steady state batches are reused
+ * rather than allocated and freed. Nobody waits on it: the reader allocates a
+ * batch when it is empty, and the consumer frees one when it is full.
+ */
+enum {
+	RING_NR      = 16,
+	RING_FREE_NR = 2 * RING_NR
+};
+
+struct ring {
+	struct batch    *r_slot[RING_NR];
+	u_int64_t        r_head;
+	u_int64_t        r_tail;
+	struct batch    *r_free[RING_FREE_NR];
+	u_int64_t        r_free_head;
+	u_int64_t        r_free_tail;
+	/*
+	 * result of the last source read, ENOENT at the end of the trace. Valid
+	 * once ->r_done is set.
+	 */
+	int              r_result;
+	int              r_done;
+	/*
+	 * set by the consumer to stop the reader early.
 	 */
-	struct list_head a_linkage;
+	int              r_stop;
+	int              r_full;
+	int              r_empty;
+	pthread_mutex_t  r_lock;
+	pthread_cond_t   r_wait;
+	struct source   *r_source;
+	pthread_t        r_thread;
 };
 
 enum car_queue {
@@ -253,17 +726,18 @@ struct mm {
 	/*
 	 * selected replacement algorithm.
 	 */
-	struct repalg   *m_alg;
+	const struct repalg *m_alg;
 	/*
 	 * number of physical frames in the primary storage.
 	 */
 	u_int64_t        m_nr_frames;
 	/*
-	 * number of virtual pages in the virtual memory.
+	 * number of virtual pages in the virtual memory. Grows when the trace
+	 * references new pages.
 	 */
 	u_int64_t        m_nr_vpages;
 	/*
-	 * number of file objects.
+	 * number of file objects. Grows when the trace references new files.
 	 */
 	u_int64_t        m_nr_objects;
 	/*
@@ -275,13 +749,23 @@ struct mm {
 	 */
 	struct frame    *m_frames;
 	/*
-	 * an array of pages (virtual memory).
+	 * frames [->m_nr_fresh, ->m_nr_frames) were never used, and are free
+	 * without being on ->m_freelist.
+	 */
+	u_int64_t        m_nr_fresh;
+	/*
+	 * pages (virtual memory), allocated in chunks of MM_CHUNK, so that
+	 * pages never move as the array grows. Use vpage_get().
+	 */
+	struct vpage   **m_vpages;
+	/*
+	 * rarely used parts of pages, in chunks parallel to ->m_vpages.
 	 */
-	struct vpage    *m_vpages;
+	struct vpage_cold **m_vpages_cold;
 	/*
-	 * an array of file objects.
+	 * file objects, allocated in chunks of MM_CHUNK. Use object_get().
 	 */
-	struct object   *m_objects;
+	struct object  **m_objects;
 	/*
 	 * list of free frames, linked through ->f_linkage.
 	 */
@@ -300,9 +784,20 @@ struct mm {
 	struct list_head m_fifo2;
 
 	/*
-	 * list of looked-ahead accesses.
+	 * accesses, shared by all simulated memories.
 	 */
-	struct list_head m_future;
+	struct window   *m_window;
+	/*
+	 * next reads, shared by all simulated memories, for algorithms with
+	 * ->r_future.
+	 */
+	const struct future *m_future;
+	/*
+	 * random number generator, private to this memory, so that memories
+	 * simulated in lockstep do not disturb each other's sequences.
+	 */
+	struct random_data m_rand;
+	char             m_rand_state[128];
 
 	/*
 	 * number of cache hits (i.e., avoided page faults).
@@ -346,11 +841,14 @@ struct mm {
 
 		struct list_head am;
 		struct list_head a1in;
-		struct list_head a1out;
+		struct vlist     a1out;
 	} m_q2;
 	struct {
 		struct {
-			struct list_head list;
+			/*
+			 * pages in CQ_NONE are not linked.
+			 */
+			struct vlist     list;
 			u_int64_t        nr;
 		} q[CQ_NR];
 		/*
@@ -375,6 +873,56 @@ struct mm {
 		int              prev_priority;
 
 	} m_linux;
+	struct {
+		/*
+		 * Fenwick tree counting occupied slots. Slots are handed out
+		 * in access order, so the number of occupied slots after
+		 * page's slot is its stack distance.
+		 */
+		u_int32_t       *tree;
+		/*
+		 * segment tree of maxima of ->key-s of slots, ->size leaves
+		 * starting at ->key[->size]. Used by opt_depth() instead of
+		 * ->tree.
+		 */
+		u_int64_t       *key;
+		/*
+		 * page occupying each slot, or STACK_FREE, or STACK_GHOST.
+		 */
+		vpage_no_t      *owner;
+		/*
+		 * number of slots handed out so far.
+		 */
+		u_int64_t        nr;
+		/*
+		 * number of allocated slots.
+		 */
+		u_int64_t        size;
+		/*
+		 * number of occupied slots.
+		 */
+		u_int64_t        used;
+		/*
+		 * slots of ghosts (see lru_depth()), as a max-heap.
+		 */
+		u_int64_t       *ghost;
+		u_int64_t        ghost_nr;
+		u_int64_t        ghost_size;
+		/*
+		 * maximal number of slots. Accesses deeper than that are
+		 * misses for all memory sizes of interest, and opt_depth()
+		 * drops pages falling below the limit.
+		 */
+		u_int64_t        limit;
+	} m_stack;
+	struct {
+		/*
+		 * segment tree of maxima of next reads of pages in frames,
+		 * ->size leaves starting at ->next[->size], one per frame.
+		 */
+		u_int64_t       *next;
+		u_int64_t        size;
+	} m_opt;
 };
 
 /*
@@ -420,6 +968,24 @@ struct repalg {
 	 * internally from ->r_{read,ra,write,fault}() implementations.
 	 */
 	void      (*r_alloc)(struct mm *mm, struct vpage *pg);
+	/*
+	 * called instead of all the above to compute miss ratio curve (-C).
+	 * Processes access of @type to @pg and returns in @depth its stack
+	 * distance: the smallest number of frames for which this access is a
+	 * hit, or 0 if the access misses with any number of frames. NULL for
+	 * algorithms that are not stack algorithms.
+	 */
+	int       (*r_depth)(struct mm *mm, struct vpage *pg, char type,
+			     u_int64_t *depth);
+	/*
+	 * called to set algorithm parameters, given to -a as
+	 * <name>:<param>:... NULL for algorithms without parameters.
+	 */
+	int       (*r_param)(struct mm *mm, int nr, const u_int64_t *param);
+	/*
+	 * true if the algorithm needs ->m_future.
+	 */
+	int         r_future;
 };
 
 enum {
@@ -431,37 +997,291 @@ enum {
 
 static int verbose = 0;
 
+/*
+ * Pages, files and frames are valid when zeroed, and are set up when first
+ * used, rather than when allocated. Their arrays are mapped, so that nothing
+ * is populated before it is touched: with a large -V, -f or -M, the simulation
+ * starts at once, and only what the trace uses takes memory. A chunk of pages
+ * is a huge page.
+ */
+enum {
+	MM_CHUNK_SHIFT = 16,
+	MM_CHUNK       = 1 << MM_CHUNK_SHIFT,
+	/*
+	 * huge page size. Larger areas are aligned to it and advised to use
+	 * transparent huge pages.
+	 */
+	MM_HUGE        = 1 << 21,
+	/*
+	 * smaller areas come from malloc.
+	 */
+	MM_AREA_MIN    = 1 << 16
+};
+
 static void vpage_print(const char *prefix, const struct vpage *pg);
 
-static void frame_fini(struct mm *mm, struct frame *frame)
+/*
+ * Allocates @size bytes of zeroed memory, populated on first touch. Areas of
+ * at least MM_HUGE bytes are huge page aligned.
+ */
+static void *mm_area_alloc(size_t size)
 {
-	list_del_init(&frame->f_linkage);
+	char   *area;
+	size_t  align;
+	size_t  head;
+
+	if (size < MM_AREA_MIN)
+		return calloc(1, size);
+	align = size < MM_HUGE ? MM_AREA_MIN : MM_HUGE;
+	size = (size + align - 1) & ~(align - 1);
+	area = mmap(NULL, size + align, PROT_READ|PROT_WRITE,
+		    MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+	if (area == MAP_FAILED)
+		return NULL;
+	/*
+	 * Trim the mapping to an aligned area.
+	 */
+	head = (align - ((uintptr_t)area & (align - 1))) & (align - 1);
+	if (head > 0)
+		munmap(area, head);
+	munmap(area + head + size, align - head);
+	area += head;
+	if (align == MM_HUGE)
+		madvise(area, size, MADV_HUGEPAGE);
+	return area;
 }
 
-static void frame_init(struct mm *mm, struct frame *frame)
+static void mm_area_free(void *area, size_t size)
 {
-	list_add_tail(&frame->f_linkage, &mm->m_freelist);
-}
+	size_t align;
 
-static void vpage_fini(struct mm *mm, struct vpage *page)
+	if (size < MM_AREA_MIN)
+		free(area);
+	else if (area != NULL) {
+		align = size < MM_HUGE ? MM_AREA_MIN : MM_HUGE;
+		munmap(area, (size + align - 1) & ~(align - 1));
+	}
+}
+
+static void frame_fini(struct mm *mm, struct frame *frame)
 {
+	list_del_init(&frame->f_linkage);
 }
 
-static void vpage_init(struct mm *mm, struct vpage *page)
+static void radix_free(struct radix_node *node, u_int32_t height)
 {
-	INIT_LIST_HEAD(&page->v_pages);
-	INIT_LIST_HEAD(&page->v_stuff);
+	int i;
+
+	if (node != NULL && height > 1) {
+		for (i = 0; i < RADIX_NR; ++i)
+			radix_free(node->rn_slot[i], height - 1);
+	}
+	free(node);
 }
 
 static void object_fini(struct mm *mm, struct object *obj)
 {
+	radix_free(obj->o_pages, obj->o_height);
+	obj->o_pages  = NULL;
+	obj->o_height = 0;
+}
+
+/*
+ * Grows chunked array *@dir, currently holding *@nr elements of @size bytes,
+ * so that it has at least @target elements. New elements are zeroed. Existing
+ * elements are not moved.
+ */
+static int chunk_grow(void ***dir, u_int64_t *nr, u_int64_t target,
+		      size_t size)
+{
+	u_int64_t have;
+	u_int64_t need;
+	void    **area;
+
+	have = *nr >> MM_CHUNK_SHIFT;
+	need = (target + MM_CHUNK - 1) >> MM_CHUNK_SHIFT;
+	if (need <= have)
+		return 0;
+	area = realloc(*dir, need * sizeof area[0]);
+	if (area == NULL)
+		return ENOMEM;
+	*dir = area;
+	for (; have < need; ++have) {
+		area[have] = mm_area_alloc(MM_CHUNK * size);
+		if (area[have] == NULL)
+			return ENOMEM;
+		*nr = (have + 1) << MM_CHUNK_SHIFT;
+	}
+	return 0;
+}
+
+static struct vpage *vpage_at(const struct mm *mm, vpage_no_t vno)
+{
+	return &mm->m_vpages[vno >> MM_CHUNK_SHIFT][vno & (MM_CHUNK - 1)];
+}
+
+static struct vpage_cold *vpage_cold(const struct mm *mm,
+				     const struct vpage *pg)
+{
+	return &mm->m_vpages_cold[pg->v_no >> MM_CHUNK_SHIFT]
+		[pg->v_no & (MM_CHUNK - 1)];
+}
+
+static struct object *object_at(const struct mm *mm, inode_no_t ino)
+{
+	return &mm->m_objects[ino >> MM_CHUNK_SHIFT][ino & (MM_CHUNK - 1)];
+}
+
+static int vpages_grow(struct mm *mm, u_int64_t nr)
+{
+	vpage_no_t vno;
+	u_int64_t  nr_cold;
+	int        result;
+
+	if (nr > MM_MAX)
+		return EFBIG;
+	vno = mm->m_nr_vpages;
+	nr_cold = vno;
+	result = chunk_grow((void ***)&mm->m_vpages_cold, &nr_cold, nr,
+			    sizeof(struct vpage_cold));
+	if (result == 0)
+		result = chunk_grow((void ***)&mm->m_vpages, &mm->m_nr_vpages,
+				    nr, sizeof(struct vpage));
+	/*
+	 * Pages are usable once both halves are allocated.
+	 */
+	mm->m_nr_vpages = min_t(u_int64_t, mm->m_nr_vpages, nr_cold);
+	/*
+	 * New pages are in no CAR queue.
+	 */
+	mm->m_car.q[CQ_NONE].nr += mm->m_nr_vpages - vno;
+	return result;
+}
+
+static int objects_grow(struct mm *mm, u_int64_t nr)
+{
+	if (nr > MM_MAX)
+		return EFBIG;
+	return chunk_grow((void ***)&mm->m_objects, &mm->m_nr_objects, nr,
+			  sizeof(struct object));
+}
+
+/*
+ * Returns page number @vno, allocating it if necessary. Returns NULL if out
+ * of memory.
+ */
+static struct vpage *vpage_get(struct mm *mm, vpage_no_t vno)
+{
+	if (vno >= mm->m_nr_vpages && vpages_grow(mm, vno + 1) != 0)
+		return NULL;
+	return vpage_at(mm, vno);
+}
+
+static struct object *object_get(struct mm *mm, inode_no_t ino)
+{
+	if (ino >= mm->m_nr_objects && objects_grow(mm, ino + 1) != 0)
+		return NULL;
+	return object_at(mm, ino);
+}
+
+/*
+ * FILE PAGES
+ *
+ * Pages of a file are kept in a radix tree by their index, as in the page
+ * cache, so that truncate visits only the pages past the truncation point.
+ */
+
+/*
+ * True if the radix tree of height @height covers @index.
+ */
+static int radix_covers(u_int32_t height, pgoff_t index)
+{
+	return height * RADIX_SHIFT >= 64 ||
+		index < (1ULL << (height * RADIX_SHIFT));
+}
+
+/*
+ * Adds page @vno at @index to @obj.
+ */
+static int object_page_add(struct object *obj, pgoff_t index, vpage_no_t vno)
+{
+	struct radix_node  *node;
+	void              **slot;
+	u_int32_t           level;
+
+	while (obj->o_height == 0 || !radix_covers(obj->o_height, index)) {
+		if (obj->o_pages != NULL) {
+			node = calloc(1, sizeof *node);
+			if (node == NULL)
+				return ENOMEM;
+			node->rn_slot[0] = obj->o_pages;
+			obj->o_pages = node;
+		}
+		obj->o_height++;
+	}
+	slot = (void **)&obj->o_pages;
+	for (level = obj->o_height; level > 0; --level) {
+		if (*slot == NULL) {
+			*slot = calloc(1, sizeof *node);
+			if (*slot == NULL)
+				return ENOMEM;
+		}
+		node = *slot;
+		slot = &node->rn_slot[(index >> ((level - 1) * RADIX_SHIFT)) &
+				      (RADIX_NR - 1)];
+	}
+	*slot = (void *)(uintptr_t)(vno + 1);
+	return 0;
+}
+
+/*
+ * Calls @fn for the pages at or past @from in subtree @node of height
+ * @height, covering indices starting at @base, in index order. Stops at the
+ * first error.
+ */
+static int radix_scan(struct mm *mm, struct radix_node *node, u_int32_t height,
+		      pgoff_t base, pgoff_t from,
+		      int (*fn)(struct mm *, struct vpage *, const void *),
+		      const void *arg)
+{
+	u_int32_t shift;
+	pgoff_t   first;
+	int       i;
+	int       result;
+
+	shift = (height - 1) * RADIX_SHIFT;
+	i = from > base ? (from - base) >> shift : 0;
+	for (result = 0; result == 0 && i < RADIX_NR; ++i) {
+		void *slot = node->rn_slot[i];
+
+		first = base + ((pgoff_t)i << shift);
+		if (slot == NULL)
+			continue;
+		if (height > 1)
+			result = radix_scan(mm, slot, height - 1, first,
+					    max_t(pgoff_t, from, first),
+					    fn, arg);
+		else
+			result = fn(mm, vpage_at(mm, (uintptr_t)slot - 1),
+				    arg);
+	}
+	return result;
 }
 
-static void object_init(struct mm *mm, struct object *obj)
+/*
+ * Calls @fn for the pages of @obj at or past index @from, in index order.
+ */
+static int object_pages_from(struct mm *mm, struct object *obj, pgoff_t from,
+			     int (*fn)(struct mm *, struct vpage *,
+				       const void *),
+			     const void *arg)
 {
-	INIT_LIST_HEAD(&obj->o_pages);
+	if (obj->o_pages == NULL || !radix_covers(obj->o_height, from))
+		return 0;
+	return radix_scan(mm, obj->o_pages, obj->o_height, 0, from, fn, arg);
 }
 
+#ifndef NDEBUG
 static int frame_invariant(const struct mm *mm, const struct frame *frame)
 {
 	return
@@ -475,24 +1295,35 @@ static int vpage_invariant(const struct mm *mm, const struct vpage *page)
 		page->v_no < mm->m_nr_vpages &&
 		ergo(page->v_frame != NULL, page->v_frame->f_page == page);
 }
+#endif
 
 static struct frame *frame_from_list(struct list_head *head)
 {
 	return container_of(head, struct frame, f_linkage);
 }
 
+/*
+ * Takes the frame freed last, or the next frame never used. This is the
+ * order of a free list initially holding all frames in order.
+ */
 static struct frame *frame_free_get(struct mm *mm)
 {
 	struct list_head *head;
 	struct frame     *frame;
 
-	assert(!list_empty(&mm->m_freelist));
 	assert(mm->m_nr_free > 0);
 
-	head = mm->m_freelist.next;
-	list_del_init(head);
+	if (list_empty(&mm->m_freelist)) {
+		assert(mm->m_nr_fresh < mm->m_nr_frames);
+		frame = &mm->m_frames[mm->m_nr_fresh];
+		frame->f_no = mm->m_nr_fresh++;
+		INIT_LIST_HEAD(&frame->f_linkage);
+	} else {
+		head = mm->m_freelist.next;
+		list_del_init(head);
+		frame = frame_from_list(head);
+	}
 	mm->m_nr_free--;
-	frame = frame_from_list(head);
 	assert(frame->f_page == NULL);
 	assert(frame->f_flags == 0);
 	return frame;
@@ -519,9 +1350,75 @@ static void vpage_place(struct mm *mm, struct vpage *pg, struct frame *frame)
 		vpage_print("P  ", pg);
 }
 
-static struct vpage *vpage_from_list(struct list_head *head)
+/*
+ * VLIST
+ *
+ * Lists of pages linked by page numbers, see struct vlist.
+ */
+
+static void vlist_init(struct vlist *head)
+{
+	head->vl_first = head->vl_last = 0;
+}
+
+static struct vpage *vlist_page(const struct mm *mm, u_int32_t link)
+{
+	assert(link != 0);
+	return vpage_at(mm, link - 1);
+}
+
+static struct vpage *vlist_first(const struct mm *mm, const struct vlist *head)
+{
+	return vlist_page(mm, head->vl_first);
+}
+
+static struct vpage *vlist_last(const struct mm *mm, const struct vlist *head)
+{
+	return vlist_page(mm, head->vl_last);
+}
+
+/*
+ * Adds @pg at the beginning of @head.
+ */
+static void vlist_add(struct mm *mm, struct vlist *head, struct vpage *pg)
+{
+	pg->v_prev = 0;
+	pg->v_next = head->vl_first;
+	if (head->vl_first != 0)
+		vlist_page(mm, head->vl_first)->v_prev = pg->v_no + 1;
+	else
+		head->vl_last = pg->v_no + 1;
+	head->vl_first = pg->v_no + 1;
+}
+
+/*
+ * Adds @pg at the end of @head.
+ */
+static void vlist_add_tail(struct mm *mm, struct vlist *head, struct vpage *pg)
+{
+	pg->v_next = 0;
+	pg->v_prev = head->vl_last;
+	if (head->vl_last != 0)
+		vlist_page(mm, head->vl_last)->v_next = pg->v_no + 1;
+	else
+		head->vl_first = pg->v_no + 1;
+	head->vl_last = pg->v_no + 1;
+}
+
+/*
+ * Removes @pg from @head, which it is on.
+ */
+static void vlist_del(struct mm *mm, struct vlist *head, struct vpage *pg)
 {
-	return container_of(head, struct vpage, v_stuff);
+	if (pg->v_prev != 0)
+		vlist_page(mm, pg->v_prev)->v_next = pg->v_next;
+	else
+		head->vl_first = pg->v_next;
+	if (pg->v_next != 0)
+		vlist_page(mm, pg->v_next)->v_prev = pg->v_prev;
+	else
+		head->vl_last = pg->v_prev;
+	pg->v_next = pg->v_prev = 0;
 }
 
 static void frame_pageout(struct mm *mm, struct frame *frame)
@@ -540,10 +1437,7 @@ static void frame_pageout(struct mm *mm, struct frame *frame)
 
 static void vpage_pagein(struct mm *mm, struct vpage *pg)
 {
-	struct frame *frame;
-
-	frame = pg->v_frame;
-	assert(frame != NULL);
+	assert(pg->v_frame != NULL);
 	if (verbose & VERBOSE_TRACE)
 		vpage_print("I  ", pg);
 }
@@ -576,17 +1470,231 @@ static void frame_steal(struct mm *mm, struct frame *frame)
 	}
 }
 
-static struct access *access_from_list(struct list_head *head)
+/*
+ * FILTER
+ */
+static const char *filter_names[FF_NR] = {
+	[FF_PID]  = "pid",
+	[FF_COMM] = "comm",
+	[FF_DEV]  = "dev",
+	[FF_INO]  = "ino",
+	[FF_TIME] = "time",
+	[FF_TYPE] = "type"
+};
+
+static int filter_set_has(const struct filter_set *set, u_int32_t val)
+{
+	u_int32_t i;
+
+	for (i = 0; i < set->fs_nr; ++i) {
+		if (set->fs_val[i] == val)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Returns true if @access passes @filter. Cheapest and most selective
+ * predicates are checked first.
+ */
+static int filter_match(const struct filter *filter,
+			const struct access *access)
+{
+	unsigned int fields;
+
+	fields = filter->fl_fields;
+	if ((fields & (1 << FF_TYPE)) &&
+	    !filter->fl_type[(unsigned char)access->a_type])
+		return 0;
+	if ((fields & (1 << FF_PID)) &&
+	    !(filter->fl_pid[access->a_pid / 8] & (1 << (access->a_pid % 8))))
+		return 0;
+	if (fields & (1 << FF_TIME)) {
+		u_int32_t i;
+
+		for (i = 0; i < filter->fl_nr_time; ++i) {
+			if (access->a_time >= filter->fl_time[i][0] &&
+			    access->a_time < filter->fl_time[i][1])
+				break;
+		}
+		if (i == filter->fl_nr_time)
+			return 0;
+	}
+	if ((fields & (1 << FF_DEV)) &&
+	    !filter_set_has(&filter->fl_dev, access->a_dev))
+		return 0;
+	if ((fields & (1 << FF_INO)) &&
+	    !filter_set_has(&filter->fl_ino, access->a_ino))
+		return 0;
+	if (fields & (1 << FF_COMM)) {
+		u_int32_t i;
+
+		for (i = 0; i < filter->fl_nr_comm; ++i) {
+			if (!strncmp(filter->fl_comm[i], access->a_comm,
+				     sizeof access->a_comm))
+				break;
+		}
+		if (i == filter->fl_nr_comm)
+			return 0;
+	}
+	return 1;
+}
+
+static int filter_set_add(struct filter_set *set, u_int32_t val)
+{
+	u_int32_t *area;
+
+	area = realloc(set->fs_val, (set->fs_nr + 1) * sizeof area[0]);
+	if (area == NULL)
+		return ENOMEM;
+	set->fs_val = area;
+	set->fs_val[set->fs_nr++] = val;
+	return 0;
+}
+
+/*
+ * Parses seconds since the start of the trace into microseconds. Empty
+ * string stands for @dflt.
+ */
+static int filter_time(const char *str, const char *end, u_int64_t dflt,
+		       u_int64_t *usec)
+{
+	char  *eoc;
+	double sec;
+
+	if (str == end) {
+		*usec = dflt;
+		return 0;
+	}
+	sec = strtod(str, &eoc);
+	if (eoc != end || sec < 0)
+		return EINVAL;
+	*usec = sec * 1000000;
+	return 0;
+}
+
+/*
+ * Adds predicate "<field>=<value>[,<value>...]" to @filter.
+ */
+static int filter_parse(struct filter *filter, const char *arg)
+{
+	enum filter_field field;
+	const char       *val;
+	const char       *end;
+	size_t            len;
+	int               result;
+
+	val = strchr(arg, '=');
+	if (val == NULL)
+		return EINVAL;
+	len = val - arg;
+	for (field = 0; field < FF_NR; ++field) {
+		if (strlen(filter_names[field]) == len &&
+		    !strncmp(filter_names[field], arg, len))
+			break;
+	}
+	if (field == FF_NR)
+		return EINVAL;
+	filter->fl_fields |= 1 << field;
+	for (val++, result = 0; result == 0 && *val != 0; val = end) {
+		const char   *dash;
+		char         *eoc;
+		unsigned long num;
+
+		end = val + strcspn(val, ",");
+		num = 0;
+		if (field == FF_PID || field == FF_DEV || field == FF_INO) {
+			/*
+			 * Devices and inodes in hex, as fslog prints them.
+			 */
+			num = strtoul(val, &eoc, field == FF_PID ? 0 : 16);
+			if (eoc != end || eoc == val)
+				return EINVAL;
+		}
+		switch (field) {
+		case FF_PID:
+			if (num >= 1 << 16)
+				return EINVAL;
+			filter->fl_pid[num / 8] |= 1 << (num % 8);
+			break;
+		case FF_DEV:
+			result = filter_set_add(&filter->fl_dev, num);
+			break;
+		case FF_INO:
+			result = filter_set_add(&filter->fl_ino, num);
+			break;
+		case FF_COMM: {
+			char (*area)[16];
+
+			area = realloc(filter->fl_comm, (filter->fl_nr_comm + 1) *
+				       sizeof area[0]);
+			if (area == NULL)
+				return ENOMEM;
+			filter->fl_comm = area;
+			memset(area[filter->fl_nr_comm], 0, sizeof area[0]);
+			memcpy(area[filter->fl_nr_comm++], val,
+			       min_t(size_t, end - val, sizeof area[0]));
+			break;
+		}
+		case FF_TIME: {
+			u_int64_t (*area)[2];
+
+			dash = memchr(val, '-', end - val);
+			if (dash == NULL)
+				return EINVAL;
+			area = realloc(filter->fl_time, (filter->fl_nr_time + 1) *
+				       sizeof area[0]);
+			if (area == NULL)
+				return ENOMEM;
+			filter->fl_time = area;
+			area += filter->fl_nr_time++;
+			result = filter_time(val, dash, 0, &(*area)[0]);
+			if (result == 0)
+				result = filter_time(dash + 1, end, ~0ULL,
+						     &(*area)[1]);
+			break;
+		}
+		case FF_TYPE:
+			for (; val < end; ++val)
+				filter->fl_type[(unsigned char)*val] = 1;
+			break;
+		default:
+			assert(0);
+		}
+		if (*end == ',')
+			end++;
+	}
+	return result;
+}
+
+static void filter_fini(struct filter *filter)
+{
+	free(filter->fl_dev.fs_val);
+	free(filter->fl_ino.fs_val);
+	free(filter->fl_comm);
+	free(filter->fl_time);
+}
+
+/*
+ * TEXT
+ *
+ * fslog.trace as produced by fslog.awk: one access per line.
+ */
+static int text_open(struct source *src)
+{
+	return 0;
+}
+
+static void text_close(struct source *src)
 {
-	return container_of(head, struct access, a_linkage);
 }
 
-static int access_read(struct access *access)
+static int text_read(struct source *src, struct access *access)
 {
 	int result;
 	char line[64];
 
-	if (!fgets(line, sizeof line, stdin))
+	if (!fgets(line, sizeof line, src->s_file))
 		result = ENOENT;
 	else if (sscanf(line, "%llx %llx %llx %c", &access->a_page,
 			&access->a_object,
@@ -598,1005 +1706,1795 @@ static int access_read(struct access *access)
 	return result;
 }
 
-static int access_get(struct mm *mm, struct access *access)
-{
-	int result;
+/*
+ * BIN
+ *
+ * Binary trace, see trace.h. Records are read in large batches, and decoded
+ * without any parsing.
+ */
+enum {
+	BIN_BUF_NR = 4096
+};
 
-	if (!list_empty(&mm->m_future)) {
-		struct access *tomorrow;
+static int bin_open(struct source *src)
+{
+	struct trace_header *hdr;
 
-		tomorrow = access_from_list(mm->m_future.next);
-		list_del_init(&tomorrow->a_linkage);
-		*access = *tomorrow;
-		free(tomorrow);
-		result = 0;
-	} else
-		result = access_read(access);
-	return result;
+	hdr = &src->s_hdr;
+	if (fread(hdr, sizeof *hdr, 1, src->s_file) != 1) {
+		fprintf(stderr, "Cannot read trace header\n");
+		return EINVAL;
+	}
+	if (hdr->th_magic != TRACE_MAGIC ||
+	    hdr->th_version != TRACE_VERSION ||
+	    hdr->th_recsize != sizeof(struct trace_record)) {
+		fprintf(stderr, "Not a binary trace: %8.8x %u %u\n",
+			hdr->th_magic, hdr->th_version, hdr->th_recsize);
+		return EINVAL;
+	}
+	src->s_buf = malloc(BIN_BUF_NR * sizeof(struct trace_record));
+	return src->s_buf != NULL ? 0 : ENOMEM;
 }
 
-static int access_look_ahead(struct mm *mm, struct access **access)
+static void bin_close(struct source *src)
 {
-	int result;
-	struct access *forecast;
+	free(src->s_buf);
+	src->s_buf = NULL;
+}
 
-	forecast = *access;
-	if (forecast == NULL)
-		forecast = access_from_list(&mm->m_future);
+static void record_decode(struct source *src, struct access *access)
+{
+	const struct trace_record *rec;
 
-	if (forecast->a_linkage.next != &mm->m_future) {
-		*access = access_from_list(forecast->a_linkage.next);
-		result = 0;
-	} else {
-		forecast = malloc(sizeof *forecast);
-		if (forecast != NULL) {
-			result = access_read(forecast);
-			if (result == 0) {
-				list_add_tail(&forecast->a_linkage,
-					      &mm->m_future);
-				*access = forecast;
-			} else
-				free(forecast);
-		} else
-			result = ENOMEM;
-	}
-	return result;
+	rec = (const struct trace_record *)src->s_buf + src->s_pos++;
+	access->a_page   = rec->tr_page;
+	access->a_object = rec->tr_object;
+	access->a_index  = rec->tr_index;
+	access->a_type   = rec->tr_type;
 }
 
-static int generic_init(struct mm *mm)
+static int bin_read(struct source *src, struct access *access)
 {
+	if (src->s_pos == src->s_nr) {
+		src->s_pos = 0;
+		src->s_nr  = fread(src->s_buf, sizeof(struct trace_record),
+				   BIN_BUF_NR, src->s_file);
+		if (src->s_nr == 0)
+			return ferror(src->s_file) ? EIO : ENOENT;
+	}
+	record_decode(src, access);
 	return 0;
 }
 
-static void generic_fini(struct mm *mm)
+static int bin_seek(struct source *src, u_int64_t recno)
 {
+	if (src->s_start < 0)
+		return ESPIPE;
+	if (fseeko(src->s_file, src->s_start + sizeof src->s_hdr +
+		   recno * sizeof(struct trace_record), SEEK_SET) != 0)
+		return errno;
+	src->s_pos = src->s_nr = 0;
+	return 0;
 }
 
-static void generic_read(struct mm *mm, struct vpage *pg)
+/*
+ * ZBIN
+ *
+ * Compressed binary trace, see trace.h and "fstrace -z". Blocks are
+ * decompressed one at a time into the same buffer that BIN uses. The block
+ * index at the end of the trace is used by zbin_seek() to start decompression
+ * at the block containing the target record.
+ */
+static int zbin_open(struct source *src)
 {
-	mm->m_alg->r_alloc(mm, pg);
-	vpage_pagein(mm, pg);
+	struct trace_header *hdr;
+	u_int32_t            tail[2];
+
+	hdr = &src->s_hdr;
+	if (fread(hdr, sizeof *hdr, 1, src->s_file) != 1 ||
+	    fread(tail, sizeof tail, 1, src->s_file) != 1) {
+		fprintf(stderr, "Cannot read trace header\n");
+		return EINVAL;
+	}
+	if (hdr->th_magic != TRACE_ZMAGIC ||
+	    hdr->th_version != TRACE_VERSION ||
+	    hdr->th_recsize != sizeof(struct trace_record) || tail[0] == 0) {
+		fprintf(stderr, "Not a compressed trace: %8.8x %u %u %u\n",
+			hdr->th_magic, hdr->th_version, hdr->th_recsize,
+			tail[0]);
+		return EINVAL;
+	}
+	src->s_zblock = tail[0];
+	src->s_zsize  = compressBound(src->s_zblock * TRACE_ZRECSIZE);
+	src->s_buf    = malloc(src->s_zblock * sizeof(struct trace_record));
+	src->s_col    = malloc(src->s_zblock * TRACE_ZRECSIZE);
+	src->s_zbuf   = malloc(src->s_zsize);
+	return src->s_buf != NULL && src->s_col != NULL &&
+		src->s_zbuf != NULL ? 0 : ENOMEM;
 }
 
-static void generic_write(struct mm *mm, struct vpage *pg)
+static void zbin_close(struct source *src)
 {
-	mm->m_alg->r_alloc(mm, pg);
+	free(src->s_buf);
+	free(src->s_col);
+	free(src->s_zbuf);
+	src->s_buf  = NULL;
+	src->s_col  = NULL;
+	src->s_zbuf = NULL;
 }
 
-static void generic_punch(struct mm *mm, struct vpage *pg)
+/*
+ * Reads and decompresses the block at the current position of the stream.
+ */
+static int zbin_block(struct source *src)
 {
-	assert(vpage_invariant(mm, pg));
-	if (pg->v_frame != NULL) {
-		struct frame *frame;
+	struct trace_zblock blk;
+	uLong               size;
 
-		frame = pg->v_frame;
-
-		assert(frame_invariant(mm, frame));
-		frame_free(mm, frame);
+	src->s_pos = src->s_nr = 0;
+	if (fread(&blk, sizeof blk, 1, src->s_file) != 1) {
+		fprintf(stderr, "Truncated compressed trace\n");
+		return EIO;
 	}
-	assert(vpage_invariant(mm, pg));
+	if (blk.tb_nr == 0)
+		return ENOENT;
+	size = blk.tb_nr * TRACE_ZRECSIZE;
+	if (blk.tb_nr > src->s_zblock || blk.tb_size > src->s_zsize ||
+	    fread(src->s_zbuf, blk.tb_size, 1, src->s_file) != 1 ||
+	    uncompress(src->s_col, &size, src->s_zbuf, blk.tb_size) != Z_OK ||
+	    size != blk.tb_nr * TRACE_ZRECSIZE) {
+		fprintf(stderr, "Corrupted compressed block\n");
+		return EIO;
+	}
+	trace_zunpack(src->s_col, blk.tb_nr, src->s_buf);
+	src->s_nr = blk.tb_nr;
+	return 0;
 }
 
-static int random_init(struct mm *mm)
+static int zbin_read(struct source *src, struct access *access)
 {
-	srandom(time(NULL));
+	if (src->s_pos == src->s_nr) {
+		int result;
+
+		result = zbin_block(src);
+		if (result != 0)
+			return result;
+	}
+	record_decode(src, access);
 	return 0;
 }
 
-static void random_alloc(struct mm *mm, struct vpage *pg)
+static int zbin_seek(struct source *src, u_int64_t recno)
 {
-	struct frame *victim;
-
-	assert(vpage_invariant(mm, pg));
-
-	if (pg->v_frame == NULL) {
+	struct trace_ztrailer trailer;
+	u_int64_t             block;
+	u_int64_t             at;
+	int                   result;
+
+	if (src->s_start < 0)
+		return ESPIPE;
+	if (fseeko(src->s_file, -(off_t)sizeof trailer, SEEK_END) != 0 ||
+	    fread(&trailer, sizeof trailer, 1, src->s_file) != 1 ||
+	    trailer.tt_magic != TRACE_ZMAGIC) {
+		fprintf(stderr, "Cannot read block index\n");
+		return EIO;
+	}
+	block = recno / src->s_zblock;
+	if (block >= trailer.tt_nr_blocks) {
 		/*
-		 * Miss
+		 * Past the end: position at the terminating block.
 		 */
-		if (mm->m_nr_free == 0) {
-			/*
-			 * XXX random() is long int.
-			 *
-			 * XXX yes, % is bad. Who cares?
-			 */
-			victim = &mm->m_frames[random() % mm->m_nr_frames];
-			frame_steal(mm, victim);
-		}
-		assert(mm->m_nr_free > 0);
-		victim = frame_free_get(mm);
-		vpage_place(mm, pg, victim);
-	}
-	assert(vpage_invariant(mm, pg));
+		at = trailer.tt_index - sizeof(struct trace_zblock);
+	} else if (fseeko(src->s_file, src->s_start + trailer.tt_index +
+			  block * sizeof at, SEEK_SET) != 0 ||
+		   fread(&at, sizeof at, 1, src->s_file) != 1)
+		return EIO;
+	if (fseeko(src->s_file, src->s_start + at, SEEK_SET) != 0)
+		return errno;
+	if (block >= trailer.tt_nr_blocks)
+		return 0;
+	result = zbin_block(src);
+	if (result == 0)
+		src->s_pos = recno % src->s_zblock;
+	if (src->s_pos > src->s_nr)
+		src->s_pos = src->s_nr;
+	return result;
 }
 
-static void lru_alloc(struct mm *mm, struct vpage *pg)
-{
-	struct frame *frame;
-
-	assert(vpage_invariant(mm, pg));
+/*
+ * MMAP
+ *
+ * Same text format as TEXT, but the trace file is mapped into memory and
+ * parsed in place. Lines written by fslog.awk have fixed layout
+ *
+ *     "%8.8x %8.8x %8.8s %c\n"
+ *
+ * and each 8-digit hexadecimal field is decoded as a single 64 bit word,
+ * converting all digits in parallel (SWAR). Lines that do not match the
+ * fixed layout are handed to the generic parser.
+ */
+enum {
+	MMAP_LINE = 29
+};
 
-	if (pg->v_frame == NULL) {
-		/*
-		 * Miss
-		 */
-		if (mm->m_nr_free == 0) {
-			assert(!list_empty(&mm->m_lru));
-			frame = frame_from_list(mm->m_lru.prev);
-			frame_steal(mm, frame);
-		}
-		assert(mm->m_nr_free > 0);
-		frame = frame_free_get(mm);
-		vpage_place(mm, pg, frame);
-	}
-	assert(vpage_invariant(mm, pg));
-	frame = pg->v_frame;
-	assert(pg->v_frame != NULL);
-	list_move(&frame->f_linkage, &mm->m_lru);
-}
+#define MMAP_ONES  0x0101010101010101ULL
+#define MMAP_HIGH  0x8080808080808080ULL
 
-static void fifo_alloc(struct mm *mm, struct vpage *pg)
+static u_int64_t mmap_load(const char *p)
 {
-	struct frame *frame;
-
-	assert(vpage_invariant(mm, pg));
+	u_int64_t word;
 
-	if (pg->v_frame == NULL) {
-		/*
-		 * Miss
-		 */
-		if (mm->m_nr_free == 0) {
-			assert(!list_empty(&mm->m_fifo));
-			frame = frame_from_list(mm->m_fifo.prev);
-			frame_steal(mm, frame);
-		}
-		assert(mm->m_nr_free > 0);
-		frame = frame_free_get(mm);
-		vpage_place(mm, pg, frame);
-		assert(list_empty(&frame->f_linkage));
-		list_add(&frame->f_linkage, &mm->m_fifo);
-	}
-	assert(vpage_invariant(mm, pg));
-	assert(pg->v_frame != NULL);
+	memcpy(&word, p, sizeof word);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	word = __builtin_bswap64(word);
+#endif
+	return word;
 }
 
 /*
- * FIFO2
- *
- * FIFO Second Chance.
+ * Returns true iff all 8 bytes of @word are hexadecimal digits.
  */
-static void fifo2_alloc(struct mm *mm, struct vpage *pg)
+static int mmap_hex_valid(u_int64_t word)
 {
-	struct frame *frame;
-
-	assert(vpage_invariant(mm, pg));
+	u_int64_t lower;
+	u_int64_t digit;
+	u_int64_t alpha;
 
-	if (pg->v_frame == NULL) {
-		/*
-		 * Miss
-		 */
-		if (mm->m_nr_free == 0) {
-			assert(!list_empty(&mm->m_fifo2));
-			do {
-				frame = frame_from_list(mm->m_fifo2.prev);
-				if (frame->f_flags & FR_REF) {
-					frame->f_flags &= ~FR_REF;
-					list_move(&frame->f_linkage,
-						  &mm->m_fifo2);
-				} else
-					break;
-			} while (1);
-			frame_steal(mm, frame);
-		}
-		assert(mm->m_nr_free > 0);
-		frame = frame_free_get(mm);
-		vpage_place(mm, pg, frame);
-		assert(list_empty(&frame->f_linkage));
-		list_add(&frame->f_linkage, &mm->m_fifo2);
-	}
-	assert(vpage_invariant(mm, pg));
-	assert(pg->v_frame != NULL);
+	if (word & MMAP_HIGH)
+		return 0;
+	/*
+	 * For a byte b < 0x80, b + (0x80 - k) has the high bit set iff b >= k,
+	 * and never carries into the next byte.
+	 */
+	lower = word | (MMAP_ONES * 0x20);
+	digit = (word + MMAP_ONES * (0x80 - '0')) &
+		~(word + MMAP_ONES * (0x80 - '9' - 1));
+	alpha = (lower + MMAP_ONES * (0x80 - 'a')) &
+		~(lower + MMAP_ONES * (0x80 - 'f' - 1));
+	return ((digit | alpha) & MMAP_HIGH) == MMAP_HIGH;
 }
 
 /*
- * SFIFO
- *
- * From "Segmented FIFO page replacement", by Rollins Turner and Henry Levy
- *
- * http://portal.acm.org/ft_gateway.cfm?id=805473&type=pdf&coll=portal&dl=ACM&CFID=15151515&CFTOKEN=6184618
+ * Decodes 8 hexadecimal digits, most significant first in memory.
  */
-static void sfifo_alloc(struct mm *mm, struct vpage *pg)
+static u_int32_t mmap_hex_decode(u_int64_t word)
 {
-	struct frame *frame;
-
-	assert(vpage_invariant(mm, pg));
+	/*
+	 * Digit value to every byte: '0'..'9' have bit 6 clear, letters have
+	 * it set and their low nibble is 1..6.
+	 */
+	word = (word & (MMAP_ONES * 0x0f)) + 9 * ((word >> 6) & MMAP_ONES);
+	/*
+	 * Combine adjacent nibbles, bytes and half-words.
+	 */
+	word = ((word << 4) + (word >> 8)) & 0x00ff00ff00ff00ffULL;
+	word = ((word << 8) + (word >> 16)) & 0x0000ffff0000ffffULL;
+	return (word << 16) | (word >> 32);
+}
 
-	if (pg->v_frame == NULL) {
-		if (mm->m_nr_free == 0) {
-			while (mm->m_sfifo.tail_nr <=
-			       mm->m_nr_frames * mm->m_sfifo.tail / 100) {
-				/*
-				 * Tail list is too short, populate it.
-				 */
-				frame = frame_from_list(mm->m_fifo.prev);
-				assert(!(frame->f_flags & FR_TAIL));
-				frame->f_flags |= FR_TAIL;
-				list_move(&frame->f_linkage, &mm->m_lru);
-				mm->m_sfifo.tail_nr++;
-			}
-			assert(!list_empty(&mm->m_lru));
-			frame = frame_from_list(mm->m_lru.prev);
-			assert(frame->f_flags & FR_TAIL);
-			frame->f_flags &= ~FR_TAIL;
-			mm->m_sfifo.tail_nr--;
-			frame_steal(mm, frame);
-		}
-		assert(mm->m_nr_free > 0);
-		frame = frame_free_get(mm);
-		vpage_place(mm, pg, frame);
-		assert(list_empty(&frame->f_linkage));
-		list_add(&frame->f_linkage, &mm->m_fifo);
-	} else {
-		frame = pg->v_frame;
-		if (frame->f_flags & FR_TAIL) {
-			frame->f_flags &= ~FR_TAIL;
-			mm->m_sfifo.tail_nr--;
-			list_move(&frame->f_linkage, &mm->m_fifo);
+static int mmap_open(struct source *src)
+{
+	struct stat st;
+	off_t       start;
+	int         fd;
+
+	fd = fileno(src->s_file);
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		fprintf(stderr, "Input must be a regular file for mmap\n");
+		return EINVAL;
+	}
+	start = lseek(fd, 0, SEEK_CUR);
+	if (start < 0 || start > st.st_size)
+		start = 0;
+	src->s_map_size = st.st_size;
+	if (src->s_map_size > 0) {
+		src->s_map = mmap(NULL, src->s_map_size, PROT_READ,
+				  MAP_PRIVATE, fd, 0);
+		if (src->s_map == MAP_FAILED) {
+			src->s_map = NULL;
+			return errno;
 		}
+		madvise(src->s_map, src->s_map_size, MADV_SEQUENTIAL);
 	}
-	assert(vpage_invariant(mm, pg));
-	assert(pg->v_frame != NULL);
+	src->s_cur = src->s_map + start;
+	src->s_end = src->s_map + src->s_map_size;
+	return 0;
 }
 
-/*
- * 2Q
- *
- * From "2Q: A Low Overhead High Performance Buffer Management Replacement
- * Algorithm", by Theodore Johnson and Dennis Shasha.
- *
- * http://www.vldb.org/conf/1994/P439.PDF
- */
-
-static void q2_reclaim_for(struct mm *mm, struct vpage *pg)
+static void mmap_close(struct source *src)
 {
-	struct frame *frame;
-
-	if (mm->m_nr_free == 0) {
-		if (mm->m_q2.a1in_nr > mm->m_nr_frames * mm->m_q2.kin / 100) {
-			struct vpage *tail;
-
-			frame = frame_from_list(mm->m_q2.a1in.prev);
-			list_del_init(&frame->f_linkage);
-			--mm->m_q2.a1in_nr;
-			assert(frame->f_flags & FR_TAIL);
-			frame->f_flags &= ~FR_TAIL;
-			tail = frame->f_page;
-			assert(tail != NULL);
-			assert(list_empty(&tail->v_stuff));
-			list_add(&tail->v_stuff, &mm->m_q2.a1out);
-			if (mm->m_q2.a1out_nr >=
-			    mm->m_nr_frames * mm->m_q2.kout / 100)
-				list_del_init(mm->m_q2.a1out.prev);
-			else
-				++mm->m_q2.a1out_nr;
-		} else {
-			frame = frame_from_list(mm->m_q2.am.prev);
-			assert(!(frame->f_flags & FR_TAIL));
-			list_del_init(&frame->f_linkage);
-			--mm->m_q2.am_nr;
-		}
-		frame_steal(mm, frame);
+	if (src->s_map != NULL) {
+		munmap(src->s_map, src->s_map_size);
+		src->s_map = NULL;
 	}
-	frame = frame_free_get(mm);
-	vpage_place(mm, pg, frame);
 }
 
-static void q2_alloc(struct mm *mm, struct vpage *pg)
+static int mmap_read_slow(struct source *src, struct access *access)
 {
-	struct frame *frame;
-
-	assert(vpage_invariant(mm, pg));
-
-	frame = pg->v_frame;
-	if (frame != NULL) {
-		if (!(frame->f_flags & FR_TAIL))
-			/*
-			 * Frame is in Am list.
-			 */
-			list_move(&frame->f_linkage, &mm->m_q2.am);
-	} else {
-		q2_reclaim_for(mm, pg);
-		frame = pg->v_frame;
-		assert(frame != NULL);
-		assert(list_empty(&frame->f_linkage));
-		if (!list_empty(&pg->v_stuff)) {
-			/*
-			 * Page is in A1out list.
-			 */
-			list_add(&frame->f_linkage, &mm->m_q2.am);
-			++mm->m_q2.am_nr;
-			list_del_init(&pg->v_stuff);
-			--mm->m_q2.a1out_nr;
-		} else {
-			list_add(&frame->f_linkage, &mm->m_q2.a1in);
-			++mm->m_q2.a1in_nr;
-			frame->f_flags |= FR_TAIL;
-		}
+	const char *eol;
+	char        line[64];
+	size_t      len;
+
+	eol = memchr(src->s_cur, '\n', src->s_end - src->s_cur);
+	len = (eol != NULL ? eol + 1 : src->s_end) - src->s_cur;
+	memcpy(line, src->s_cur, min(len, sizeof line - 1));
+	line[min(len, sizeof line - 1)] = 0;
+	src->s_cur += len;
+	if (sscanf(line, "%llx %llx %llx %c", &access->a_page,
+		   &access->a_object, &access->a_index, &access->a_type) != 4) {
+		fprintf(stderr, "Malformed input: `%s'\n", line);
+		return EINVAL;
 	}
+	return 0;
+}
+
+static int mmap_read(struct source *src, struct access *access)
+{
+	const char *p;
+	u_int64_t   page;
+	u_int64_t   object;
+	u_int64_t   index;
+
+	p = src->s_cur;
+	if (p == src->s_end)
+		return ENOENT;
+	if (src->s_end - p < MMAP_LINE ||
+	    p[8] != ' ' || p[17] != ' ' || p[26] != ' ' || p[28] != '\n')
+		return mmap_read_slow(src, access);
+	page   = mmap_load(p);
+	object = mmap_load(p + 9);
+	index  = mmap_load(p + 18);
+	if (!mmap_hex_valid(page) || !mmap_hex_valid(object) ||
+	    !mmap_hex_valid(index))
+		return mmap_read_slow(src, access);
+	access->a_page   = mmap_hex_decode(page);
+	access->a_object = mmap_hex_decode(object);
+	access->a_index  = mmap_hex_decode(index);
+	access->a_type   = p[27];
+	src->s_cur = p + MMAP_LINE;
+	return 0;
 }
 
 /*
- * CAR
+ * RAW
  *
- * From "CAR: Clock with Adaptive Replacement", by Sorav Bansal and Dharmendra
- * S. Modha
- *
- * http://citeseer.ist.psu.edu/bansal04car.html
+ * Raw struct fslog_record-s, as copied from the relay channel by fslog. Dense
+ * page and file numbers are assigned here, in order of first appearance, much
+ * like fslog.awk does, except that files are identified by (dev, ino, gen)
+ * only, without the name.
  */
+enum {
+	RAW_BUF_NR   = 4096,
+	IDMAP_SIZE0  = 1 << 16
+};
 
-static int car_init(struct mm *mm)
+static u_int64_t idmap_hash(const u_int32_t key[4])
 {
-	int i;
-
-	for (i = 0; i < sizeof_array(mm->m_car.q); ++i)
-		INIT_LIST_HEAD(&mm->m_car.q[i].list);
-	mm->m_car.q[CQ_NONE].nr = mm->m_nr_vpages;
-	return 0;
+	u_int64_t h;
+
+	h  = ((u_int64_t)key[0] << 32 | key[1]) * 0x9e3779b97f4a7c15ULL;
+	h ^= ((u_int64_t)key[2] << 32 | key[3]) * 0xc2b2ae3d27d4eb4fULL;
+	h ^= h >> 29;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 32;
+	return h;
 }
 
-static void car_fini(struct mm *mm)
+static struct idmap_entry *idmap_slot(struct idmap_entry *table,
+				      u_int64_t size, const u_int32_t key[4])
 {
+	u_int64_t i;
+
+	for (i = idmap_hash(key) & (size - 1);; i = (i + 1) & (size - 1)) {
+		struct idmap_entry *slot;
+
+		slot = &table[i];
+		if (slot->ie_id == 0 || !memcmp(slot->ie_key, key,
+						sizeof slot->ie_key))
+			return slot;
+	}
 }
 
-static enum car_queue car_queue_get(const struct vpage *pg)
+static int idmap_init(struct idmap *map)
 {
-	return (pg->v_flags & VP_PMASK) >> (VP_PSHIFT + 1);
+	map->im_size  = IDMAP_SIZE0;
+	map->im_nr    = 0;
+	map->im_table = calloc(map->im_size, sizeof map->im_table[0]);
+	return map->im_table != NULL ? 0 : ENOMEM;
 }
 
-static void car_queue_set(struct vpage *pg, enum car_queue q)
+static void idmap_fini(struct idmap *map)
 {
-	pg->v_flags &= ~VP_PMASK;
-	pg->v_flags |= q << (VP_PSHIFT + 1);
+	free(map->im_table);
+	map->im_table = NULL;
 }
 
-static int car_ref_get(const struct vpage *pg)
+/*
+ * Makes @dst a copy of @src.
+ */
+static int idmap_copy(struct idmap *dst, const struct idmap *src)
 {
-	return pg->v_flags & VP_PBIT0;
+	*dst = *src;
+	if (src->im_table == NULL)
+		return 0;
+	dst->im_table = malloc(src->im_size * sizeof dst->im_table[0]);
+	if (dst->im_table == NULL)
+		return ENOMEM;
+	memcpy(dst->im_table, src->im_table,
+	       src->im_size * sizeof dst->im_table[0]);
+	return 0;
 }
 
-static void car_ref_set(struct vpage *pg, int bit)
+static int idmap_grow(struct idmap *map)
 {
-	pg->v_flags |= !!bit * VP_PBIT0;
+	struct idmap_entry *table;
+	u_int64_t           size;
+	u_int64_t           i;
+
+	size  = map->im_size * 2;
+	table = calloc(size, sizeof table[0]);
+	if (table == NULL)
+		return ENOMEM;
+	for (i = 0; i < map->im_size; ++i) {
+		if (map->im_table[i].ie_id != 0)
+			*idmap_slot(table, size,
+				    map->im_table[i].ie_key) = map->im_table[i];
+	}
+	free(map->im_table);
+	map->im_table = table;
+	map->im_size  = size;
+	return 0;
 }
 
-
-static void car_move(struct mm *mm, struct vpage *pg,
-		     enum car_queue t, int tail)
+/*
+ * Returns identifier of @key, assigning the next one if @key is new.
+ */
+static int idmap_get(struct idmap *map, const u_int32_t key[4], u_int64_t *id)
 {
-	enum car_queue q;
+	struct idmap_entry *slot;
 
-	q = car_queue_get(pg);
+	slot = idmap_slot(map->im_table, map->im_size, key);
+	if (slot->ie_id == 0) {
+		/*
+		 * Keep load factor below 1/2.
+		 */
+		if (2 * (map->im_nr + 1) > map->im_size) {
+			int result;
 
-	--mm->m_car.q[q].nr;
-	++mm->m_car.q[t].nr;
-	if (tail)
-		list_move_tail(&pg->v_stuff, &mm->m_car.q[t].list);
-	else
-		list_move(&pg->v_stuff, &mm->m_car.q[t].list);
-	car_queue_set(pg, t);
-	assert(equi(pg->v_frame != NULL,
-		    car_queue_get(pg) == CQ_T1 || car_queue_get(pg) == CQ_T2));
+			result = idmap_grow(map);
+			if (result != 0)
+				return result;
+			slot = idmap_slot(map->im_table, map->im_size, key);
+		}
+		memcpy(slot->ie_key, key, sizeof slot->ie_key);
+		slot->ie_id = ++map->im_nr;
+	}
+	*id = slot->ie_id - 1;
+	return 0;
 }
 
-static struct vpage *car_queue(struct mm *mm, enum car_queue q, int tail)
+static int raw_open(struct source *src)
 {
-	struct vpage *pg;
+	int result;
 
-	assert(mm->m_car.q[q].nr > 0);
+	src->s_buf = malloc(RAW_BUF_NR * sizeof(struct fslog_record));
+	if (src->s_buf == NULL)
+		return ENOMEM;
+	result = idmap_init(&src->s_pages);
+	if (result == 0)
+		result = idmap_init(&src->s_files);
+	return result;
+}
 
-	if (tail)
-		pg = vpage_from_list(mm->m_car.q[q].list.prev);
-	else
-		pg = vpage_from_list(mm->m_car.q[q].list.next);
-	assert(car_queue_get(pg) == q);
-	return pg;
+static void raw_close(struct source *src)
+{
+	idmap_fini(&src->s_files);
+	idmap_fini(&src->s_pages);
+	free(src->s_buf);
+	src->s_buf = NULL;
 }
 
-static void car_replace(struct mm *mm)
+static int raw_read(struct source *src, struct access *access)
 {
-	int found;
-	assert(mm->m_car.q[CQ_T1].nr + mm->m_car.q[CQ_T2].nr + mm->m_nr_free ==
-	       mm->m_nr_frames);
+	const struct fslog_record *rec;
+	u_int32_t                  key[4];
+	int32_t                    delta;
+	int                        result;
+
+	if (src->s_pos == src->s_nr) {
+		src->s_pos = 0;
+		src->s_nr  = fread(src->s_buf, sizeof *rec,
+				   RAW_BUF_NR, src->s_file);
+		if (src->s_nr == 0)
+			return ferror(src->s_file) ? EIO : ENOENT;
+	}
+	rec = (const struct fslog_record *)src->s_buf + src->s_pos++;
+	/*
+	 * Time-stamps are 32 bit microseconds: extend them to 64 bits. They
+	 * can go slightly backwards, keep the trace time monotonic.
+	 */
+	if (!src->s_time_set) {
+		src->s_time_raw = rec->fr_time;
+		src->s_time_set = 1;
+	}
+	delta = rec->fr_time - src->s_time_raw;
+	if (delta > 0) {
+		src->s_time     += delta;
+		src->s_time_raw  = rec->fr_time;
+	}
+	access->a_index = rec->fr_index;
+	access->a_type  = rec->fr_type;
+	access->a_time  = src->s_time;
+	access->a_pid   = rec->fr_pid;
+	access->a_dev   = rec->fr_dev;
+	access->a_ino   = rec->fr_ino;
+	memcpy(access->a_comm, rec->fr_comm, sizeof access->a_comm);
+	/*
+	 * Filter before identifiers are assigned, so that filtered out pages
+	 * and files cost nothing.
+	 */
+	if (src->s_filter != NULL && !filter_match(src->s_filter, access))
+		return EAGAIN;
+
+	key[0] = rec->fr_dev;
+	key[1] = rec->fr_ino;
+	key[2] = rec->fr_gen;
+	key[3] = 0;
+	result = idmap_get(&src->s_files, key, &access->a_object);
+	if (result != 0)
+		return result;
+	key[3] = rec->fr_index;
+	return idmap_get(&src->s_pages, key, &access->a_page);
+}
 
-	found = 0;
-	do {
-		struct vpage *pg;
-		enum car_queue target;
-		int ref;
+struct srcfmt fmts[] = {
+	{
+		.sf_name  = "text",
+		.sf_open  = text_open,
+		.sf_close = text_close,
+		.sf_read  = text_read
+	},
+	{
+		.sf_name  = "bin",
+		.sf_open  = bin_open,
+		.sf_close = bin_close,
+		.sf_read  = bin_read,
+		.sf_seek  = bin_seek
+	},
+	{
+		.sf_name  = "zbin",
+		.sf_open  = zbin_open,
+		.sf_close = zbin_close,
+		.sf_read  = zbin_read,
+		.sf_seek  = zbin_seek
+	},
+	{
+		.sf_name  = "mmap",
+		.sf_open  = mmap_open,
+		.sf_close = mmap_close,
+		.sf_read  = mmap_read
+	},
+	{
+		.sf_name  = "raw",
+		.sf_open  = raw_open,
+		.sf_close = raw_close,
+		.sf_read  = raw_read,
+		.sf_meta  = 1
+	},
+	{
+		.sf_name = NULL
+	}
+};
 
-		if (mm->m_car.q[CQ_T1].nr >= max(1ULL, mm->m_car.p)) {
-			pg = car_queue(mm, CQ_T1, 0);
-			target = CQ_B1;
-		} else {
-			pg = car_queue(mm, CQ_T2, 0);
-			target = CQ_B2;
-		}
-		ref = car_ref_get(pg);
-		if (!ref) {
-			found = 1;
-			assert(pg->v_frame != NULL);
-			frame_steal(mm, pg->v_frame);
-		} else {
-			car_ref_set(pg, 0);
-			target = CQ_T2;
-		}
-		car_move(mm, pg, target, ref);
-	} while (!found);
+static int source_init(struct source *src, struct srcfmt *fmt, FILE *file)
+{
+	src->s_fmt   = fmt;
+	src->s_file  = file;
+	src->s_start = ftello(file);
+	return fmt->sf_open(src);
+}
 
-	assert(mm->m_car.q[CQ_T1].nr + mm->m_car.q[CQ_T2].nr + mm->m_nr_free ==
-	       mm->m_nr_frames);
+static void source_fini(struct source *src)
+{
+	src->s_fmt->sf_close(src);
+	idmap_fini(&src->s_sampled);
 }
 
-static void car_dir_replace(struct mm *mm)
+/*
+ * SAMPLE
+ *
+ * Spatially hashed sampling (SHARDS, Waldspurger et al., FAST'15): all
+ * accesses to a page are kept if the hash of the page number is below the
+ * threshold, and dropped otherwise. A cache of M * R frames run over the
+ * accesses sampled at rate R sees approximately R times the hits and misses
+ * of a cache of M frames run over the full trace.
+ *
+ * The fraction of references that are actually sampled deviates from R when
+ * a few pages are very hot, and whether they are sampled or not shifts the
+ * hit ratio a lot. As in SHARDS, the difference is attributed to hits: hot
+ * pages hit almost always. That is, misses are scaled by 1/R and everything
+ * else in the full trace is a hit.
+ */
+enum {
+	SAMPLE_MOD = 1 << 24
+};
+
+static int sample_init(struct source *src, double rate)
 {
-	enum car_queue chop;
+	src->s_sample = rate * SAMPLE_MOD;
+	if (src->s_sample == 0)
+		src->s_sample = 1;
+	return idmap_init(&src->s_sampled);
+}
 
-	assert(mm->m_car.q[CQ_T1].nr + mm->m_car.q[CQ_T2].nr + mm->m_nr_free ==
-	       mm->m_nr_frames);
+static u_int64_t sample_hash(u_int64_t x)
+{
+	/*
+	 * splitmix64 finalizer. The increment keeps page 0 from hashing to 0,
+	 * and being always sampled.
+	 */
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
 
-	if (mm->m_car.q[CQ_T1].nr + mm->m_car.q[CQ_B1].nr == mm->m_nr_frames)
-		chop = CQ_B1;
-	else if (mm->m_car.q[CQ_T1].nr + mm->m_car.q[CQ_T2].nr +
-		 mm->m_car.q[CQ_B1].nr + mm->m_car.q[CQ_B2].nr ==
-		 2 * mm->m_nr_frames)
-		chop = CQ_B2;
-	else
-		return;
+/*
+ * Returns EAGAIN if @access is not sampled, renumbers its page otherwise.
+ *
+ * Truncates are always kept: they apply to all pages of the file past the
+ * truncation point, not only the one in the record.
+ */
+static int sample(struct source *src, struct access *access)
+{
+	u_int32_t key[4];
+
+	if (access->a_type != FSLOG_WRITE && access->a_type != FSLOG_PUNCH)
+		src->s_nr_seen++;
+	if (access->a_type != FSLOG_PUNCH &&
+	    sample_hash(access->a_page) % SAMPLE_MOD >= src->s_sample)
+		return EAGAIN;
+	key[0] = access->a_page;
+	key[1] = access->a_page >> 32;
+	key[2] = 0;
+	key[3] = 0;
+	return idmap_get(&src->s_sampled, key, &access->a_page);
+}
 
-	car_move(mm, car_queue(mm, chop, 1), CQ_NONE, 0);
+/*
+ * Takes the state of @src for its checkpoint mark.
+ */
+static void source_mark_take(struct source *src)
+{
+	struct source_mark *mark = src->s_mark;
+
+	mark->sm_time     = src->s_time;
+	mark->sm_time_raw = src->s_time_raw;
+	mark->sm_time_set = src->s_time_set;
+	mark->sm_nr_seen  = src->s_nr_seen;
+	mark->sm_result   = idmap_copy(&mark->sm_pages, &src->s_pages);
+	if (mark->sm_result == 0)
+		mark->sm_result = idmap_copy(&mark->sm_files, &src->s_files);
+	if (mark->sm_result == 0)
+		mark->sm_result = idmap_copy(&mark->sm_sampled,
+					     &src->s_sampled);
+	/*
+	 * Published last: the simulation checks it without locks.
+	 */
+	__atomic_store_n(&mark->sm_access, src->s_nr_access, __ATOMIC_SEQ_CST);
+}
 
-	assert(mm->m_car.q[CQ_T1].nr + mm->m_car.q[CQ_T2].nr + mm->m_nr_free ==
-	       mm->m_nr_frames);
+/*
+ * Returns the state of @src to the one taken in @mark.
+ */
+static int source_restore(struct source *src, const struct source_mark *mark)
+{
+	int result;
+
+	src->s_time     = mark->sm_time;
+	src->s_time_raw = mark->sm_time_raw;
+	src->s_time_set = mark->sm_time_set;
+	src->s_nr_seen  = mark->sm_nr_seen;
+	idmap_fini(&src->s_pages);
+	idmap_fini(&src->s_files);
+	idmap_fini(&src->s_sampled);
+	result = idmap_copy(&src->s_pages, &mark->sm_pages);
+	if (result == 0)
+		result = idmap_copy(&src->s_files, &mark->sm_files);
+	if (result == 0)
+		result = idmap_copy(&src->s_sampled, &mark->sm_sampled);
+	return result;
 }
 
-static void car_alloc(struct mm *mm, struct vpage *pg)
+/*
+ * Reads the next access that passes the filter and the sampling. ->sf_read()
+ * may apply the filter itself, and return EAGAIN for rejected records.
+ */
+static int access_read(struct source *src, struct access *access)
 {
-	enum car_queue q;
-	enum car_queue target;
-	int dirmiss;
+	u_int64_t recno = src->s_recno;
+	u_int64_t seen  = src->s_nr_seen;
+	int       result;
 
-	q = car_queue_get(pg);
+	do {
+		memset(access, 0, sizeof *access);
+		result = src->s_fmt->sf_read(src, access);
+		if (result == 0 && src->s_filter != NULL &&
+		    !filter_match(src->s_filter, access))
+			result = EAGAIN;
+		if (result == 0 && src->s_sample != 0)
+			result = sample(src, access);
+		if (result == 0)
+			src->s_nr_access++;
+		if (result == 0 || result == EAGAIN) {
+			src->s_recno++;
+			if (src->s_mark != NULL &&
+			    src->s_recno == src->s_mark->sm_recno)
+				source_mark_take(src);
+		}
+	} while (result == EAGAIN);
+	access->a_skip = src->s_recno - recno;
+	access->a_seen = src->s_nr_seen - seen;
+	return result;
+}
 
-	assert(equi(pg->v_frame != NULL, q == CQ_T1 || q == CQ_T2));
-	assert(mm->m_car.q[CQ_T1].nr + mm->m_car.q[CQ_T2].nr + mm->m_nr_free ==
-	       mm->m_nr_frames);
+/*
+ * Skips the first @recno records of the trace.
+ */
+static int source_seek(struct source *src, u_int64_t recno)
+{
+	struct access access;
+	int           result;
+	u_int64_t     i;
+
+	result = src->s_fmt->sf_seek != NULL ?
+		src->s_fmt->sf_seek(src, recno) : ESPIPE;
+	if (result == ESPIPE) {
+		for (result = 0, i = 0; result == 0 && i < recno; ++i)
+			result = access_read(src, &access);
+	}
+	src->s_recno     = recno;
+	src->s_nr_access = 0;
+	return result == ENOENT ? 0 : result;
+}
 
-	dirmiss = q != CQ_B1 && q != CQ_B2;
-	if (pg->v_frame != NULL)
-		car_ref_set(pg, 1);
-	else {
-		struct frame *frame;
+/*
+ * Starts reading @src from record @start again, for a second pass. As in
+ * main(), records are skipped before the filter and the sampling apply.
+ */
+static int source_rewind(struct source *src, u_int64_t start)
+{
+	struct filter *filter;
+	u_int64_t      rate;
+	int            result;
+
+	if (src->s_start < 0 ||
+	    fseeko(src->s_file, src->s_start, SEEK_SET) != 0)
+		return ESPIPE;
+	src->s_fmt->sf_close(src);
+	src->s_pos       = 0;
+	src->s_nr        = 0;
+	src->s_time      = 0;
+	src->s_time_set  = 0;
+	src->s_nr_seen   = 0;
+	src->s_recno     = 0;
+	src->s_nr_access = 0;
+	result = src->s_fmt->sf_open(src);
+	if (result == 0 && start > 0) {
+		filter = src->s_filter;
+		rate   = src->s_sample;
+		src->s_filter = NULL;
+		src->s_sample = 0;
+		result = source_seek(src, start);
+		src->s_filter = filter;
+		src->s_sample = rate;
+	}
+	return result;
+}
 
-		assert(equi(dirmiss, q == CQ_NONE));
+/*
+ * Sleeps until @cond holds, with @flag raised.
+ */
+#define RING_WAIT(ring, flag, cond)					\
+({									\
+	pthread_mutex_lock(&(ring)->r_lock);				\
+	__atomic_store_n(&(ring)->flag, 1, __ATOMIC_SEQ_CST);		\
+	while (!(cond))							\
+		pthread_cond_wait(&(ring)->r_wait, &(ring)->r_lock);	\
+	__atomic_store_n(&(ring)->flag, 0, __ATOMIC_SEQ_CST);		\
+	pthread_mutex_unlock(&(ring)->r_lock);				\
+})
+
+static void ring_wake(struct ring *ring, int *flag)
+{
+	if (__atomic_load_n(flag, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&ring->r_lock);
+		pthread_cond_broadcast(&ring->r_wait);
+		pthread_mutex_unlock(&ring->r_lock);
+	}
+}
 
-		if (mm->m_nr_free == 0) {
+static u_int64_t ring_load(const u_int64_t *idx)
+{
+	return __atomic_load_n(idx, __ATOMIC_SEQ_CST);
+}
 
-			car_replace(mm);
-			/*
-			 * Cache directory replacement.
-			 */
-			if (dirmiss)
-				car_dir_replace(mm);
-		}
+static int ring_stopped(struct ring *ring)
+{
+	return __atomic_load_n(&ring->r_stop, __ATOMIC_SEQ_CST);
+}
 
-		assert(mm->m_nr_free > 0);
-		frame = frame_free_get(mm);
-		vpage_place(mm, pg, frame);
+static int ring_put(struct ring *ring, struct batch *b)
+{
+	u_int64_t tail;
+
+	tail = ring->r_tail;
+	if (tail - ring_load(&ring->r_head) == RING_NR)
+		RING_WAIT(ring, r_full,
+			  tail - ring_load(&ring->r_head) < RING_NR ||
+			  ring_stopped(ring));
+	if (ring_stopped(ring))
+		return ECANCELED;
+	ring->r_slot[tail % RING_NR] = b;
+	__atomic_store_n(&ring->r_tail, tail + 1, __ATOMIC_SEQ_CST);
+	ring_wake(ring, &ring->r_empty);
+	return 0;
+}
 
-		if (dirmiss) {
-			target = CQ_T1;
-		} else {
-			u_int64_t delta;
+/*
+ * Takes a batch given back by the consumer, or allocates a new one.
+ */
+static struct batch *ring_batch(struct ring *ring)
+{
+	struct batch *b;
+	u_int64_t     head;
+
+	head = ring->r_free_head;
+	if (ring_load(&ring->r_free_tail) == head)
+		return malloc(sizeof *b);
+	b = ring->r_free[head % RING_FREE_NR];
+	__atomic_store_n(&ring->r_free_head, head + 1, __ATOMIC_SEQ_CST);
+	return b;
+}
 
-			if (q == CQ_B1) {
-				delta = max(1ULL, mm->m_car.q[CQ_B2].nr /
-					    mm->m_car.q[CQ_B1].nr);
-				mm->m_car.p = min(mm->m_car.p + delta,
-						  mm->m_nr_frames);
-			} else {
-				assert(q == CQ_B2);
+/*
+ * Gives consumed batch @b back to the reader.
+ */
+static void ring_release(struct ring *ring, struct batch *b)
+{
+	u_int64_t tail;
 
-				delta = max(1ULL, mm->m_car.q[CQ_B1].nr /
-					    mm->m_car.q[CQ_B2].nr);
-				mm->m_car.p = min(mm->m_car.p - delta, 0ULL);
-			}
-			target = CQ_T2;
+	tail = ring->r_free_tail;
+	if (tail - ring_load(&ring->r_free_head) == RING_FREE_NR) {
+		free(b);
+		return;
+	}
+	ring->r_free[tail % RING_FREE_NR] = b;
+	__atomic_store_n(&ring->r_free_tail, tail + 1, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Reader thread: decodes the trace into batches until the end of the trace,
+ * an error, or ring_fini().
+ */
+static void *ring_reader(void *arg)
+{
+	struct ring  *ring = arg;
+	struct batch *b;
+	u_int64_t     no;
+	int           result;
+
+	for (no = 0, result = 0; result == 0; ) {
+		b = ring_batch(ring);
+		if (b == NULL) {
+			result = ENOMEM;
+			break;
 		}
-		car_move(mm, pg, target, 1);
-		car_ref_set(pg, 0);
+		b->b_first = no;
+		for (b->b_nr = 0; b->b_nr < BATCH_NR; b->b_nr++) {
+			struct access *access;
+
+			access = &b->b_rec[b->b_nr];
+			result = access_read(ring->r_source, access);
+			if (result != 0)
+				break;
+			access->a_no = no + b->b_nr;
+		}
+		/*
+		 * @b belongs to the consumer once it is in the ring.
+		 */
+		no += b->b_nr;
+		if (b->b_nr == 0 || ring_put(ring, b) != 0) {
+			free(b);
+			break;
+		}
+	}
+	ring->r_result = result;
+	__atomic_store_n(&ring->r_done, 1, __ATOMIC_SEQ_CST);
+	ring_wake(ring, &ring->r_empty);
+	return NULL;
+}
+
+/*
+ * Takes the next batch from the ring.
+ */
+static int ring_get(struct ring *ring, struct batch **b)
+{
+	u_int64_t head;
+
+	head = ring->r_head;
+	if (ring_load(&ring->r_tail) == head)
+		RING_WAIT(ring, r_empty, ring_load(&ring->r_tail) != head ||
+			  __atomic_load_n(&ring->r_done, __ATOMIC_SEQ_CST));
+	if (ring_load(&ring->r_tail) == head)
+		/*
+		 * The reader is done, and the ring is empty.
+		 */
+		return ring->r_result;
+	*b = ring->r_slot[head % RING_NR];
+	__atomic_store_n(&ring->r_head, head + 1, __ATOMIC_SEQ_CST);
+	ring_wake(ring, &ring->r_full);
+	return 0;
+}
+
+static int ring_init(struct ring *ring, struct source *src)
+{
+	int result;
 
+	memset(ring, 0, sizeof *ring);
+	ring->r_source = src;
+	pthread_mutex_init(&ring->r_lock, NULL);
+	pthread_cond_init(&ring->r_wait, NULL);
+	result = pthread_create(&ring->r_thread, NULL, ring_reader, ring);
+	if (result != 0) {
+		pthread_cond_destroy(&ring->r_wait);
+		pthread_mutex_destroy(&ring->r_lock);
 	}
-	assert(equi(pg->v_frame != NULL,
-		    car_queue_get(pg) == CQ_T1 || car_queue_get(pg) == CQ_T2));
+	return result;
 }
 
-static void car_punch(struct mm *mm, struct vpage *pg)
+static void ring_fini(struct ring *ring)
 {
-	generic_punch(mm, pg);
-	car_move(mm, pg, CQ_NONE, 0);
+	__atomic_store_n(&ring->r_stop, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_lock(&ring->r_lock);
+	pthread_cond_broadcast(&ring->r_wait);
+	pthread_mutex_unlock(&ring->r_lock);
+	pthread_join(ring->r_thread, NULL);
+	for (; ring->r_head != ring->r_tail; ring->r_head++)
+		free(ring->r_slot[ring->r_head % RING_NR]);
+	for (; ring->r_free_head != ring->r_free_tail; ring->r_free_head++)
+		free(ring->r_free[ring->r_free_head % RING_FREE_NR]);
+	pthread_cond_destroy(&ring->r_wait);
+	pthread_mutex_destroy(&ring->r_lock);
+}
+
+static int batch_has(const struct batch *b, u_int64_t no)
+{
+	return b->b_first <= no && no < b->b_first + b->b_nr;
 }
 
 /*
- * ARC
- *
- * Shares a lot with CAR.
- *
- * From "ARC: A Self-Tuning, Low Overhead Replacement Cache" by Nimrod
- * Megiddo, Dharmendra Modha
- *
- * http://citeseer.ist.psu.edu/megiddo03arc.html
+ * Looks for the batch containing access number @no in the window. Accesses
+ * are usually taken from the beginning of the window (access_get()) or
+ * looked ahead at near its end, so check these first.
  */
-static void arc_alloc(struct mm *mm, struct vpage *pg)
+static struct batch *window_lookup(struct window *w, u_int64_t no)
 {
-	enum car_queue q;
-	enum car_queue target;
-	u_int64_t      delta;
+	struct batch *b;
+
+	if (list_empty(&w->w_batches))
+		return NULL;
+	b = list_entry(w->w_batches.prev, struct batch, b_linkage);
+	if (no >= b->b_first)
+		return batch_has(b, no) ? b : NULL;
+	list_for_each_entry(b, &w->w_batches, b_linkage) {
+		if (batch_has(b, no))
+			return b;
+	}
+	return NULL;
+}
 
-	q = car_queue_get(pg);
+/*
+ * Finds the access number @no, pulling batches from the ring into the window
+ * as necessary.
+ */
+static int window_find(struct window *w, u_int64_t no,
+		       struct access **access)
+{
+	struct batch *b;
+	int           result;
 
-	assert(equi(pg->v_frame != NULL, q == CQ_T1 || q == CQ_T2));
-	assert(mm->m_car.q[CQ_T1].nr + mm->m_car.q[CQ_T2].nr + mm->m_nr_free ==
-	       mm->m_nr_frames);
+	if (w->w_replay != NULL) {
+		const struct replay *rp = w->w_replay;
 
-	target = CQ_T2;
-	if (pg->v_frame != NULL) {
-		;
-	} else if (q == CQ_B1) {
-		delta = max(1ULL, mm->m_car.q[CQ_B2].nr/mm->m_car.q[CQ_B1].nr);
-		mm->m_car.p = min(mm->m_car.p + delta, mm->m_nr_frames);
-	} else if (q == CQ_B2) {
-		delta = max(1ULL, mm->m_car.q[CQ_B1].nr/mm->m_car.q[CQ_B2].nr);
-		mm->m_car.p = min(mm->m_car.p - delta, 0ULL);
-	} else {
-		struct vpage *tail;
+		if (no / BATCH_NR >= rp->rp_nr ||
+		    !batch_has(rp->rp_batch[no / BATCH_NR], no))
+			return rp->rp_result;
+		*access = &rp->rp_batch[no / BATCH_NR]->b_rec[no % BATCH_NR];
+		return 0;
+	}
+	b = w->w_peek;
+	if (b == NULL || !batch_has(b, no))
+		b = window_lookup(w, no);
+	while (b == NULL) {
+		struct batch *next = NULL;
+
+		result = ring_get(w->w_ring, &next);
+		if (result != 0)
+			return result;
+		list_add_tail(&next->b_linkage, &w->w_batches);
+		if (batch_has(next, no))
+			b = next;
+	}
+	w->w_peek = b;
+	*access = &b->b_rec[no - b->b_first];
+	return 0;
+}
 
-		assert(q == CQ_NONE);
+static void window_init(struct window *w, struct ring *ring,
+			const struct replay *rp)
+{
+	w->w_ring   = ring;
+	w->w_replay = rp;
+	w->w_next = 0;
+	w->w_peek = NULL;
+	INIT_LIST_HEAD(&w->w_batches);
+}
 
-		if (mm->m_car.q[CQ_T1].nr + mm->m_car.q[CQ_B1].nr ==
-		    mm->m_nr_frames) {
-			if (mm->m_car.q[CQ_B1].nr > 0)
-				tail = car_queue(mm, CQ_B1, 1);
-			else {
-				tail = car_queue(mm, CQ_T1, 1);
-				frame_steal(mm, tail->v_frame);
-			}
-			car_move(mm, tail, CQ_NONE, 0);
-		} else {
-			u_int64_t total;
+static void window_fini(struct window *w)
+{
+	struct batch *b;
+	struct batch *tmp;
 
-			total = mm->m_car.q[CQ_T1].nr + mm->m_car.q[CQ_B1].nr +
-				mm->m_car.q[CQ_T2].nr + mm->m_car.q[CQ_B2].nr;
-			if (total >= mm->m_nr_frames) {
-				if (total == 2 * mm->m_nr_frames) {
-					car_move(mm, car_queue(mm, CQ_B2, 1),
-						 CQ_NONE, 0);
-				}
-			}
+	list_for_each_entry_safe(b, tmp, &w->w_batches, b_linkage) {
+		list_del(&b->b_linkage);
+		free(b);
+	}
+	w->w_peek = NULL;
+}
+
+static int access_get(struct window *w, struct access *access)
+{
+	struct access *next;
+	int            result;
+
+	result = window_find(w, w->w_next, &next);
+	if (result == 0 && w->w_replay != NULL) {
+		*access = *next;
+		w->w_next++;
+	} else if (result == 0) {
+		struct batch *b;
+
+		*access = *next;
+		w->w_next++;
+		b = w->w_peek;
+		if (b->b_first + b->b_nr == w->w_next) {
+			/*
+			 * Batch is consumed. Earlier batches are released
+			 * already.
+			 */
+			assert(b == list_entry(w->w_batches.next,
+					       struct batch, b_linkage));
+			list_del(&b->b_linkage);
+			ring_release(w->w_ring, b);
+			w->w_peek = NULL;
 		}
-		target = CQ_T1;
 	}
-	if (pg->v_frame == NULL) {
-		if (mm->m_nr_free == 0) {
-			u_int64_t t1;
-			enum car_queue shrink;
-			enum car_queue expand;
-			struct vpage *shuttle;
+	return result;
+}
 
-			t1 = mm->m_car.q[CQ_T1].nr;
-			if (t1 > 0 &&
-			    (t1 > mm->m_car.p || (q == CQ_B2 &&
-						  t1 == mm->m_car.p))) {
-				shrink = CQ_T1;
-				expand = CQ_B1;
-			} else {
-				shrink = CQ_T2;
-				expand = CQ_B2;
+/*
+ * Takes all batches from @ring.
+ */
+static int replay_init(struct replay *rp, struct ring *ring)
+{
+	struct batch **area;
+	struct batch  *b;
+	u_int64_t      size;
+
+	rp->rp_batch = NULL;
+	rp->rp_nr    = 0;
+	for (size = 0; (rp->rp_result = ring_get(ring, &b)) == 0; ) {
+		if (rp->rp_nr == size) {
+			size = max_t(u_int64_t, 2 * size, 1024);
+			area = realloc(rp->rp_batch, size * sizeof area[0]);
+			if (area == NULL) {
+				free(b);
+				return ENOMEM;
 			}
-			shuttle = car_queue(mm, shrink, 1);
-			frame_steal(mm, shuttle->v_frame);
-			car_move(mm, shuttle, expand, 0);
+			rp->rp_batch = area;
 		}
-		vpage_place(mm, pg, frame_free_get(mm));
+		assert(b->b_first == rp->rp_nr * BATCH_NR);
+		rp->rp_batch[rp->rp_nr++] = b;
 	}
-	car_move(mm, pg, target, 0);
-	assert(equi(pg->v_frame != NULL,
-		    car_queue_get(pg) == CQ_T1 || car_queue_get(pg) == CQ_T2));
+	return 0;
+}
+
+static void replay_fini(struct replay *rp)
+{
+	u_int64_t i;
+
+	for (i = 0; i < rp->rp_nr; ++i)
+		free(rp->rp_batch[i]);
+	free(rp->rp_batch);
 }
 
 /*
- * LINUX
- *
- * This emulates replacement algorithm of Linux 2.6. kernel (mm/vmscan.c)
- *
- * Assumptions:
- *
- *  - no mapped or anonymous pages;
- *
- *  - no kswapd, only direct reclaim;
- *
- *  - all allocations are with GFP_FS;
- *
- *  - no non-fs caches;
+ * Returns in @access the access following *@access, or the next access to be
+ * returned by access_get() if *@access is NULL. Looked ahead accesses stay
+ * valid until access_get() returns them.
+ */
+static int access_look_ahead(struct mm *mm, struct access **access)
+{
+	struct window *w = mm->m_window;
+
+	return window_find(w, *access != NULL ? (*access)->a_no + 1 :
+			   w->w_next, access);
+}
+
+/*
+ * FUTURE
  *
- *  - no low_page reserves;
+ * For clairvoyant algorithms: the next read of the page of every access, as
+ * one 64 bit word per access. It is computed before the simulation: when the
+ * trace can be read twice, by a separate pass over the input (future_scan()),
+ * so that the trace itself need not be kept in memory, otherwise by looking
+ * ahead through the window (future_window()).
  *
- *  - single zone.
+ * The forward pass only stores the page of every access and whether it is a
+ * read. future_done() then walks the array backward, keeping the next read of
+ * every page seen so far, and replaces each word with the next read of its
+ * page. Arrays larger than FUTURE_MEM go to an unlinked temporary file: they
+ * are appended to and walked backward in chunks of FUTURE_CHUNK words, and the
+ * completed array is mapped for the simulation, which reads it in order. The
+ * memory used is then a word per page, plus a chunk, whatever the length of
+ * the trace.
  */
 
-static void linux_add_to_active(struct mm *mm, struct frame *frame)
+enum {
+	/*
+	 * arrays larger than this many bytes go to a temporary file.
+	 */
+	FUTURE_MEM   = 1 << 28,
+	/*
+	 * words read or written to the file at once.
+	 */
+	FUTURE_CHUNK = 1 << 16
+};
+
+static void future_init(struct future *fu)
 {
-	list_add(&frame->f_linkage, &mm->m_linux.active);
-	mm->m_linux.nr_active++;
+	memset(fu, 0, sizeof *fu);
+	fu->fu_fd = -1;
 }
 
-static void linux_add_to_inactive(struct mm *mm, struct frame *frame)
+/*
+ * Moves the array built so far to a temporary file.
+ */
+static int future_spill(struct future *fu)
 {
-	list_add(&frame->f_linkage, &mm->m_linux.inactive);
-	mm->m_linux.nr_inactive++;
+	const char *dir;
+	char        name[4096];
+
+	fu->fu_buf = malloc(FUTURE_CHUNK * sizeof fu->fu_buf[0]);
+	if (fu->fu_buf == NULL)
+		return ENOMEM;
+	dir = getenv("TMPDIR");
+	snprintf(name, sizeof name, "%s/replacement.XXXXXX",
+		 dir != NULL ? dir : "/tmp");
+	fu->fu_fd = mkstemp(name);
+	if (fu->fu_fd < 0)
+		return errno;
+	unlink(name);
+	if (pwrite(fu->fu_fd, fu->fu_next, fu->fu_nr * sizeof fu->fu_next[0],
+		   0) != fu->fu_nr * sizeof fu->fu_next[0])
+		return errno != 0 ? errno : EIO;
+	free(fu->fu_next);
+	fu->fu_next = NULL;
+	fu->fu_size = 0;
+	return 0;
 }
 
-#if 0
-static void linux_del_from_active(struct mm *mm, struct frame *frame)
+/*
+ * Writes (@read == 0) or reads @nr words of @fu->fu_buf at word @first of the
+ * file.
+ */
+static int future_io(struct future *fu, u_int64_t first, u_int64_t nr,
+		     int read)
 {
-	assert(mm->m_linux.nr_active > 0);
-	list_del_init(&frame->f_linkage);
-	mm->m_linux.nr_active--;
+	size_t  size;
+	off_t   off;
+	ssize_t done;
+
+	size = nr * sizeof fu->fu_buf[0];
+	off  = first * sizeof fu->fu_buf[0];
+	done = read ? pread(fu->fu_fd, fu->fu_buf, size, off) :
+		pwrite(fu->fu_fd, fu->fu_buf, size, off);
+	if (done != size)
+		return done < 0 ? errno : EIO;
+	return 0;
 }
-#endif
 
-static void linux_del_from_inactive(struct mm *mm, struct frame *frame)
+/*
+ * Adds the next access to the array.
+ */
+static int future_add(struct future *fu, const struct access *access)
 {
-	assert(mm->m_linux.nr_inactive > 0);
-	list_del_init(&frame->f_linkage);
-	mm->m_linux.nr_inactive--;
+	u_int64_t key;
+	int       result;
+
+	key = access->a_page << 1 |
+		(access->a_type != FSLOG_WRITE && access->a_type != FSLOG_PUNCH);
+	fu->fu_nr_pages = max_t(u_int64_t, fu->fu_nr_pages, access->a_page + 1);
+	if (fu->fu_fd < 0 && fu->fu_nr == fu->fu_size) {
+		u_int64_t  size;
+		u_int64_t *area;
+
+		size = max_t(u_int64_t, 2 * fu->fu_size, 1 << 16);
+		if (size * sizeof area[0] <= FUTURE_MEM) {
+			area = realloc(fu->fu_next, size * sizeof area[0]);
+			if (area == NULL)
+				return ENOMEM;
+			fu->fu_next = area;
+			fu->fu_size = size;
+		} else {
+			result = future_spill(fu);
+			if (result != 0)
+				return result;
+		}
+	}
+	if (fu->fu_fd >= 0) {
+		/*
+		 * The buffer holds words [fu_nr - fu_buf_nr, fu_nr).
+		 */
+		fu->fu_buf[fu->fu_buf_nr++] = key;
+		if (fu->fu_buf_nr == FUTURE_CHUNK) {
+			result = future_io(fu, fu->fu_nr + 1 - FUTURE_CHUNK,
+					   FUTURE_CHUNK, 0);
+			if (result != 0)
+				return result;
+			fu->fu_buf_nr = 0;
+		}
+	} else
+		fu->fu_next[fu->fu_nr] = key;
+	fu->fu_nr++;
+	return 0;
 }
 
-static void linux_activate_page(struct mm *mm, struct frame *frame)
+/*
+ * Replaces keys of accesses [@first, @first + @nr), stored in @area, with
+ * next reads, last access first. @head is the next read of every page after
+ * the range, numbered from 1, or 0.
+ */
+static void future_resolve(u_int64_t *head, u_int64_t *area, u_int64_t first,
+			   u_int64_t nr)
 {
-	if (frame->f_flags & FR_TAIL) {
-		linux_del_from_inactive(mm, frame);
-		frame->f_flags &= ~FR_TAIL;
-		linux_add_to_active(mm, frame);
+	u_int64_t key;
+	u_int64_t pno;
+
+	while (nr-- > 0) {
+		key = area[nr];
+		pno = key >> 1;
+		area[nr] = head[pno] != 0 ? head[pno] : FUTURE_NEVER;
+		if (key & 1)
+			head[pno] = first + nr + 1;
 	}
 }
 
 /*
- * Mark a page as having seen activity.
- *
- * inactive,unreferenced	->	inactive,referenced
- * inactive,referenced		->	active,unreferenced
- * active,unreferenced		->	active,referenced
+ * Completes the array, once all accesses are added.
  */
-static void linux_mark_page_accessed(struct mm *mm, struct frame *frame)
+static int future_done(struct future *fu)
 {
-	if ((frame->f_flags & (FR_TAIL|FR_REF1)) == (FR_TAIL|FR_REF1)) {
-		linux_activate_page(mm, frame);
-		frame->f_flags &= ~FR_REF1;
-	} else
-		frame->f_flags |= FR_REF1;
+	u_int64_t *head;
+	u_int64_t  first;
+	u_int64_t  nr;
+	int        result;
+
+	head = calloc(fu->fu_nr_pages, sizeof head[0]);
+	if (head == NULL)
+		return ENOMEM;
+	result = 0;
+	if (fu->fu_fd < 0)
+		future_resolve(head, fu->fu_next, 0, fu->fu_nr);
+	else {
+		first = fu->fu_nr - fu->fu_buf_nr;
+		nr    = fu->fu_buf_nr;
+		/*
+		 * The last chunk is still in the buffer.
+		 */
+		while (1) {
+			future_resolve(head, fu->fu_buf, first, nr);
+			result = future_io(fu, first, nr, 0);
+			if (result != 0 || first == 0)
+				break;
+			nr     = min_t(u_int64_t, first, FUTURE_CHUNK);
+			first -= nr;
+			result = future_io(fu, first, nr, 1);
+			if (result != 0)
+				break;
+		}
+		free(fu->fu_buf);
+		fu->fu_buf = NULL;
+		if (result == 0) {
+			fu->fu_next = mmap(NULL, fu->fu_nr * sizeof head[0],
+					   PROT_READ, MAP_SHARED, fu->fu_fd, 0);
+			if (fu->fu_next == MAP_FAILED) {
+				fu->fu_next = NULL;
+				result = errno;
+			} else
+				madvise(fu->fu_next,
+					fu->fu_nr * sizeof head[0],
+					MADV_SEQUENTIAL);
+		}
+	}
+	free(head);
+	return result;
 }
 
-enum {
-	DEF_PRIORITY     = 12,
-	SWAP_CLUSTER_MAX = 32
-};
+/*
+ * Builds the array by a separate pass over @src, which is then rewound to
+ * record @start.
+ */
+static int future_scan(struct future *fu, struct source *src, u_int64_t start)
+{
+	struct access access;
+	int           result;
 
-struct scan_control {
-	struct mm    *mm;
-	/* Incremented by the number of inactive pages that were scanned */
-	unsigned long nr_scanned;
+	while ((result = access_read(src, &access)) == 0) {
+		result = future_add(fu, &access);
+		if (result != 0)
+			return result;
+	}
+	if (result == ENOENT)
+		result = future_done(fu);
+	return result != 0 ? result : source_rewind(src, start);
+}
 
-	int may_writepage;
+/*
+ * Builds the array by looking ahead at the whole trace through @w. Accesses
+ * stay in the window until they are simulated.
+ */
+static int future_window(struct future *fu, struct window *w)
+{
+	struct access *access;
+	u_int64_t      no;
+	int            result;
+
+	for (no = w->w_next; (result = window_find(w, no, &access)) == 0; ++no) {
+		result = future_add(fu, access);
+		if (result != 0)
+			return result;
+	}
+	return result == ENOENT ? future_done(fu) : result;
+}
 
-	/* Can pages be swapped as part of reclaim? */
-	int may_swap;
+/*
+ * Returns the next read after access @no, numbered from 1 as ->m_total.
+ */
+static u_int64_t future_next(const struct future *fu, u_int64_t no)
+{
+	u_int64_t next;
 
-	/* This context's SWAP_CLUSTER_MAX. If freeing memory for
-	 * suspend, we effectively ignore SWAP_CLUSTER_MAX.
-	 * In this context, it doesn't matter that we scan the
-	 * whole list at once. */
-	int swap_cluster_max;
+	assert(fu->fu_base < no && no <= fu->fu_base + fu->fu_nr);
+	next = fu->fu_next[no - fu->fu_base - 1];
+	return next != FUTURE_NEVER ? next + fu->fu_base : next;
+}
 
-	int swappiness;
-};
+static void future_fini(struct future *fu)
+{
+	if (fu->fu_fd < 0)
+		free(fu->fu_next);
+	else {
+		if (fu->fu_next != NULL)
+			munmap(fu->fu_next, fu->fu_nr * sizeof fu->fu_next[0]);
+		close(fu->fu_fd);
+	}
+	free(fu->fu_buf);
+}
 
-/* possible outcome of pageout() */
-typedef enum {
-	/* failed to write page out, page is locked */
-	PAGE_KEEP,
-	/* move page to the active list, page is locked */
-	PAGE_ACTIVATE,
-	/* page has been sent to the disk successfully, page is unlocked */
-	PAGE_SUCCESS,
-	/* page is clean and locked */
-	PAGE_CLEAN,
-} pageout_t;
+static int generic_init(struct mm *mm)
+{
+	return 0;
+}
 
-static pageout_t linux_pageout(struct frame *frame)
+static void generic_fini(struct mm *mm)
 {
-	return PAGE_SUCCESS;
 }
 
-static u_int64_t linux_shrink_page_list(struct list_head *page_list,
-					struct scan_control *sc)
+static void generic_read(struct mm *mm, struct vpage *pg)
 {
-	LIST_HEAD(ret_pages);
-	unsigned long nr_reclaimed = 0;
+	mm->m_alg->r_alloc(mm, pg);
+	vpage_pagein(mm, pg);
+}
 
-	while (!list_empty(page_list)) {
+static void generic_write(struct mm *mm, struct vpage *pg)
+{
+	mm->m_alg->r_alloc(mm, pg);
+}
+
+static void generic_punch(struct mm *mm, struct vpage *pg)
+{
+	assert(vpage_invariant(mm, pg));
+	if (pg->v_frame != NULL) {
 		struct frame *frame;
-		int referenced;
 
-		frame = frame_from_list(page_list->prev);
-		list_del_init(&frame->f_linkage);
+		frame = pg->v_frame;
 
-		assert(frame->f_flags & FR_TAIL);
+		assert(frame_invariant(mm, frame));
+		frame_free(mm, frame);
+	}
+	assert(vpage_invariant(mm, pg));
+}
 
-		sc->nr_scanned++;
+static int random_init(struct mm *mm)
+{
+	srandom_r(time(NULL), &mm->m_rand);
+	return 0;
+}
 
-		referenced = frame->f_flags & FR_REF1;
-		frame->f_flags &= ~FR_REF1;
+static void random_alloc(struct mm *mm, struct vpage *pg)
+{
+	struct frame *victim;
 
-		if (frame->f_flags & FR_DIRTY) {
-			if (referenced)
-				goto keep_locked;
-			if (!sc->may_writepage)
-				goto keep_locked;
+	assert(vpage_invariant(mm, pg));
 
-			/* Page is dirty, try to write it out here */
-			switch(linux_pageout(frame)) {
-			case PAGE_KEEP:
-				goto keep_locked;
-			case PAGE_ACTIVATE:
-				goto activate_locked;
-			case PAGE_SUCCESS:
-			case PAGE_CLEAN:
-				; /* try to free the page below */
-			}
-		}
-
-		nr_reclaimed++;
-		frame_steal(sc->mm, frame);
-		continue;
+	if (pg->v_frame == NULL) {
+		/*
+		 * Miss
+		 */
+		if (mm->m_nr_free == 0) {
+			int32_t rnd;
 
-activate_locked:
-		frame->f_flags &= ~FR_TAIL;
-keep_locked:
-		list_add(&frame->f_linkage, &ret_pages);
+			/*
+			 * XXX yes, % is bad. Who cares?
+			 */
+			random_r(&mm->m_rand, &rnd);
+			victim = &mm->m_frames[rnd % mm->m_nr_frames];
+			frame_steal(mm, victim);
+		}
+		assert(mm->m_nr_free > 0);
+		victim = frame_free_get(mm);
+		vpage_place(mm, pg, victim);
 	}
-	list_splice(&ret_pages, page_list);
-	return nr_reclaimed;
+	assert(vpage_invariant(mm, pg));
 }
 
-static u_int64_t linux_isolate_lru_pages(unsigned long nr_to_scan,
-					 struct list_head *src,
-					 struct list_head *dst,
-					 unsigned long *scanned)
+static void lru_alloc(struct mm *mm, struct vpage *pg)
 {
 	struct frame *frame;
-	unsigned long scan;
 
-	for (scan = 0; scan < nr_to_scan && !list_empty(src); scan++) {
-		frame = frame_from_list(src->prev);
-		list_move(&frame->f_linkage, dst);
-	}
+	assert(vpage_invariant(mm, pg));
 
-	*scanned = scan;
-	return scan;
+	if (pg->v_frame == NULL) {
+		/*
+		 * Miss
+		 */
+		if (mm->m_nr_free == 0) {
+			assert(!list_empty(&mm->m_lru));
+			frame = frame_from_list(mm->m_lru.prev);
+			frame_steal(mm, frame);
+		}
+		assert(mm->m_nr_free > 0);
+		frame = frame_free_get(mm);
+		vpage_place(mm, pg, frame);
+	}
+	assert(vpage_invariant(mm, pg));
+	frame = pg->v_frame;
+	assert(pg->v_frame != NULL);
+	list_move(&frame->f_linkage, &mm->m_lru);
 }
 
-static u_int64_t linux_shrink_inactive(unsigned long max_scan,
-					    struct mm *mm,
-					    struct scan_control *sc)
-{
-	LIST_HEAD(page_list);
-	unsigned long nr_scanned = 0;
-	unsigned long nr_reclaimed = 0;
-
-	do {
-		struct frame *frame;
-		unsigned long nr_taken;
-		unsigned long nr_scan;
-		unsigned long nr_freed;
-
-		nr_taken = linux_isolate_lru_pages(sc->swap_cluster_max,
-						   &mm->m_linux.inactive,
-						   &page_list, &nr_scan);
-		mm->m_linux.nr_inactive -= nr_taken;
-		mm->m_linux.pages_scanned += nr_scan;
+/*
+ * Miss ratio curve of LRU.
+ *
+ * LRU is a stack algorithm: pages resident in memory of M frames are the M
+ * topmost pages of a single stack where pages are ordered by the time of last
+ * access. An access hits with M frames iff the accessed page is at depth M or
+ * less, so one pass over the trace computing the depth of every access yields
+ * the number of hits for every M at once.
+ *
+ * Every access is given a new slot, slots are numbered in access order and a
+ * page occupies the slot of its last access. The depth of a page is the number
+ * of occupied slots from its slot onward, counted by a Fenwick tree in
+ * O(log(slots)). When slots run out, occupied ones are renumbered
+ * (stack_compact()), keeping the tree proportional to the number of distinct
+ * pages rather than to the length of the trace.
+ *
+ * Punch frees the frame of a page, after which the next miss uses that frame
+ * instead of evicting. To keep the stack exact, a punched page leaves a ghost
+ * in its slot: memory of M frames has a free frame for every ghost among the
+ * M topmost slots. A page accessed below a ghost (or not on the stack at all)
+ * misses in memories where the ghost is resident, and it uses the ghost's free
+ * frame there. Hence the most recent such ghost is moved to the slot the page
+ * leaves (or discarded, if the page was not on the stack): memories large
+ * enough to hit keep their free frame, smaller memories lose one.
+ */
 
-		nr_scanned += nr_scan;
-		nr_freed = linux_shrink_page_list(&page_list, sc);
-		nr_reclaimed += nr_freed;
+#define STACK_FREE  ((vpage_no_t)~0ULL)
+#define STACK_GHOST ((vpage_no_t)~1ULL)
 
-		if (nr_taken == 0)
-			break;
+enum {
+	STACK_MIN = 1 << 12
+};
 
-		/*
-		 * Put back any unfreeable pages.
-		 */
-		while (!list_empty(&page_list)) {
-			frame = frame_from_list(page_list.prev);
-			list_del_init(&frame->f_linkage);
-			if (!(frame->f_flags & FR_TAIL))
-				linux_add_to_active(mm, frame);
-			else
-				linux_add_to_inactive(mm, frame);
-		}
-  	} while (nr_scanned < max_scan);
-	return nr_reclaimed;
+/*
+ * Adds @delta to the count of occupied slots at @slot.
+ */
+static void stack_add(struct mm *mm, u_int64_t slot, int delta)
+{
+	for (slot++; slot <= mm->m_stack.size; slot += slot & -slot)
+		mm->m_stack.tree[slot - 1] += delta;
 }
 
-static void linux_shrink_active(u_int64_t nr_pages, struct mm *mm,
-				     struct scan_control *sc)
+/*
+ * Returns number of occupied slots before @slot.
+ */
+static u_int64_t stack_prefix(struct mm *mm, u_int64_t slot)
 {
-	unsigned long pgscanned;
-	unsigned long pgmoved;
-	LIST_HEAD(l_hold);	/* The pages which were snipped off */
-	struct frame *frame;
-
-	pgmoved = linux_isolate_lru_pages(nr_pages, &mm->m_linux.active,
-					  &l_hold, &pgscanned);
-	mm->m_linux.pages_scanned += pgscanned;
-	assert(mm->m_linux.nr_active >= pgmoved);
-	mm->m_linux.nr_active -= pgmoved;
+	u_int64_t sum;
 
-	while (!list_empty(&l_hold)) {
-		frame = frame_from_list(l_hold.prev);
-		assert(!(frame->f_flags & FR_TAIL));
-		frame->f_flags |= FR_TAIL;
+	for (sum = 0; slot > 0; slot -= slot & -slot)
+		sum += mm->m_stack.tree[slot - 1];
+	return sum;
+}
 
-		list_move(&frame->f_linkage, &mm->m_linux.inactive);
-		mm->m_linux.nr_inactive++;
+static int ghost_push(struct mm *mm, u_int64_t slot)
+{
+	u_int64_t *heap;
+	u_int64_t  i;
+
+	if (mm->m_stack.ghost_nr == mm->m_stack.ghost_size) {
+		i = max_t(u_int64_t, 2 * mm->m_stack.ghost_size, 64);
+		heap = realloc(mm->m_stack.ghost, i * sizeof heap[0]);
+		if (heap == NULL)
+			return ENOMEM;
+		mm->m_stack.ghost = heap;
+		mm->m_stack.ghost_size = i;
 	}
+	heap = mm->m_stack.ghost;
+	for (i = mm->m_stack.ghost_nr++; i > 0 && heap[(i - 1) / 2] < slot;
+	     i = (i - 1) / 2)
+		heap[i] = heap[(i - 1) / 2];
+	heap[i] = slot;
+	mm->m_stack.owner[slot] = STACK_GHOST;
+	return 0;
 }
 
-static u_int64_t linux_shrink_zone(int prio, struct mm *mm,
-				   struct scan_control *sc)
+/*
+ * Removes the most recent ghost and returns its slot.
+ */
+static u_int64_t ghost_pop(struct mm *mm)
 {
-	unsigned long nr_active;
-	unsigned long nr_inactive;
-	unsigned long nr_to_scan;
-	unsigned long nr_reclaimed = 0;
+	u_int64_t *heap;
+	u_int64_t  top;
+	u_int64_t  last;
+	u_int64_t  nr;
+	u_int64_t  i;
+	u_int64_t  j;
+
+	heap = mm->m_stack.ghost;
+	assert(mm->m_stack.ghost_nr > 0);
+	top  = heap[0];
+	nr   = --mm->m_stack.ghost_nr;
+	last = heap[nr];
+	for (i = 0; (j = 2 * i + 1) < nr; i = j) {
+		if (j + 1 < nr && heap[j + 1] > heap[j])
+			j++;
+		if (heap[j] <= last)
+			break;
+		heap[i] = heap[j];
+	}
+	heap[i] = last;
+	return top;
+}
 
+/*
+ * Renumbers occupied slots to 0, 1, ..., preserving their order, and resizes
+ * the stack to have room for as many new slots as there are occupied ones.
+ */
+static int stack_compact(struct mm *mm)
+{
+	u_int64_t   size;
+	u_int64_t   slot;
+	u_int64_t   used;
+	u_int64_t   ghost;
+	vpage_no_t  owner;
+	u_int32_t  *tree;
+	vpage_no_t *owners;
+
+	size = max_t(u_int64_t, 2 * mm->m_stack.used, STACK_MIN);
+	if (size > mm->m_stack.size) {
+		owners = realloc(mm->m_stack.owner, size * sizeof owners[0]);
+		if (owners == NULL)
+			return ENOMEM;
+		mm->m_stack.owner = owners;
+		tree = realloc(mm->m_stack.tree, size * sizeof tree[0]);
+		if (tree == NULL)
+			return ENOMEM;
+		mm->m_stack.tree = tree;
+	} else
+		size = mm->m_stack.size;
+	owners = mm->m_stack.owner;
+	tree   = mm->m_stack.tree;
+	ghost  = mm->m_stack.ghost_nr;
+	for (slot = used = 0; slot < mm->m_stack.nr; ++slot) {
+		owner = owners[slot];
+		if (owner == STACK_FREE)
+			continue;
+		owners[used] = owner;
+		if (owner == STACK_GHOST)
+			/*
+			 * Slots in decreasing order make a valid max-heap.
+			 */
+			mm->m_stack.ghost[--ghost] = used;
+		else
+			vpage_at(mm, owner)->v_slot = used + 1;
+		used++;
+	}
+	assert(used == mm->m_stack.used);
+	assert(ghost == 0);
 	/*
-	 * Add one to `nr_to_scan' just to make sure that the kernel will
-	 * slowly sift through the active list.
+	 * Build the tree in linear time.
 	 */
-	mm->m_linux.nr_scan_active += (mm->m_linux.nr_active >> prio) + 1;
-	nr_active = mm->m_linux.nr_scan_active;
-	if (nr_active >= sc->swap_cluster_max)
-		mm->m_linux.nr_scan_active = 0;
-	else
-		nr_active = 0;
+	for (slot = 0; slot < size; ++slot)
+		tree[slot] = slot < used;
+	for (slot = 1; slot <= size; ++slot) {
+		u_int64_t up = slot + (slot & -slot);
 
-	mm->m_linux.nr_scan_inactive += (mm->m_linux.nr_inactive >> prio) + 1;
-	nr_inactive = mm->m_linux.nr_scan_inactive;
-	if (nr_inactive >= sc->swap_cluster_max)
-		mm->m_linux.nr_scan_inactive = 0;
-	else
-		nr_inactive = 0;
+		if (up <= size)
+			tree[up - 1] += tree[slot - 1];
+	}
+	mm->m_stack.nr   = used;
+	mm->m_stack.size = size;
+	return 0;
+}
 
-	while (nr_active || nr_inactive) {
-		if (nr_active) {
-			nr_to_scan = min(nr_active,
-					(unsigned long)sc->swap_cluster_max);
-			nr_active -= nr_to_scan;
-			linux_shrink_active(nr_to_scan, mm, sc);
-		}
+static void stack_del(struct mm *mm, u_int64_t slot)
+{
+	mm->m_stack.owner[slot] = STACK_FREE;
+	stack_add(mm, slot, -1);
+	mm->m_stack.used--;
+}
 
-		if (nr_inactive) {
-			nr_to_scan = min(nr_inactive,
-					(unsigned long)sc->swap_cluster_max);
-			nr_inactive -= nr_to_scan;
-			nr_reclaimed +=
-				linux_shrink_inactive(nr_to_scan, mm, sc);
+static int lru_depth(struct mm *mm, struct vpage *pg, char type,
+		     u_int64_t *depth)
+{
+	u_int64_t slot;
+	int       vacate;
+	int       result;
+
+	slot = pg->v_slot;
+	*depth = 0;
+	if (slot != 0) {
+		pg->v_slot = 0;
+		slot--;
+		*depth = mm->m_stack.used - stack_prefix(mm, slot);
+	}
+	vacate = *depth != 0;
+	if (type == FSLOG_PUNCH)
+		return vacate ? ghost_push(mm, slot) : 0;
+	if (mm->m_stack.ghost_nr > 0 &&
+	    (!vacate || mm->m_stack.ghost[0] > slot)) {
+		stack_del(mm, ghost_pop(mm));
+		if (vacate) {
+			/*
+			 * The ghost takes over the slot, which stays
+			 * occupied. Cannot fail: there is room for the popped
+			 * ghost.
+			 */
+			result = ghost_push(mm, slot);
+			assert(result == 0);
+			vacate = 0;
 		}
 	}
-	return nr_reclaimed;
+	if (vacate)
+		stack_del(mm, slot);
+	if (mm->m_stack.nr == mm->m_stack.size) {
+		result = stack_compact(mm);
+		if (result != 0)
+			return result;
+	}
+	slot = mm->m_stack.nr++;
+	mm->m_stack.owner[slot] = pg->v_no;
+	stack_add(mm, slot, +1);
+	mm->m_stack.used++;
+	pg->v_slot = slot + 1;
+	return 0;
 }
 
-static u_int64_t linux_shrink_zones(int prio, struct mm *mm,
-				    struct scan_control *sc)
+static void stack_fini(struct mm *mm)
 {
-	mm->m_linux.temp_priority = prio;
-	if (mm->m_linux.prev_priority > prio)
-		mm->m_linux.prev_priority = prio;
-
-	return linux_shrink_zone(prio, mm, sc);
+	free(mm->m_stack.tree);
+	free(mm->m_stack.key);
+	free(mm->m_stack.owner);
+	free(mm->m_stack.ghost);
 }
 
-static void linux_try_to_free_pages(struct mm *mm)
+static void lru_fini(struct mm *mm)
 {
-	int priority;
-	int total_scanned = 0;
-	unsigned long nr_reclaimed = 0;
-	unsigned long lru_pages;
-	struct scan_control sc = {
-		.mm = mm,
-		.may_writepage = 1 /* !laptop_mode */,
-		.swap_cluster_max = SWAP_CLUSTER_MAX,
-	};
-
-	mm->m_linux.temp_priority = DEF_PRIORITY;
-	lru_pages = mm->m_linux.nr_active + mm->m_linux.nr_inactive;
-
-	sc.may_writepage = 0;
-
-	for (priority = DEF_PRIORITY; priority >= 0; priority--) {
-		sc.nr_scanned = 0;
-
-		nr_reclaimed += linux_shrink_zones(priority, mm, &sc);
-		total_scanned += sc.nr_scanned;
-		if (nr_reclaimed >= sc.swap_cluster_max)
-			break;
-
-		if (total_scanned > sc.swap_cluster_max +
-		    sc.swap_cluster_max / 2)
-			sc.may_writepage = 1;
-
-	}
-	mm->m_linux.prev_priority = mm->m_linux.temp_priority;
+	stack_fini(mm);
 }
 
-static void linux_alloc(struct mm *mm, struct vpage *pg)
+static void fifo_alloc(struct mm *mm, struct vpage *pg)
 {
 	struct frame *frame;
 
 	assert(vpage_invariant(mm, pg));
 
 	if (pg->v_frame == NULL) {
-		if (mm->m_nr_free == 0)
-			/*
-			 * Enter reclaim.
-			 */
-			linux_try_to_free_pages(mm);
+		/*
+		 * Miss
+		 */
+		if (mm->m_nr_free == 0) {
+			assert(!list_empty(&mm->m_fifo));
+			frame = frame_from_list(mm->m_fifo.prev);
+			frame_steal(mm, frame);
+		}
 		assert(mm->m_nr_free > 0);
 		frame = frame_free_get(mm);
 		vpage_place(mm, pg, frame);
-		linux_add_to_inactive(mm, frame);
-		frame->f_flags |= FR_TAIL;
-	} else
-		/*
-		 * mark_page_accessed().
-		 */
-		linux_mark_page_accessed(mm, pg->v_frame);
+		assert(list_empty(&frame->f_linkage));
+		list_add(&frame->f_linkage, &mm->m_fifo);
+	}
 	assert(vpage_invariant(mm, pg));
+	assert(pg->v_frame != NULL);
 }
 
-static void linux_punch(struct mm *mm, struct vpage *pg)
+/*
+ * FIFO2
+ *
+ * FIFO Second Chance.
+ */
+static void fifo2_alloc(struct mm *mm, struct vpage *pg)
 {
 	struct frame *frame;
 
-	frame = pg->v_frame;
-	if (frame != NULL) {
-		if (frame->f_flags & FR_TAIL) {
-			frame->f_flags &= ~FR_TAIL;
-			assert(mm->m_linux.nr_inactive > 0);
-			mm->m_linux.nr_inactive--;
-		} else {
-			assert(mm->m_linux.nr_active > 0);
-			mm->m_linux.nr_active--;
+	assert(vpage_invariant(mm, pg));
+
+	if (pg->v_frame == NULL) {
+		/*
+		 * Miss
+		 */
+		if (mm->m_nr_free == 0) {
+			assert(!list_empty(&mm->m_fifo2));
+			do {
+				frame = frame_from_list(mm->m_fifo2.prev);
+				if (frame->f_flags & FR_REF) {
+					frame->f_flags &= ~FR_REF;
+					list_move(&frame->f_linkage,
+						  &mm->m_fifo2);
+				} else
+					break;
+			} while (1);
+			frame_steal(mm, frame);
 		}
+		assert(mm->m_nr_free > 0);
+		frame = frame_free_get(mm);
+		vpage_place(mm, pg, frame);
+		assert(list_empty(&frame->f_linkage));
+		list_add(&frame->f_linkage, &mm->m_fifo2);
 	}
-	generic_punch(mm, pg);
+	assert(vpage_invariant(mm, pg));
+	assert(pg->v_frame != NULL);
 }
 
 /*
- * WORST
+ * SFIFO
  *
- * Worst possible algorithm. Causes as many faults as possible.
+ * From "Segmented FIFO page replacement", by Rollins Turner and Henry Levy
+ *
+ * http://portal.acm.org/ft_gateway.cfm?id=805473&type=pdf&coll=portal&dl=ACM&CFID=15151515&CFTOKEN=6184618
  */
-static void worst_alloc(struct mm *mm, struct vpage *pg)
+static int sfifo_param(struct mm *mm, int nr, const u_int64_t *param)
+{
+	if (nr != 1 || param[0] > 100)
+		return EINVAL;
+	mm->m_sfifo.tail = param[0];
+	return 0;
+}
+
+static void sfifo_alloc(struct mm *mm, struct vpage *pg)
 {
 	struct frame *frame;
 
@@ -1604,446 +3502,3021 @@ static void worst_alloc(struct mm *mm, struct vpage *pg)
 
 	if (pg->v_frame == NULL) {
 		if (mm->m_nr_free == 0) {
-			struct vpage  *nextfault;
-			struct access *peek;
-			int result;
-
-			peek = NULL;
-			result = access_look_ahead(mm, &peek);
-			if (result != 0)
-				return random_alloc(mm, pg);
-			assert(peek != NULL);
-			nextfault = &mm->m_vpages[peek->a_page];
-			if (nextfault->v_frame != NULL)
-				/*
-				 * Next access is to page already in memory:
-				 * replace it so that next access faults.
-				 */
-				frame_steal(mm, nextfault->v_frame);
-			else
+			while (mm->m_sfifo.tail_nr <=
+			       mm->m_nr_frames * mm->m_sfifo.tail / 100 &&
+			       !list_empty(&mm->m_fifo)) {
 				/*
-				 * Next access will fault anyway.
+				 * Tail list is too short, populate it. With
+				 * a tail of 100%, all frames go there.
 				 */
-				return random_alloc(mm, pg);
+				frame = frame_from_list(mm->m_fifo.prev);
+				assert(!(frame->f_flags & FR_TAIL));
+				frame->f_flags |= FR_TAIL;
+				list_move(&frame->f_linkage, &mm->m_lru);
+				mm->m_sfifo.tail_nr++;
+			}
+			assert(!list_empty(&mm->m_lru));
+			frame = frame_from_list(mm->m_lru.prev);
+			assert(frame->f_flags & FR_TAIL);
+			frame->f_flags &= ~FR_TAIL;
+			mm->m_sfifo.tail_nr--;
+			frame_steal(mm, frame);
 		}
 		assert(mm->m_nr_free > 0);
 		frame = frame_free_get(mm);
 		vpage_place(mm, pg, frame);
 		assert(list_empty(&frame->f_linkage));
+		list_add(&frame->f_linkage, &mm->m_fifo);
+	} else {
+		frame = pg->v_frame;
+		if (frame->f_flags & FR_TAIL) {
+			frame->f_flags &= ~FR_TAIL;
+			mm->m_sfifo.tail_nr--;
+			list_move(&frame->f_linkage, &mm->m_fifo);
+		}
 	}
 	assert(vpage_invariant(mm, pg));
 	assert(pg->v_frame != NULL);
 }
 
 /*
- * OPT
- *
- * Optimal clairvoyant algorithm by Belady.
- *
- * Replaces pages that won't be faulted for the longest time.
+ * 2Q
+ *
+ * From "2Q: A Low Overhead High Performance Buffer Management Replacement
+ * Algorithm", by Theodore Johnson and Dennis Shasha.
+ *
+ * http://www.vldb.org/conf/1994/P439.PDF
+ */
+
+static int q2_param(struct mm *mm, int nr, const u_int64_t *param)
+{
+	if (nr < 1 || nr > 2)
+		return EINVAL;
+	mm->m_q2.kin = param[0];
+	if (nr > 1)
+		mm->m_q2.kout = param[1];
+	return 0;
+}
+
+/*
+ * True if @pg is in A1out list.
+ */
+static int q2_a1out(const struct vpage *pg)
+{
+	return pg->v_flags & VP_PBIT0;
+}
+
+static void q2_reclaim_for(struct mm *mm, struct vpage *pg)
+{
+	struct frame *frame;
+
+	if (mm->m_nr_free == 0) {
+		if (mm->m_q2.a1in_nr > mm->m_nr_frames * mm->m_q2.kin / 100 ||
+		    mm->m_q2.am_nr == 0) {
+			struct vpage *tail;
+
+			frame = frame_from_list(mm->m_q2.a1in.prev);
+			list_del_init(&frame->f_linkage);
+			--mm->m_q2.a1in_nr;
+			assert(frame->f_flags & FR_TAIL);
+			frame->f_flags &= ~FR_TAIL;
+			tail = frame->f_page;
+			assert(tail != NULL);
+			assert(!q2_a1out(tail));
+			vlist_add(mm, &mm->m_q2.a1out, tail);
+			tail->v_flags |= VP_PBIT0;
+			if (mm->m_q2.a1out_nr >=
+			    mm->m_nr_frames * mm->m_q2.kout / 100) {
+				tail = vlist_last(mm, &mm->m_q2.a1out);
+				vlist_del(mm, &mm->m_q2.a1out, tail);
+				tail->v_flags &= ~VP_PBIT0;
+			} else
+				++mm->m_q2.a1out_nr;
+		} else {
+			frame = frame_from_list(mm->m_q2.am.prev);
+			assert(!(frame->f_flags & FR_TAIL));
+			list_del_init(&frame->f_linkage);
+			--mm->m_q2.am_nr;
+		}
+		frame_steal(mm, frame);
+	}
+	frame = frame_free_get(mm);
+	vpage_place(mm, pg, frame);
+}
+
+static void q2_alloc(struct mm *mm, struct vpage *pg)
+{
+	struct frame *frame;
+
+	assert(vpage_invariant(mm, pg));
+
+	frame = pg->v_frame;
+	if (frame != NULL) {
+		if (!(frame->f_flags & FR_TAIL))
+			/*
+			 * Frame is in Am list.
+			 */
+			list_move(&frame->f_linkage, &mm->m_q2.am);
+	} else {
+		q2_reclaim_for(mm, pg);
+		frame = pg->v_frame;
+		assert(frame != NULL);
+		assert(list_empty(&frame->f_linkage));
+		if (q2_a1out(pg)) {
+			list_add(&frame->f_linkage, &mm->m_q2.am);
+			++mm->m_q2.am_nr;
+			vlist_del(mm, &mm->m_q2.a1out, pg);
+			pg->v_flags &= ~VP_PBIT0;
+			--mm->m_q2.a1out_nr;
+		} else {
+			list_add(&frame->f_linkage, &mm->m_q2.a1in);
+			++mm->m_q2.a1in_nr;
+			frame->f_flags |= FR_TAIL;
+		}
+	}
+}
+
+/*
+ * Truncate frees the frame of @pg, taking it off A1in or Am, and forgets
+ * its A1out entry, if any: the page comes back with new contents.
+ */
+static void q2_punch(struct mm *mm, struct vpage *pg)
+{
+	struct frame *frame;
+
+	frame = pg->v_frame;
+	if (frame != NULL) {
+		if (frame->f_flags & FR_TAIL)
+			--mm->m_q2.a1in_nr;
+		else
+			--mm->m_q2.am_nr;
+	} else if (q2_a1out(pg)) {
+		vlist_del(mm, &mm->m_q2.a1out, pg);
+		pg->v_flags &= ~VP_PBIT0;
+		--mm->m_q2.a1out_nr;
+	}
+	generic_punch(mm, pg);
+}
+
+/*
+ * CAR
+ *
+ * From "CAR: Clock with Adaptive Replacement", by Sorav Bansal and Dharmendra
+ * S. Modha
+ *
+ * http://citeseer.ist.psu.edu/bansal04car.html
+ */
+
+static int car_init(struct mm *mm)
+{
+	int i;
+
+	for (i = 0; i < sizeof_array(mm->m_car.q); ++i)
+		vlist_init(&mm->m_car.q[i].list);
+	mm->m_car.q[CQ_NONE].nr = mm->m_nr_vpages;
+	return 0;
+}
+
+static void car_fini(struct mm *mm)
+{
+}
+
+static enum car_queue car_queue_get(const struct vpage *pg)
+{
+	return (pg->v_flags & VP_PMASK) >> (VP_PSHIFT + 1);
+}
+
+static void car_queue_set(struct vpage *pg, enum car_queue q)
+{
+	pg->v_flags &= ~VP_PMASK;
+	pg->v_flags |= q << (VP_PSHIFT + 1);
+}
+
+static int car_ref_get(const struct vpage *pg)
+{
+	return pg->v_flags & VP_PBIT0;
+}
+
+static void car_ref_set(struct vpage *pg, int bit)
+{
+	pg->v_flags |= !!bit * VP_PBIT0;
+}
+
+
+static void car_move(struct mm *mm, struct vpage *pg,
+		     enum car_queue t, int tail)
+{
+	enum car_queue q;
+
+	q = car_queue_get(pg);
+
+	--mm->m_car.q[q].nr;
+	++mm->m_car.q[t].nr;
+	if (q != CQ_NONE)
+		vlist_del(mm, &mm->m_car.q[q].list, pg);
+	if (t == CQ_NONE)
+		;
+	else if (tail)
+		vlist_add_tail(mm, &mm->m_car.q[t].list, pg);
+	else
+		vlist_add(mm, &mm->m_car.q[t].list, pg);
+	car_queue_set(pg, t);
+	assert(equi(pg->v_frame != NULL,
+		    car_queue_get(pg) == CQ_T1 || car_queue_get(pg) == CQ_T2));
+}
+
+static struct vpage *car_queue(struct mm *mm, enum car_queue q, int tail)
+{
+	struct vpage *pg;
+
+	if (mm->m_car.q[q].nr == 0) {
+		/*
+		 * Counts out of step with the frames: the caller leaves the
+		 * page without a frame, and the access fails.
+		 */
+		fprintf(stderr, "Empty CAR queue %i\n", q);
+		return NULL;
+	}
+	if (tail)
+		pg = vlist_last(mm, &mm->m_car.q[q].list);
+	else
+		pg = vlist_first(mm, &mm->m_car.q[q].list);
+	assert(car_queue_get(pg) == q);
+	return pg;
+}
+
+static void car_replace(struct mm *mm)
+{
+	int found;
+	assert(mm->m_car.q[CQ_T1].nr + mm->m_car.q[CQ_T2].nr + mm->m_nr_free ==
+	       mm->m_nr_frames);
+
+	found = 0;
+	do {
+		struct vpage *pg;
+		enum car_queue target;
+		int ref;
+
+		if (mm->m_car.q[CQ_T1].nr >= max(1ULL, mm->m_car.p)) {
+			pg = car_queue(mm, CQ_T1, 0);
+			target = CQ_B1;
+		} else {
+			pg = car_queue(mm, CQ_T2, 0);
+			target = CQ_B2;
+		}
+		if (pg == NULL)
+			return;
+		ref = car_ref_get(pg);
+		if (!ref) {
+			found = 1;
+			assert(pg->v_frame != NULL);
+			frame_steal(mm, pg->v_frame);
+		} else {
+			car_ref_set(pg, 0);
+			target = CQ_T2;
+		}
+		car_move(mm, pg, target, ref);
+	} while (!found);
+
+	assert(mm->m_car.q[CQ_T1].nr + mm->m_car.q[CQ_T2].nr + mm->m_nr_free ==
+	       mm->m_nr_frames);
+}
+
+static void car_dir_replace(struct mm *mm)
+{
+	enum car_queue chop;
+
+	assert(mm->m_car.q[CQ_T1].nr + mm->m_car.q[CQ_T2].nr + mm->m_nr_free ==
+	       mm->m_nr_frames);
+
+	/*
+	 * Truncate frees frames without shrinking the directory, so that
+	 * misses into the free frames can take it past the bounds: chop
+	 * until it is back within them.
+	 */
+	if (mm->m_car.q[CQ_T1].nr + mm->m_car.q[CQ_B1].nr >= mm->m_nr_frames &&
+	    mm->m_car.q[CQ_B1].nr > 0)
+		chop = CQ_B1;
+	else
+		chop = CQ_B2;
+	while (mm->m_car.q[chop].nr > 0 &&
+	       (chop == CQ_B1 ?
+		mm->m_car.q[CQ_T1].nr + mm->m_car.q[CQ_B1].nr >=
+		mm->m_nr_frames :
+		mm->m_car.q[CQ_T1].nr + mm->m_car.q[CQ_T2].nr +
+		mm->m_car.q[CQ_B1].nr + mm->m_car.q[CQ_B2].nr >=
+		2 * mm->m_nr_frames))
+		car_move(mm, car_queue(mm, chop, 1), CQ_NONE, 0);
+
+	assert(mm->m_car.q[CQ_T1].nr + mm->m_car.q[CQ_T2].nr + mm->m_nr_free ==
+	       mm->m_nr_frames);
+}
+
+static void car_alloc(struct mm *mm, struct vpage *pg)
+{
+	enum car_queue q;
+	enum car_queue target;
+	int dirmiss;
+
+	q = car_queue_get(pg);
+
+	assert(equi(pg->v_frame != NULL, q == CQ_T1 || q == CQ_T2));
+	assert(mm->m_car.q[CQ_T1].nr + mm->m_car.q[CQ_T2].nr + mm->m_nr_free ==
+	       mm->m_nr_frames);
+
+	dirmiss = q != CQ_B1 && q != CQ_B2;
+	if (pg->v_frame != NULL)
+		car_ref_set(pg, 1);
+	else {
+		struct frame *frame;
+
+		assert(equi(dirmiss, q == CQ_NONE));
+
+		if (mm->m_nr_free == 0) {
+
+			car_replace(mm);
+			/*
+			 * Cache directory replacement.
+			 */
+			if (dirmiss)
+				car_dir_replace(mm);
+		}
+		if (mm->m_nr_free == 0)
+			return;
+		frame = frame_free_get(mm);
+		vpage_place(mm, pg, frame);
+
+		if (dirmiss) {
+			target = CQ_T1;
+		} else {
+			u_int64_t delta;
+
+			if (q == CQ_B1) {
+				delta = max(1ULL, mm->m_car.q[CQ_B2].nr /
+					    mm->m_car.q[CQ_B1].nr);
+				mm->m_car.p = min(mm->m_car.p + delta,
+						  mm->m_nr_frames);
+			} else {
+				assert(q == CQ_B2);
+
+				delta = max(1ULL, mm->m_car.q[CQ_B1].nr /
+					    mm->m_car.q[CQ_B2].nr);
+				mm->m_car.p = min(mm->m_car.p - delta, 0ULL);
+			}
+			target = CQ_T2;
+		}
+		car_move(mm, pg, target, 1);
+		car_ref_set(pg, 0);
+
+	}
+	assert(equi(pg->v_frame != NULL,
+		    car_queue_get(pg) == CQ_T1 || car_queue_get(pg) == CQ_T2));
+}
+
+static void car_punch(struct mm *mm, struct vpage *pg)
+{
+	generic_punch(mm, pg);
+	car_move(mm, pg, CQ_NONE, 0);
+}
+
+/*
+ * ARC
+ *
+ * Shares a lot with CAR.
+ *
+ * From "ARC: A Self-Tuning, Low Overhead Replacement Cache" by Nimrod
+ * Megiddo, Dharmendra Modha
+ *
+ * http://citeseer.ist.psu.edu/megiddo03arc.html
+ */
+static void arc_alloc(struct mm *mm, struct vpage *pg)
+{
+	enum car_queue q;
+	enum car_queue target;
+	u_int64_t      delta;
+
+	q = car_queue_get(pg);
+
+	assert(equi(pg->v_frame != NULL, q == CQ_T1 || q == CQ_T2));
+	assert(mm->m_car.q[CQ_T1].nr + mm->m_car.q[CQ_T2].nr + mm->m_nr_free ==
+	       mm->m_nr_frames);
+
+	target = CQ_T2;
+	if (pg->v_frame != NULL) {
+		;
+	} else if (q == CQ_B1) {
+		delta = max(1ULL, mm->m_car.q[CQ_B2].nr/mm->m_car.q[CQ_B1].nr);
+		mm->m_car.p = min(mm->m_car.p + delta, mm->m_nr_frames);
+	} else if (q == CQ_B2) {
+		delta = max(1ULL, mm->m_car.q[CQ_B1].nr/mm->m_car.q[CQ_B2].nr);
+		mm->m_car.p = min(mm->m_car.p - delta, 0ULL);
+	} else {
+		struct vpage *tail;
+
+		assert(q == CQ_NONE);
+
+		/*
+		 * Bounds are checked with >=, as truncate can take the
+		 * directory past them, see car_dir_replace().
+		 */
+		if (mm->m_car.q[CQ_T1].nr + mm->m_car.q[CQ_B1].nr >=
+		    mm->m_nr_frames) {
+			if (mm->m_car.q[CQ_B1].nr > 0)
+				tail = car_queue(mm, CQ_B1, 1);
+			else {
+				tail = car_queue(mm, CQ_T1, 1);
+				if (tail == NULL)
+					return;
+				frame_steal(mm, tail->v_frame);
+			}
+			car_move(mm, tail, CQ_NONE, 0);
+		} else {
+			u_int64_t total;
+
+			total = mm->m_car.q[CQ_T1].nr + mm->m_car.q[CQ_B1].nr +
+				mm->m_car.q[CQ_T2].nr + mm->m_car.q[CQ_B2].nr;
+			if (total >= mm->m_nr_frames) {
+				if (total >= 2 * mm->m_nr_frames &&
+				    mm->m_car.q[CQ_B2].nr > 0) {
+					car_move(mm, car_queue(mm, CQ_B2, 1),
+						 CQ_NONE, 0);
+				}
+			}
+		}
+		target = CQ_T1;
+	}
+	if (pg->v_frame == NULL) {
+		if (mm->m_nr_free == 0) {
+			u_int64_t t1;
+			enum car_queue shrink;
+			enum car_queue expand;
+			struct vpage *shuttle;
+
+			t1 = mm->m_car.q[CQ_T1].nr;
+			if (t1 > 0 &&
+			    (t1 > mm->m_car.p || (q == CQ_B2 &&
+						  t1 == mm->m_car.p) ||
+			     mm->m_car.q[CQ_T2].nr == 0)) {
+				shrink = CQ_T1;
+				expand = CQ_B1;
+			} else {
+				shrink = CQ_T2;
+				expand = CQ_B2;
+			}
+			shuttle = car_queue(mm, shrink, 1);
+			if (shuttle == NULL)
+				return;
+			frame_steal(mm, shuttle->v_frame);
+			car_move(mm, shuttle, expand, 0);
+		}
+		vpage_place(mm, pg, frame_free_get(mm));
+	}
+	car_move(mm, pg, target, 0);
+	assert(equi(pg->v_frame != NULL,
+		    car_queue_get(pg) == CQ_T1 || car_queue_get(pg) == CQ_T2));
+}
+
+/*
+ * LINUX
+ *
+ * This emulates replacement algorithm of Linux 2.6. kernel (mm/vmscan.c)
+ *
+ * Assumptions:
+ *
+ *  - no mapped or anonymous pages;
+ *
+ *  - no kswapd, only direct reclaim;
+ *
+ *  - all allocations are with GFP_FS;
+ *
+ *  - no non-fs caches;
+ *
+ *  - no low_page reserves;
+ *
+ *  - single zone.
+ */
+
+static void linux_add_to_active(struct mm *mm, struct frame *frame)
+{
+	list_add(&frame->f_linkage, &mm->m_linux.active);
+	mm->m_linux.nr_active++;
+}
+
+static void linux_add_to_inactive(struct mm *mm, struct frame *frame)
+{
+	list_add(&frame->f_linkage, &mm->m_linux.inactive);
+	mm->m_linux.nr_inactive++;
+}
+
+#if 0
+static void linux_del_from_active(struct mm *mm, struct frame *frame)
+{
+	assert(mm->m_linux.nr_active > 0);
+	list_del_init(&frame->f_linkage);
+	mm->m_linux.nr_active--;
+}
+#endif
+
+static void linux_del_from_inactive(struct mm *mm, struct frame *frame)
+{
+	assert(mm->m_linux.nr_inactive > 0);
+	list_del_init(&frame->f_linkage);
+	mm->m_linux.nr_inactive--;
+}
+
+static void linux_activate_page(struct mm *mm, struct frame *frame)
+{
+	if (frame->f_flags & FR_TAIL) {
+		linux_del_from_inactive(mm, frame);
+		frame->f_flags &= ~FR_TAIL;
+		linux_add_to_active(mm, frame);
+	}
+}
+
+/*
+ * Mark a page as having seen activity.
+ *
+ * inactive,unreferenced	->	inactive,referenced
+ * inactive,referenced		->	active,unreferenced
+ * active,unreferenced		->	active,referenced
+ */
+static void linux_mark_page_accessed(struct mm *mm, struct frame *frame)
+{
+	if ((frame->f_flags & (FR_TAIL|FR_REF1)) == (FR_TAIL|FR_REF1)) {
+		linux_activate_page(mm, frame);
+		frame->f_flags &= ~FR_REF1;
+	} else
+		frame->f_flags |= FR_REF1;
+}
+
+enum {
+	DEF_PRIORITY     = 12,
+	SWAP_CLUSTER_MAX = 32
+};
+
+struct scan_control {
+	struct mm    *mm;
+	/* Incremented by the number of inactive pages that were scanned */
+	unsigned long nr_scanned;
+
+	int may_writepage;
+
+	/* Can pages be swapped as part of reclaim? */
+	int may_swap;
+
+	/* This context's SWAP_CLUSTER_MAX. If freeing memory for
+	 * suspend, we effectively ignore SWAP_CLUSTER_MAX.
+	 * In this context, it doesn't matter that we scan the
+	 * whole list at once. */
+	int swap_cluster_max;
+
+	int swappiness;
+};
+
+/* possible outcome of pageout() */
+typedef enum {
+	/* failed to write page out, page is locked */
+	PAGE_KEEP,
+	/* move page to the active list, page is locked */
+	PAGE_ACTIVATE,
+	/* page has been sent to the disk successfully, page is unlocked */
+	PAGE_SUCCESS,
+	/* page is clean and locked */
+	PAGE_CLEAN,
+} pageout_t;
+
+static pageout_t linux_pageout(struct frame *frame)
+{
+	return PAGE_SUCCESS;
+}
+
+static u_int64_t linux_shrink_page_list(struct list_head *page_list,
+					struct scan_control *sc)
+{
+	LIST_HEAD(ret_pages);
+	unsigned long nr_reclaimed = 0;
+
+	while (!list_empty(page_list)) {
+		struct frame *frame;
+		int referenced;
+
+		frame = frame_from_list(page_list->prev);
+		list_del_init(&frame->f_linkage);
+
+		assert(frame->f_flags & FR_TAIL);
+
+		sc->nr_scanned++;
+
+		referenced = frame->f_flags & FR_REF1;
+		frame->f_flags &= ~FR_REF1;
+
+		if (frame->f_flags & FR_DIRTY) {
+			if (referenced)
+				goto keep_locked;
+			if (!sc->may_writepage)
+				goto keep_locked;
+
+			/* Page is dirty, try to write it out here */
+			switch(linux_pageout(frame)) {
+			case PAGE_KEEP:
+				goto keep_locked;
+			case PAGE_ACTIVATE:
+				goto activate_locked;
+			case PAGE_SUCCESS:
+			case PAGE_CLEAN:
+				; /* try to free the page below */
+			}
+		}
+
+		nr_reclaimed++;
+		frame_steal(sc->mm, frame);
+		continue;
+
+activate_locked:
+		frame->f_flags &= ~FR_TAIL;
+keep_locked:
+		list_add(&frame->f_linkage, &ret_pages);
+	}
+	list_splice(&ret_pages, page_list);
+	return nr_reclaimed;
+}
+
+static u_int64_t linux_isolate_lru_pages(unsigned long nr_to_scan,
+					 struct list_head *src,
+					 struct list_head *dst,
+					 unsigned long *scanned)
+{
+	struct frame *frame;
+	unsigned long scan;
+
+	for (scan = 0; scan < nr_to_scan && !list_empty(src); scan++) {
+		frame = frame_from_list(src->prev);
+		list_move(&frame->f_linkage, dst);
+	}
+
+	*scanned = scan;
+	return scan;
+}
+
+static u_int64_t linux_shrink_inactive(unsigned long max_scan,
+					    struct mm *mm,
+					    struct scan_control *sc)
+{
+	LIST_HEAD(page_list);
+	unsigned long nr_scanned = 0;
+	unsigned long nr_reclaimed = 0;
+
+	do {
+		struct frame *frame;
+		unsigned long nr_taken;
+		unsigned long nr_scan;
+		unsigned long nr_freed;
+
+		nr_taken = linux_isolate_lru_pages(sc->swap_cluster_max,
+						   &mm->m_linux.inactive,
+						   &page_list, &nr_scan);
+		mm->m_linux.nr_inactive -= nr_taken;
+		mm->m_linux.pages_scanned += nr_scan;
+
+		nr_scanned += nr_scan;
+		nr_freed = linux_shrink_page_list(&page_list, sc);
+		nr_reclaimed += nr_freed;
+
+		if (nr_taken == 0)
+			break;
+
+		/*
+		 * Put back any unfreeable pages.
+		 */
+		while (!list_empty(&page_list)) {
+			frame = frame_from_list(page_list.prev);
+			list_del_init(&frame->f_linkage);
+			if (!(frame->f_flags & FR_TAIL))
+				linux_add_to_active(mm, frame);
+			else
+				linux_add_to_inactive(mm, frame);
+		}
+  	} while (nr_scanned < max_scan);
+	return nr_reclaimed;
+}
+
+static void linux_shrink_active(u_int64_t nr_pages, struct mm *mm,
+				     struct scan_control *sc)
+{
+	unsigned long pgscanned;
+	unsigned long pgmoved;
+	LIST_HEAD(l_hold);	/* The pages which were snipped off */
+	struct frame *frame;
+
+	pgmoved = linux_isolate_lru_pages(nr_pages, &mm->m_linux.active,
+					  &l_hold, &pgscanned);
+	mm->m_linux.pages_scanned += pgscanned;
+	assert(mm->m_linux.nr_active >= pgmoved);
+	mm->m_linux.nr_active -= pgmoved;
+
+	while (!list_empty(&l_hold)) {
+		frame = frame_from_list(l_hold.prev);
+		assert(!(frame->f_flags & FR_TAIL));
+		frame->f_flags |= FR_TAIL;
+
+		list_move(&frame->f_linkage, &mm->m_linux.inactive);
+		mm->m_linux.nr_inactive++;
+	}
+}
+
+static u_int64_t linux_shrink_zone(int prio, struct mm *mm,
+				   struct scan_control *sc)
+{
+	unsigned long nr_active;
+	unsigned long nr_inactive;
+	unsigned long nr_to_scan;
+	unsigned long nr_reclaimed = 0;
+
+	/*
+	 * Add one to `nr_to_scan' just to make sure that the kernel will
+	 * slowly sift through the active list.
+	 */
+	mm->m_linux.nr_scan_active += (mm->m_linux.nr_active >> prio) + 1;
+	nr_active = mm->m_linux.nr_scan_active;
+	if (nr_active >= sc->swap_cluster_max)
+		mm->m_linux.nr_scan_active = 0;
+	else
+		nr_active = 0;
+
+	mm->m_linux.nr_scan_inactive += (mm->m_linux.nr_inactive >> prio) + 1;
+	nr_inactive = mm->m_linux.nr_scan_inactive;
+	if (nr_inactive >= sc->swap_cluster_max)
+		mm->m_linux.nr_scan_inactive = 0;
+	else
+		nr_inactive = 0;
+
+	while (nr_active || nr_inactive) {
+		if (nr_active) {
+			nr_to_scan = min(nr_active,
+					(unsigned long)sc->swap_cluster_max);
+			nr_active -= nr_to_scan;
+			linux_shrink_active(nr_to_scan, mm, sc);
+		}
+
+		if (nr_inactive) {
+			nr_to_scan = min(nr_inactive,
+					(unsigned long)sc->swap_cluster_max);
+			nr_inactive -= nr_to_scan;
+			nr_reclaimed +=
+				linux_shrink_inactive(nr_to_scan, mm, sc);
+		}
+	}
+	return nr_reclaimed;
+}
+
+static u_int64_t linux_shrink_zones(int prio, struct mm *mm,
+				    struct scan_control *sc)
+{
+	mm->m_linux.temp_priority = prio;
+	if (mm->m_linux.prev_priority > prio)
+		mm->m_linux.prev_priority = prio;
+
+	return linux_shrink_zone(prio, mm, sc);
+}
+
+static void linux_try_to_free_pages(struct mm *mm, int may_writepage)
+{
+	int priority;
+	int total_scanned = 0;
+	unsigned long nr_reclaimed = 0;
+	unsigned long lru_pages;
+	struct scan_control sc = {
+		.mm = mm,
+		.may_writepage = 1 /* !laptop_mode */,
+		.swap_cluster_max = SWAP_CLUSTER_MAX,
+	};
+
+	mm->m_linux.temp_priority = DEF_PRIORITY;
+	lru_pages = mm->m_linux.nr_active + mm->m_linux.nr_inactive;
+
+	sc.may_writepage = may_writepage;
+
+	for (priority = DEF_PRIORITY; priority >= 0; priority--) {
+		sc.nr_scanned = 0;
+
+		nr_reclaimed += linux_shrink_zones(priority, mm, &sc);
+		total_scanned += sc.nr_scanned;
+		if (nr_reclaimed >= sc.swap_cluster_max)
+			break;
+
+		if (total_scanned > sc.swap_cluster_max +
+		    sc.swap_cluster_max / 2)
+			sc.may_writepage = 1;
+
+	}
+	mm->m_linux.prev_priority = mm->m_linux.temp_priority;
+}
+
+static void linux_alloc(struct mm *mm, struct vpage *pg)
+{
+	struct frame *frame;
+	int i;
+
+	assert(vpage_invariant(mm, pg));
+
+	if (pg->v_frame == NULL) {
+		/*
+		 * Enter reclaim. In few frames, reclaim scans too little to
+		 * start writing dirty pages, and can free nothing: the kernel
+		 * would retry once pdflush has cleaned them, so retry with
+		 * writeback allowed from the start.
+		 */
+		for (i = 0; mm->m_nr_free == 0 && i <= DEF_PRIORITY; ++i)
+			linux_try_to_free_pages(mm, i > 0);
+		if (mm->m_nr_free == 0) {
+			fprintf(stderr, "Reclaim freed no frame\n");
+			return;
+		}
+		frame = frame_free_get(mm);
+		vpage_place(mm, pg, frame);
+		linux_add_to_inactive(mm, frame);
+		frame->f_flags |= FR_TAIL;
+	} else
+		/*
+		 * mark_page_accessed().
+		 */
+		linux_mark_page_accessed(mm, pg->v_frame);
+	assert(vpage_invariant(mm, pg));
+}
+
+static void linux_punch(struct mm *mm, struct vpage *pg)
+{
+	struct frame *frame;
+
+	frame = pg->v_frame;
+	if (frame != NULL) {
+		if (frame->f_flags & FR_TAIL) {
+			frame->f_flags &= ~FR_TAIL;
+			assert(mm->m_linux.nr_inactive > 0);
+			mm->m_linux.nr_inactive--;
+		} else {
+			assert(mm->m_linux.nr_active > 0);
+			mm->m_linux.nr_active--;
+		}
+	}
+	generic_punch(mm, pg);
+}
+
+/*
+ * WORST
+ *
+ * Worst possible algorithm. Causes as many faults as possible.
+ */
+static void worst_alloc(struct mm *mm, struct vpage *pg)
+{
+	struct frame *frame;
+
+	assert(vpage_invariant(mm, pg));
+
+	if (pg->v_frame == NULL) {
+		if (mm->m_nr_free == 0) {
+			struct vpage  *nextfault;
+			struct access *peek;
+			int result;
+
+			peek = NULL;
+			result = access_look_ahead(mm, &peek);
+			if (result != 0)
+				return random_alloc(mm, pg);
+			assert(peek != NULL);
+			nextfault = vpage_get(mm, peek->a_page);
+			if (nextfault == NULL)
+				return random_alloc(mm, pg);
+			if (nextfault->v_frame != NULL)
+				/*
+				 * Next access is to page already in memory:
+				 * replace it so that next access faults.
+				 */
+				frame_steal(mm, nextfault->v_frame);
+			else
+				/*
+				 * Next access will fault anyway.
+				 */
+				return random_alloc(mm, pg);
+		}
+		assert(mm->m_nr_free > 0);
+		frame = frame_free_get(mm);
+		vpage_place(mm, pg, frame);
+		assert(list_empty(&frame->f_linkage));
+	}
+	assert(vpage_invariant(mm, pg));
+	assert(pg->v_frame != NULL);
+}
+
+/*
+ * OPT
+ *
+ * Optimal clairvoyant algorithm by Belady.
+ *
+ * Replaces pages that won't be faulted for the longest time. Next reads of
+ * resident pages are kept in a segment tree over frames, so that the victim is
+ * found in O(log(frames)).
+ */
+
+/*
+ * Returns the next read of the page accessed last.
+ */
+static u_int64_t opt_next(struct mm *mm)
+{
+	return future_next(mm->m_future, mm->m_total);
+}
+
+/*
+ * Sets the next read of the page in @frame.
+ */
+static void opt_next_set(struct mm *mm, struct frame *frame, u_int64_t next)
+{
+	u_int64_t *tree;
+	u_int64_t  node;
+
+	tree = mm->m_opt.next;
+	node = frame->f_no + mm->m_opt.size;
+	tree[node] = next;
+	for (node /= 2; node > 0; node /= 2)
+		tree[node] = max_t(u_int64_t, tree[2 * node], tree[2 * node + 1]);
+}
+
+/*
+ * Returns the frame whose page is read again last, the first such frame if
+ * there are several.
+ */
+static struct frame *opt_victim(struct mm *mm)
+{
+	u_int64_t *tree;
+	u_int64_t  node;
+
+	tree = mm->m_opt.next;
+	for (node = 1; node < mm->m_opt.size; )
+		node = tree[2 * node] >= tree[2 * node + 1] ?
+			2 * node : 2 * node + 1;
+	return &mm->m_frames[node - mm->m_opt.size];
+}
+
+static void opt_alloc(struct mm *mm, struct vpage *pg)
+{
+	struct frame *frame;
+
+	assert(vpage_invariant(mm, pg));
+
+	if (pg->v_frame == NULL) {
+		if (mm->m_nr_free == 0) {
+			frame = opt_victim(mm);
+			assert(frame->f_page != NULL);
+			assert(frame == frame->f_page->v_frame);
+			assert(mm->m_opt.next[1] > mm->m_total);
+			if (verbose & VERBOSE_TABLE) {
+				frame_no_t fno;
+				u_int64_t  next;
+
+				printf("%8llx: ", mm->m_total);
+				for (fno = 0; fno < mm->m_nr_frames; fno++) {
+					next = mm->m_opt.next[mm->m_opt.size +
+							      fno];
+					if (next != FUTURE_NEVER)
+						printf("%8llx", next);
+					else
+						printf("   never");
+					printf(fno == frame->f_no ? "*" : " ");
+				}
+				printf("\n");
+			}
+			frame_steal(mm, frame);
+		}
+		assert(mm->m_nr_free > 0);
+		frame = frame_free_get(mm);
+		vpage_place(mm, pg, frame);
+		assert(list_empty(&frame->f_linkage));
+	}
+	assert(vpage_invariant(mm, pg));
+	assert(pg->v_frame != NULL);
+}
+
+static int opt_init(struct mm *mm)
+{
+	if (mm->m_future == NULL)
+		return EINVAL;
+	for (mm->m_opt.size = 1; mm->m_opt.size < mm->m_nr_frames; )
+		mm->m_opt.size *= 2;
+	mm->m_opt.next = calloc(2 * mm->m_opt.size, sizeof mm->m_opt.next[0]);
+	return mm->m_opt.next != NULL ? 0 : ENOMEM;
+}
+
+static void opt_fini(struct mm *mm)
+{
+	free(mm->m_opt.next);
+	mm->m_opt.next = NULL;
+	stack_fini(mm);
+}
+
+/*
+ * Miss ratio curve of OPT.
+ *
+ * OPT is a stack algorithm too (Mattson et al.), with pages ordered by
+ * priority rather than by recency: memory of M frames evicts the resident page
+ * read again last, whatever M is. When page X at depth D is accessed, X moves
+ * to the top, and the page evicted from the top K slots (the one with the
+ * latest next read) is carried down: at slot K, the carried page and the page
+ * in the slot swap if the latter is read later. The carried page ends up in
+ * the slot X left. Only slots where a swap happens change, so slots are kept
+ * in place, and a segment tree over next reads of slots finds the next swap in
+ * O(log(slots)).
+ *
+ * Punched pages leave ghosts, as in lru_depth(). A ghost is a free frame,
+ * which is used before anything is evicted, so it is given a next read later
+ * than any page's.
+ */
+
+#define OPT_GHOST (~0ULL)
+
+static void opt_key_set(struct mm *mm, u_int64_t slot, u_int64_t key)
+{
+	u_int64_t *tree;
+
+	tree = mm->m_stack.key;
+	slot += mm->m_stack.size;
+	tree[slot] = key;
+	for (slot /= 2; slot > 0; slot /= 2)
+		tree[slot] = max_t(u_int64_t, tree[2 * slot], tree[2 * slot + 1]);
+}
+
+static int opt_stack_grow(struct mm *mm)
+{
+	u_int64_t   size;
+	u_int64_t   i;
+	u_int64_t  *tree;
+	vpage_no_t *owner;
+
+	size = max_t(u_int64_t, 2 * mm->m_stack.size, STACK_MIN);
+	owner = realloc(mm->m_stack.owner, size * sizeof owner[0]);
+	if (owner == NULL)
+		return ENOMEM;
+	mm->m_stack.owner = owner;
+	tree = calloc(2 * size, sizeof tree[0]);
+	if (tree == NULL)
+		return ENOMEM;
+	if (mm->m_stack.key != NULL)
+		memcpy(tree + size, mm->m_stack.key + mm->m_stack.size,
+		       mm->m_stack.nr * sizeof tree[0]);
+	for (i = size - 1; i > 0; --i)
+		tree[i] = max_t(u_int64_t, tree[2 * i], tree[2 * i + 1]);
+	free(mm->m_stack.key);
+	mm->m_stack.key  = tree;
+	mm->m_stack.size = size;
+	return 0;
+}
+
+/*
+ * Returns the first slot in [@lo, @hi) with key larger than @key, or @hi.
+ */
+static u_int64_t opt_find(struct mm *mm, u_int64_t lo, u_int64_t hi,
+			  u_int64_t key)
+{
+	u_int64_t *tree;
+	u_int64_t  node;
+
+	tree = mm->m_stack.key;
+	if (lo >= hi)
+		return hi;
+	/*
+	 * Climb from @lo to the first subtree to the right of it containing a
+	 * larger key...
+	 */
+	node = lo + mm->m_stack.size;
+	if (tree[node] > key)
+		return lo;
+	while (1) {
+		while (node & 1)
+			node /= 2;
+		if (node == 0)
+			return hi;
+		node++;
+		if (tree[node] > key)
+			break;
+	}
+	/*
+	 * ... and descend to its leftmost such leaf.
+	 */
+	while (node < mm->m_stack.size)
+		node = tree[2 * node] > key ? 2 * node : 2 * node + 1;
+	return min_t(u_int64_t, node - mm->m_stack.size, hi);
+}
+
+static void opt_place(struct mm *mm, u_int64_t slot, vpage_no_t owner,
+		      u_int64_t key)
+{
+	mm->m_stack.owner[slot] = owner;
+	if (owner != STACK_GHOST && owner != STACK_FREE)
+		vpage_at(mm, owner)->v_slot = slot + 1;
+	opt_key_set(mm, slot, key);
+}
+
+static int opt_depth(struct mm *mm, struct vpage *pg, char type,
+		     u_int64_t *depth)
+{
+	u_int64_t  hole;
+	u_int64_t  next;
+	u_int64_t  slot;
+	vpage_no_t carry;
+	u_int64_t  carry_key;
+	int        result;
+
+	*depth = pg->v_slot;
+	if (type == FSLOG_PUNCH) {
+		if (*depth != 0) {
+			pg->v_slot = 0;
+			opt_place(mm, *depth - 1, STACK_GHOST, OPT_GHOST);
+		}
+		return 0;
+	}
+	next = opt_next(mm);
+	if (*depth == 0) {
+		hole = mm->m_stack.nr;
+		if (hole < mm->m_stack.limit) {
+			if (hole == mm->m_stack.size) {
+				result = opt_stack_grow(mm);
+				if (result != 0)
+					return result;
+			}
+			mm->m_stack.nr++;
+		}
+	} else
+		hole = *depth - 1;
+	if (hole == 0) {
+		opt_place(mm, 0, pg->v_no, next);
+		return 0;
+	}
+	carry     = mm->m_stack.owner[0];
+	carry_key = mm->m_stack.key[mm->m_stack.size];
+	opt_place(mm, 0, pg->v_no, next);
+	for (slot = 1; (slot = opt_find(mm, slot, hole, carry_key)) < hole;
+	     slot++) {
+		vpage_no_t owner;
+		u_int64_t  key;
+
+		owner = mm->m_stack.owner[slot];
+		key   = mm->m_stack.key[mm->m_stack.size + slot];
+		opt_place(mm, slot, carry, carry_key);
+		carry     = owner;
+		carry_key = key;
+	}
+	if (*depth == 0 && (carry == STACK_GHOST || hole == mm->m_stack.nr)) {
+		/*
+		 * Ghost carried to the bottom of the stack is of no use, a
+		 * page carried past the limit falls off the stack.
+		 */
+		if (hole < mm->m_stack.nr)
+			mm->m_stack.nr--;
+		else if (carry != STACK_GHOST)
+			vpage_at(mm, carry)->v_slot = 0;
+	} else
+		opt_place(mm, hole, carry, carry_key);
+	return 0;
+}
+
+static void opt_read(struct mm *mm, struct vpage *pg)
+{
+	opt_alloc(mm, pg);
+	vpage_pagein(mm, pg);
+	opt_next_set(mm, pg->v_frame, opt_next(mm));
+}
+
+static void opt_write(struct mm *mm, struct vpage *pg)
+{
+	opt_alloc(mm, pg);
+	opt_next_set(mm, pg->v_frame, opt_next(mm));
+}
+
+/*
+ * TODO:
+ *
+ * LRFU: http://citeseer.ist.psu.edu/lee97implementation.html
+ */
+
+static const struct repalg algs[] = {
+	{
+		.r_name = "random",
+		.r_init = random_init,
+		.r_fini = generic_fini,
+
+		.r_read  = generic_read,
+		.r_ra    = generic_read,
+		.r_write = generic_write,
+		.r_fault = generic_read,
+		.r_punch = generic_punch,
+		.r_alloc = random_alloc
+	},
+	{
+		.r_name = "lru",
+		.r_init = generic_init,
+		.r_fini = lru_fini,
+
+		.r_read  = generic_read,
+		.r_ra    = generic_read,
+		.r_write = generic_write,
+		.r_fault = generic_read,
+		.r_punch = generic_punch,
+		.r_alloc = lru_alloc,
+		.r_depth = lru_depth
+	},
+	{
+		.r_name = "fifo",
+		.r_init = generic_init,
+		.r_fini = generic_fini,
+
+		.r_read  = generic_read,
+		.r_ra    = generic_read,
+		.r_write = generic_write,
+		.r_fault = generic_read,
+		.r_punch = generic_punch,
+		.r_alloc = fifo_alloc
+	},
+	{
+		.r_name = "fifo2",
+		.r_init = generic_init,
+		.r_fini = generic_fini,
+
+		.r_read  = generic_read,
+		.r_ra    = generic_read,
+		.r_write = generic_write,
+		.r_fault = generic_read,
+		.r_punch = generic_punch,
+		.r_alloc = fifo2_alloc
+	},
+	{
+		.r_name = "sfifo",
+		.r_init = generic_init,
+		.r_fini = generic_fini,
+
+		.r_read  = generic_read,
+		.r_ra    = generic_read,
+		.r_write = generic_write,
+		.r_fault = generic_read,
+		.r_punch = generic_punch,
+		.r_alloc = sfifo_alloc,
+		.r_param = sfifo_param
+	},
+	{
+		.r_name = "2q",
+		.r_init = generic_init,
+		.r_fini = generic_fini,
+
+		.r_read  = generic_read,
+		.r_ra    = generic_read,
+		.r_write = generic_write,
+		.r_fault = generic_read,
+		.r_punch = q2_punch,
+		.r_alloc = q2_alloc,
+		.r_param = q2_param
+	},
+	{
+		.r_name = "car",
+		.r_init = car_init,
+		.r_fini = car_fini,
+
+		.r_read  = generic_read,
+		.r_ra    = generic_read,
+		.r_write = generic_write,
+		.r_fault = generic_read,
+		.r_punch = car_punch,
+		.r_alloc = car_alloc
+	},
+	{
+		.r_name = "arc",
+		.r_init = car_init,
+		.r_fini = car_fini,
+
+		.r_read  = generic_read,
+		.r_ra    = generic_read,
+		.r_write = generic_write,
+		.r_fault = generic_read,
+		.r_punch = car_punch,
+		.r_alloc = arc_alloc
+	},
+	{
+		.r_name = "linux",
+		.r_init = generic_init,
+		.r_fini = generic_fini,
+
+		.r_read  = generic_read,
+		.r_ra    = generic_read,
+		.r_write = generic_write,
+		.r_fault = generic_read,
+		.r_punch = linux_punch,
+		.r_alloc = linux_alloc
+	},
+	{
+		.r_name = "worst",
+		.r_init = generic_init,
+		.r_fini = generic_fini,
+
+		.r_read  = generic_read,
+		.r_ra    = generic_read,
+		.r_write = generic_write,
+		.r_fault = generic_read,
+		.r_punch = generic_punch,
+		.r_alloc = worst_alloc
+	},
+	{
+		.r_name = "opt",
+		.r_init = opt_init,
+		.r_fini = opt_fini,
+
+		.r_read  = opt_read,
+		.r_ra    = opt_read,
+		.r_write = opt_write,
+		.r_fault = opt_read,
+		.r_punch = generic_punch,
+		.r_alloc = opt_alloc,
+		.r_depth = opt_depth,
+		.r_future = 1
+	},
+	{
+		.r_name = NULL
+	}
+};
+
+static void mm_fini(struct mm *mm)
+{
+	frame_no_t fno;
+	vpage_no_t vno;
+	inode_no_t ino;
+
+	mm->m_alg->r_fini(mm);
+
+	if (mm->m_objects != NULL) {
+		/*
+		 * Write only files that have pages, so that the rest of the
+		 * array is not populated on the way out.
+		 */
+		for (ino = 0; ino < mm->m_nr_objects; ++ino) {
+			if (object_at(mm, ino)->o_pages != NULL)
+				object_fini(mm, object_at(mm, ino));
+		}
+		for (ino = 0; ino < mm->m_nr_objects; ino += MM_CHUNK)
+			mm_area_free(mm->m_objects[ino >> MM_CHUNK_SHIFT],
+				     MM_CHUNK * sizeof(struct object));
+		free(mm->m_objects);
+		mm->m_objects = NULL;
+	}
+
+	if (mm->m_frames != NULL) {
+		for (fno = 0; fno < mm->m_nr_fresh; ++fno)
+			frame_fini(mm, &mm->m_frames[fno]);
+		mm_area_free(mm->m_frames,
+			     mm->m_nr_frames * sizeof(struct frame));
+		mm->m_frames = NULL;
+	}
+	if (mm->m_vpages != NULL) {
+		for (vno = 0; vno < mm->m_nr_vpages; vno += MM_CHUNK)
+			mm_area_free(mm->m_vpages[vno >> MM_CHUNK_SHIFT],
+				     MM_CHUNK * sizeof(struct vpage));
+		free(mm->m_vpages);
+		mm->m_vpages = NULL;
+	}
+	if (mm->m_vpages_cold != NULL) {
+		for (vno = 0; vno < mm->m_nr_vpages; vno += MM_CHUNK)
+			mm_area_free(mm->m_vpages_cold[vno >> MM_CHUNK_SHIFT],
+				     MM_CHUNK * sizeof(struct vpage_cold));
+		free(mm->m_vpages_cold);
+		mm->m_vpages_cold = NULL;
+	}
+}
+
+/*
+ * Initializes @mm. ->m_nr_vpages and ->m_nr_objects, if set, are used as
+ * hints to pre-allocate pages and files.
+ */
+static int mm_init(struct mm *mm, const struct repalg *alg)
+{
+	u_int64_t nr_vpages;
+	u_int64_t nr_objects;
+	int       result;
+
+	mm->m_alg = alg;
+	mm->m_nr_free = mm->m_nr_frames;
+	/*
+	 * Same sequence as random() without srandom().
+	 */
+	memset(&mm->m_rand, 0, sizeof mm->m_rand);
+	initstate_r(1, mm->m_rand_state, sizeof mm->m_rand_state, &mm->m_rand);
+	INIT_LIST_HEAD(&mm->m_freelist);
+	INIT_LIST_HEAD(&mm->m_lru);
+	INIT_LIST_HEAD(&mm->m_fifo);
+	INIT_LIST_HEAD(&mm->m_fifo2);
+
+	INIT_LIST_HEAD(&mm->m_q2.am);
+	INIT_LIST_HEAD(&mm->m_q2.a1in);
+	vlist_init(&mm->m_q2.a1out);
+
+	INIT_LIST_HEAD(&mm->m_linux.active);
+	INIT_LIST_HEAD(&mm->m_linux.inactive);
+
+	nr_vpages  = mm->m_nr_vpages;
+	nr_objects = mm->m_nr_objects;
+	mm->m_nr_vpages  = 0;
+	mm->m_nr_objects = 0;
+
+	mm->m_nr_fresh = 0;
+	mm->m_frames = mm->m_nr_frames <= MM_MAX ?
+		mm_area_alloc(mm->m_nr_frames * sizeof(struct frame)) : NULL;
+
+	if (mm->m_frames != NULL && vpages_grow(mm, nr_vpages) == 0 &&
+	    objects_grow(mm, nr_objects) == 0)
+		result = alg->r_init(mm);
+	else
+		result = ENOMEM;
+	if (result != 0)
+		mm_fini(mm);
+	return result;
+}
+
+static void vpage_print(const char *prefix, const struct vpage *pg)
+{
+	struct frame *frame;
+
+	frame = pg->v_frame;
+	printf("%s%8.8x %8.8x ", prefix, pg->v_no, pg->v_flags);
+	if (frame != NULL)
+		printf("[%16.16x %8.8x]\n", frame->f_no, frame->f_flags);
+	else
+		printf("NR\n");
+}
+
+/*
+ * List of memory sizes, given to -M and -C.
+ */
+struct sizes {
+	u_int64_t *sz_size;
+	u_int64_t  sz_nr;
+};
+
+static int sizes_add(struct sizes *sizes, u_int64_t size)
+{
+	u_int64_t *area;
+
+	area = realloc(sizes->sz_size, (sizes->sz_nr + 1) * sizeof area[0]);
+	if (area == NULL)
+		return ENOMEM;
+	area[sizes->sz_nr++] = size;
+	sizes->sz_size = area;
+	return 0;
+}
+
+/*
+ * Parses comma separated list of memory sizes, appending them to @sizes.
+ */
+static int sizes_parse(struct sizes *sizes, const char *arg, int radix)
+{
+	u_int64_t size;
+	char     *eoc;
+
+	do {
+		size = strtoull(arg, &eoc, radix);
+		if (eoc == arg || (*eoc != ',' && *eoc != 0))
+			return EINVAL;
+		if (sizes_add(sizes, size) != 0)
+			return ENOMEM;
+		arg = eoc + 1;
+	} while (*eoc != 0);
+	return 0;
+}
+
+static void sizes_fini(struct sizes *sizes)
+{
+	free(sizes->sz_size);
+}
+
+/*
+ * Miss ratio curve (-C): histogram of stack distances of accesses, see
+ * ->r_depth().
+ */
+struct curve {
+	/*
+	 * ->c_hist[d] is the number of accesses with stack distance d.
+	 */
+	u_int64_t *c_hist;
+	u_int64_t  c_hist_nr;
+	/*
+	 * number of counted accesses.
+	 */
+	u_int64_t  c_total;
+	/*
+	 * reuse histograms (-H) to add every access to, or NULL.
+	 */
+	struct reuse *c_reuse;
+};
+
+static int curve_add(struct curve *curve, char type, u_int64_t depth)
+{
+	/*
+	 * Writes and punches are neither hits nor misses, see ->m_total.
+	 */
+	if (type == FSLOG_WRITE || type == FSLOG_PUNCH)
+		return 0;
+	curve->c_total++;
+	if (depth >= curve->c_hist_nr) {
+		u_int64_t  nr;
+		u_int64_t *hist;
+
+		nr = max_t(u_int64_t, 2 * depth, 1024);
+		hist = realloc(curve->c_hist, nr * sizeof hist[0]);
+		if (hist == NULL)
+			return ENOMEM;
+		memset(hist + curve->c_hist_nr, 0,
+		       (nr - curve->c_hist_nr) * sizeof hist[0]);
+		curve->c_hist = hist;
+		curve->c_hist_nr = nr;
+	}
+	/*
+	 * Misses with any number of frames go to ->c_hist[0], and are not
+	 * used.
+	 */
+	curve->c_hist[depth]++;
+	return 0;
+}
+
+/*
+ * Scales counts sampled at @rate back to the trace, where @seen references
+ * were made.
+ */
+static void result_scale(u_int64_t *hits, u_int64_t *misses, double rate,
+			 u_int64_t seen)
+{
+	if (rate < 1.0) {
+		*misses = min_t(u_int64_t, *misses / rate + 0.5, seen);
+		*hits   = seen - *misses;
+	}
+}
+
+/*
+ * Prints results for memory of @size frames, prefixed with @name when several
+ * configurations are simulated.
+ */
+static void result_print(const char *name, u_int64_t size, u_int64_t hits,
+			 u_int64_t misses, double rate, u_int64_t seen)
+{
+	result_scale(&hits, &misses, rate, seen);
+	if (name != NULL)
+		printf("%-12s ", name);
+	/*
+	 * Same format as tables in "results".
+	 */
+	if (size != 0)
+		printf("% 7.7lld ", (long long)size);
+	printf("%12llu %12llu %f\n", hits, misses, hits*100.0/(hits + misses));
+}
+
+/*
+ * Prints hits and misses for every memory size in @sizes, or for every size
+ * where the number of hits changes if @sizes is empty. With sampling, memory
+ * of N frames corresponds to N * @rate frames of the sampled trace.
+ */
+static void curve_print(struct curve *curve, const char *name,
+			const struct sizes *sizes, double rate, u_int64_t seen)
+{
+	u_int64_t depth;
+	u_int64_t hits;
+	u_int64_t i;
+
+	/*
+	 * Turn the histogram into cumulative hit counts.
+	 */
+	for (depth = 1, hits = 0; depth < curve->c_hist_nr; ++depth) {
+		if (sizes->sz_nr == 0 && curve->c_hist[depth] != 0)
+			result_print(name, depth / rate + 0.5,
+				     hits + curve->c_hist[depth],
+				     curve->c_total - hits -
+				     curve->c_hist[depth], rate, seen);
+		hits += curve->c_hist[depth];
+		curve->c_hist[depth] = hits;
+	}
+	for (i = 0; i < sizes->sz_nr; ++i) {
+		depth = max_t(u_int64_t, sizes->sz_size[i] * rate + 0.5, 1);
+		depth = min_t(u_int64_t, depth, curve->c_hist_nr - 1);
+		hits  = curve->c_hist_nr > 0 ? curve->c_hist[depth] : 0;
+		result_print(name, sizes->sz_size[i], hits,
+			     curve->c_total - hits, rate, seen);
+	}
+}
+
+/*
+ * Returns the largest stack distance that matters for @sizes.
+ */
+static u_int64_t curve_limit(const struct sizes *sizes, double rate)
+{
+	u_int64_t limit;
+	u_int64_t i;
+
+	if (sizes->sz_nr == 0)
+		return ~0ULL;
+	for (i = 0, limit = 1; i < sizes->sz_nr; ++i)
+		limit = max_t(u_int64_t, limit,
+			      sizes->sz_size[i] * rate + 0.5);
+	return limit;
+}
+
+static void curve_fini(struct curve *curve)
+{
+	free(curve->c_hist);
+}
+
+/*
+ * REUSE
+ *
+ * Reuse histograms (-H). For every access type, the following are counted:
+ *
+ *     - the stack distance of accesses (see ->r_depth()). With lru this is
+ *       the reuse distance: the number of distinct pages referenced since
+ *       the previous reference to the page, the page itself included, that
+ *       is, the smallest memory where the access hits;
+ *
+ *     - the gap since the previous reference to the same page, in records
+ *       (numbered as by -s) and, with raw input, in microseconds, the units
+ *       of fr_time.
+ *
+ * Distances come with the single pass of -C, gaps need the last reference of
+ * every page in a table beside the simulation. Values are binned by powers of
+ * two: bin k > 0 holds values in [2^(k-1), 2^k - 1] and bin 0 holds 0.
+ * References with no previous one are counted apart, as cold. For distances
+ * these include references to truncated pages. Distances and counts are
+ * scaled with sampling, as in results.
+ */
+
+enum {
+	/*
+	 * R, r, W, P.
+	 */
+	REUSE_TYPES = 4,
+	REUSE_BINS  = 65
+};
+
+enum reuse_hist {
+	RH_DISTANCE,
+	RH_RECORDS,
+	RH_TIME,
+	RH_NR
+};
+
+/*
+ * last reference to a page.
+ */
+struct reuse_page {
+	/*
+	 * record of the reference plus one, 0 if none.
+	 */
+	u_int64_t rp_recno;
+	u_int64_t rp_time;
+};
+
+struct reuse {
+	/*
+	 * ->ru_hist[h][t][k] is the count in bin k of histogram h for access
+	 * type t, ->ru_cold[h][t] is the count of cold references.
+	 */
+	u_int64_t           ru_hist[RH_NR][REUSE_TYPES][REUSE_BINS];
+	u_int64_t           ru_cold[RH_NR][REUSE_TYPES];
+	/*
+	 * chunked table of last references, indexed by page number.
+	 */
+	struct reuse_page **ru_page;
+	u_int64_t           ru_nr_page;
+	/*
+	 * records read up to the last access.
+	 */
+	u_int64_t           ru_recno;
+	double              ru_rate;
+	/*
+	 * true if the trace has time-stamps.
+	 */
+	int                 ru_time;
+};
+
+static const char reuse_types[] = "RrWP";
+
+static void reuse_init(struct reuse *ru, u_int64_t start, double rate,
+		       int time)
+{
+	memset(ru, 0, sizeof *ru);
+	ru->ru_recno = start;
+	ru->ru_rate  = rate;
+	ru->ru_time  = time;
+}
+
+static void reuse_fini(struct reuse *ru)
+{
+	u_int64_t vno;
+
+	for (vno = 0; vno < ru->ru_nr_page; vno += MM_CHUNK)
+		mm_area_free(ru->ru_page[vno >> MM_CHUNK_SHIFT],
+			     MM_CHUNK * sizeof(struct reuse_page));
+	free(ru->ru_page);
+	ru->ru_page = NULL;
+	ru->ru_nr_page = 0;
+}
+
+static int reuse_bin(u_int64_t val)
+{
+	return val == 0 ? 0 : 64 - __builtin_clzll(val);
+}
+
+/*
+ * Counts @access, at stack distance @depth.
+ */
+static int reuse_add(struct reuse *ru, const struct access *access,
+		     u_int64_t depth)
+{
+	struct reuse_page *rp;
+	const char        *type;
+	u_int64_t          recno;
+	u_int64_t          vno;
+	int                t;
+
+	recno = ru->ru_recno + access->a_skip - 1;
+	ru->ru_recno += access->a_skip;
+	type = strchr(reuse_types, access->a_type);
+	if (type == NULL || access->a_type == 0)
+		return 0;
+	t   = type - reuse_types;
+	vno = access->a_page;
+	if (vno >= ru->ru_nr_page &&
+	    chunk_grow((void ***)&ru->ru_page, &ru->ru_nr_page, vno + 1,
+		       sizeof(struct reuse_page)) != 0)
+		return ENOMEM;
+	rp = &ru->ru_page[vno >> MM_CHUNK_SHIFT][vno & (MM_CHUNK - 1)];
+	if (depth > 0)
+		ru->ru_hist[RH_DISTANCE][t]
+			[reuse_bin(depth / ru->ru_rate + 0.5)]++;
+	else
+		ru->ru_cold[RH_DISTANCE][t]++;
+	if (rp->rp_recno > 0) {
+		ru->ru_hist[RH_RECORDS][t][reuse_bin(recno + 1 -
+						     rp->rp_recno)]++;
+		/*
+		 * Merged captures can be slightly out of time order.
+		 */
+		ru->ru_hist[RH_TIME][t]
+			[reuse_bin(access->a_time > rp->rp_time ?
+				   access->a_time - rp->rp_time : 0)]++;
+	} else {
+		ru->ru_cold[RH_RECORDS][t]++;
+		ru->ru_cold[RH_TIME][t]++;
+	}
+	rp->rp_recno = recno + 1;
+	rp->rp_time  = access->a_time;
+	return 0;
+}
+
+/*
+ * Forgets counts, but not last references, at the end of the warm-up.
+ */
+static void reuse_reset(struct reuse *ru)
+{
+	memset(ru->ru_hist, 0, sizeof ru->ru_hist);
+	memset(ru->ru_cold, 0, sizeof ru->ru_cold);
+}
+
+/*
+ * Writes non-empty bins to @out, one per line:
+ *
+ *     <algorithm> distance|records|time <type> <low> <high> <count>
+ *
+ * with "- -" for the bounds of cold references.
+ */
+static void reuse_print(const struct reuse *ru, const char *name, FILE *out)
+{
+	static const char *hist[RH_NR] = {
+		[RH_DISTANCE] = "distance",
+		[RH_RECORDS]  = "records",
+		[RH_TIME]     = "time"
+	};
+	u_int64_t low;
+	u_int64_t count;
+	int       h;
+	int       t;
+	int       k;
+
+	for (h = 0; h < RH_NR; ++h) {
+		if (h == RH_TIME && !ru->ru_time)
+			continue;
+		for (t = 0; t < REUSE_TYPES; ++t) {
+			count = ru->ru_cold[h][t];
+			if (count != 0)
+				fprintf(out, "%s %s %c - - %llu\n", name,
+					hist[h], reuse_types[t],
+					(unsigned long long)
+					(count / ru->ru_rate + 0.5));
+			for (k = 0; k < REUSE_BINS; ++k) {
+				count = ru->ru_hist[h][t][k];
+				if (count == 0)
+					continue;
+				low = k > 0 ? 1ULL << (k - 1) : 0;
+				fprintf(out, "%s %s %c %llu %llu %llu\n", name,
+					hist[h], reuse_types[t],
+					(unsigned long long)low,
+					(unsigned long long)(k > 0 ?
+							     2 * low - 1 : 0),
+					(unsigned long long)
+					(count / ru->ru_rate + 0.5));
+			}
+		}
+	}
+}
+
+/*
+ * SERIES
+ *
+ * Warm-up (-w) and windows (-W). Both are measured either in records of the
+ * trace, numbered as by -s, or, for raw traces, in seconds since its start.
+ *
+ * The warm-up ends with the first access from record (or time) past it. At
+ * this point hits and misses, and the miss ratio curve, are reset, so that
+ * results cover only the rest of the trace. The simulation itself goes on
+ * undisturbed.
+ *
+ * Windows are aligned to multiples of their length. Once an access falls
+ * past the current window, a line with hits, misses and hit ratio over the
+ * window is written, for every configuration, to a buffered stream:
+ *
+ *     <algorithm> <frames> <start> <hits> <misses> <ratio>
+ *
+ * where <start> is the first record, or the first second, of the window.
+ * Windows without reads are skipped. Counts are scaled with sampling, as in
+ * results.
+ *
+ * Nothing is written during the warm-up. The window where the warm-up ends is
+ * restarted at the first access past it, which is then its <start>, so that
+ * no window mixes warm-up and later accesses.
+ */
+
+/*
+ * length of warm-up or of a window.
+ */
+struct span {
+	/*
+	 * records, or microseconds if ->sp_time is set. 0 if not given.
+	 */
+	u_int64_t sp_len;
+	int       sp_time;
+};
+
+/*
+ * options shared by all configurations.
+ */
+struct series_param {
+	struct span sp_warm;
+	struct span sp_window;
+	/*
+	 * stream windows are written to.
+	 */
+	FILE       *sp_out;
+	double      sp_rate;
+};
+
+/*
+ * state of a configuration.
+ */
+struct series {
+	/*
+	 * records read up to the last simulated access, and page references
+	 * seen by the sampling in them.
+	 */
+	u_int64_t se_recno;
+	u_int64_t se_seen;
+	/*
+	 * true until the warm-up ends.
+	 */
+	int       se_warm;
+	/*
+	 * page references seen during the warm-up.
+	 */
+	u_int64_t se_warm_seen;
+	/*
+	 * start and end of the current window, in records or microseconds, and
+	 * hits, misses and seen references before it started.
+	 */
+	u_int64_t se_start;
+	u_int64_t se_end;
+	u_int64_t se_hits;
+	u_int64_t se_misses;
+	u_int64_t se_seen0;
+};
+
+/*
+ * Parses <records> or <seconds>s into @span.
+ */
+static int span_parse(struct span *span, const char *arg, int radix)
+{
+	char  *eoc;
+	double sec;
+
+	if (*arg != 0 && arg[strlen(arg) - 1] == 's') {
+		sec = strtod(arg, &eoc);
+		if (*eoc != 's' || eoc[1] != 0 || !(sec > 0))
+			return EINVAL;
+		span->sp_len  = sec * 1000000;
+		span->sp_time = 1;
+	} else {
+		span->sp_len  = strtoull(arg, &eoc, radix);
+		span->sp_time = 0;
+		if (*eoc != 0)
+			return EINVAL;
+	}
+	return span->sp_len > 0 ? 0 : EINVAL;
+}
+
+static void series_init(struct series *se, const struct series_param *sp,
+			u_int64_t start)
+{
+	memset(se, 0, sizeof *se);
+	se->se_recno = start;
+	se->se_warm  = sp->sp_warm.sp_len > 0;
+	se->se_end   = sp->sp_window.sp_len > 0 ? 0 : ~0ULL;
+}
+/*
+ * Simulated configuration: an algorithm with its parameters and memory size.
+ * All configurations are fed the same accesses in lockstep.
+ */
+struct config {
+	/*
+	 * algorithm and parameters, as given to -a.
+	 */
+	const char  *cf_name;
+	/*
+	 * memory size before sampling.
+	 */
+	u_int64_t    cf_frames;
+	struct mm    cf_mm;
+	/*
+	 * miss ratio curve, with -C.
+	 */
+	struct curve cf_curve;
+	/*
+	 * state saved for a checkpoint (-c), and its size. When resuming
+	 * (-R), the size and offset of the state in the checkpoint.
+	 */
+	char        *cf_ckpt;
+	size_t       cf_ckpt_size;
+	off_t        cf_ckpt_off;
+	/*
+	 * warm-up and windows, with -w and -W.
+	 */
+	struct series cf_series;
+	/*
+	 * reuse histograms, with -H.
+	 */
+	struct reuse  cf_reuse;
+};
+
+/*
+ * Sets up @cf to run algorithm @name, which is <algorithm>[:<param>...], in
+ * memory of @frames frames. Options common to all configurations are taken
+ * from @proto.
+ */
+static int config_init(struct config *cf, const char *name, u_int64_t frames,
+		       const struct mm *proto, int radix)
+{
+	const struct repalg *alg;
+	u_int64_t      param[4];
+	const char    *scan;
+	char          *eoc;
+	size_t         len;
+	int            nr;
+
+	len = strcspn(name, ":");
+	for (alg = &algs[0]; alg->r_name != NULL; alg++) {
+		if (strlen(alg->r_name) == len &&
+		    !strncmp(alg->r_name, name, len))
+			break;
+	}
+	if (alg->r_name == NULL) {
+		fprintf(stderr, "Unknown algorithm `%s'\n", name);
+		return EINVAL;
+	}
+	cf->cf_name   = name;
+	cf->cf_frames = frames;
+	cf->cf_mm     = *proto;
+	cf->cf_mm.m_alg = alg;
+	cf->cf_mm.m_nr_frames = frames;
+	for (nr = 0, scan = name + len; *scan == ':'; scan = eoc) {
+		if (nr == sizeof_array(param))
+			break;
+		param[nr++] = strtoull(scan + 1, &eoc, radix);
+		if (eoc == scan + 1)
+			break;
+	}
+	if (*scan != 0 ||
+	    (nr > 0 && (alg->r_param == NULL ||
+			alg->r_param(&cf->cf_mm, nr, param) != 0))) {
+		fprintf(stderr, "Malformed parameters: `%s'\n", name);
+		return EINVAL;
+	}
+	return 0;
+}
+
+/*
+ * Ends the warm-up of @cf, restarting the current window at @pos.
+ */
+static void series_warm(struct config *cf, u_int64_t pos)
+{
+	struct series *se = &cf->cf_series;
+	struct mm     *mm = &cf->cf_mm;
+
+	se->se_start  = pos;
+	se->se_hits   = 0;
+	se->se_misses = 0;
+	se->se_seen0  = se->se_seen;
+	mm->m_hits   = 0;
+	mm->m_misses = 0;
+	cf->cf_curve.c_total = 0;
+	if (cf->cf_curve.c_hist != NULL)
+		memset(cf->cf_curve.c_hist, 0,
+		       cf->cf_curve.c_hist_nr * sizeof cf->cf_curve.c_hist[0]);
+	if (cf->cf_curve.c_reuse != NULL)
+		reuse_reset(cf->cf_curve.c_reuse);
+	se->se_warm_seen = se->se_seen;
+	se->se_warm      = 0;
+}
+
+/*
+ * Writes the current window of @cf, if there were reads in it, past the
+ * warm-up.
+ */
+static void series_print(const struct series_param *sp, struct config *cf)
+{
+	struct series *se = &cf->cf_series;
+	u_int64_t      hits;
+	u_int64_t      misses;
+	u_int64_t      start;
+
+	hits   = cf->cf_mm.m_hits - se->se_hits;
+	misses = cf->cf_mm.m_misses - se->se_misses;
+	if (se->se_warm || hits + misses == 0)
+		return;
+	result_scale(&hits, &misses, sp->sp_rate, se->se_seen - se->se_seen0);
+	start = se->se_start;
+	/*
+	 * Keep the line whole, with -j.
+	 */
+	flockfile(sp->sp_out);
+	fprintf(sp->sp_out, "%s %llu ", cf->cf_name,
+		(unsigned long long)cf->cf_frames);
+	if (sp->sp_window.sp_time)
+		fprintf(sp->sp_out, "%llu.%06llu",
+			(unsigned long long)(start / 1000000),
+			(unsigned long long)(start % 1000000));
+	else
+		fprintf(sp->sp_out, "%llu", (unsigned long long)start);
+	fprintf(sp->sp_out, " %llu %llu %f\n", (unsigned long long)hits,
+		(unsigned long long)misses, hits * 100.0 / (hits + misses));
+	funlockfile(sp->sp_out);
+}
+
+/*
+ * Called before @access is simulated in @cf.
  */
+static void series_step(const struct series_param *sp, struct config *cf,
+			const struct access *access)
+{
+	struct series *se = &cf->cf_series;
+	u_int64_t      recno;
+	u_int64_t      pos;
 
-struct opt_access {
-	u_int64_t        oa_turn;
-	struct list_head oa_linkage;
-};
+	/*
+	 * Record of the access.
+	 */
+	recno = se->se_recno + access->a_skip - 1;
+	pos = sp->sp_window.sp_time ? access->a_time : recno;
+	if (se->se_warm && (sp->sp_warm.sp_time ? access->a_time : recno) >=
+	    sp->sp_warm.sp_len)
+		series_warm(cf, pos);
+	if (pos >= se->se_end) {
+		series_print(sp, cf);
+		se->se_end    = (pos / sp->sp_window.sp_len + 1) *
+			sp->sp_window.sp_len;
+		se->se_start  = se->se_end - sp->sp_window.sp_len;
+		se->se_hits   = cf->cf_mm.m_hits;
+		se->se_misses = cf->cf_mm.m_misses;
+		se->se_seen0  = se->se_seen;
+	}
+	se->se_recno += access->a_skip;
+	se->se_seen  += access->a_seen;
+}
 
-static struct opt_access *opt_from_list(struct list_head *head)
+/*
+ * Writes the last window of @cf, at the end of the trace.
+ */
+static void series_fini(const struct series_param *sp, struct config *cf)
 {
-	return container_of(head, struct opt_access, oa_linkage);
+	if (sp->sp_window.sp_len > 0)
+		series_print(sp, cf);
 }
 
-static int opt_build(struct mm *mm)
+/*
+ * Truncate callbacks for object_pages_from(), @arg is the algorithm.
+ */
+static int punch_one(struct mm *mm, struct vpage *pg, const void *arg)
 {
-	int result;
-	u_int64_t      epoch;
-	struct vpage  *scan;
-	struct access *peek;
-
-	peek = NULL;
-
-	for (epoch = 1, result = 0; result == 0; epoch++) {
-		result = access_look_ahead(mm, &peek);
-		if (result == 0) {
-			/*
-			 * WRITE and PUNCH do not cause fault, skip them.
-			 */
-			if (peek->a_type != FSLOG_WRITE &&
-			    peek->a_type != FSLOG_PUNCH) {
-				struct opt_access *oa;
-
-				oa = malloc(sizeof *oa);
-				if (oa != NULL) {
-					scan = &mm->m_vpages[peek->a_page];
-					oa->oa_turn = epoch;
-					list_add_tail(&oa->oa_linkage,
-						      &scan->v_stuff);
-				} else
-					result = ENOMEM;
-			}
-		} else {
-			result = 0;
-			break;
-		}
-	}
-	if (verbose & VERBOSE_TABLE) {
-		vpage_no_t vno;
+	const struct repalg *alg = arg;
 
-		for (vno = 0; vno < mm->m_nr_vpages; ++vno) {
-			struct opt_access *oa;
-
-			if (!list_empty(&mm->m_vpages[vno].v_stuff)) {
-				printf("%llx: ", vno);
-				list_for_each_entry(oa,
-						    &mm->m_vpages[vno].v_stuff,
-						    oa_linkage)
-					printf("%llx ", oa->oa_turn);
-				printf("\n");
-			}
-		}
-	}
-	return result;
+	alg->r_punch(mm, pg);
+	return 0;
 }
 
-static void opt_alloc(struct mm *mm, struct vpage *pg)
+static int punch_depth(struct mm *mm, struct vpage *pg, const void *arg)
 {
-	struct frame *frame;
-	struct frame *scan;
-
-	assert(vpage_invariant(mm, pg));
-
-	if (pg->v_frame == NULL) {
-		if (mm->m_nr_free == 0) {
-			frame_no_t fno;
-			u_int64_t  next_max;
-
-			next_max = 0;
-			frame = NULL;
-			for (fno = 0, scan = mm->m_frames;
-			     fno < mm->m_nr_frames; fno++, scan++) {
-				struct vpage *page;
-				u_int64_t     next;
-
-				page = scan->f_page;
-				assert(page != NULL);
-				assert(scan == page->v_frame);
-				if (!list_empty(&page->v_stuff)) {
-					struct opt_access *oa;
-
-					oa = opt_from_list(page->v_stuff.next);
-					next = oa->oa_turn;
-					assert(next > mm->m_total);
-					if (next > next_max) {
-						next_max = next;
-						frame    = scan;
-					}
-				} else {
-					frame = scan;
-					break;
-				}
-
-			}
-			if (verbose & VERBOSE_TABLE) {
-				printf("%8llx: ", mm->m_total);
-				for (fno = 0, scan = mm->m_frames;
-				     fno < mm->m_nr_frames; fno++, scan++) {
-					struct vpage *page;
+	const struct repalg *alg = arg;
+	u_int64_t            depth;
 
-					page = scan->f_page;
-					if (!list_empty(&page->v_stuff)) {
-						struct opt_access *oa;
-
-						oa = opt_from_list(page->v_stuff.next);
-						printf("%8llx", oa->oa_turn);
-					} else
-						printf("   never");
-					printf(scan == frame ? "*" : " ");
-				}
-				printf("\n");
-			}
-			assert(frame != NULL);
-			frame_steal(mm, frame);
-		}
-		assert(mm->m_nr_free > 0);
-		frame = frame_free_get(mm);
-		vpage_place(mm, pg, frame);
-		assert(list_empty(&frame->f_linkage));
-	}
-	assert(vpage_invariant(mm, pg));
-	assert(pg->v_frame != NULL);
+	return alg->r_depth(mm, pg, FSLOG_PUNCH, &depth);
 }
 
-static int opt_init(struct mm *mm)
+/*
+ * Calls @method of @alg. Generic methods are expanded in place, so that with
+ * a constant @alg the allocator is called directly.
+ */
+static __always_inline void repalg_call(const struct repalg *alg,
+					void (*method)(struct mm *,
+						       struct vpage *),
+					struct mm *mm, struct vpage *pg)
 {
-	return opt_build(mm);
+	if (method == generic_read) {
+		alg->r_alloc(mm, pg);
+		vpage_pagein(mm, pg);
+	} else if (method == generic_write)
+		alg->r_alloc(mm, pg);
+	else
+		method(mm, pg);
 }
 
-static void opt_fini(struct mm *mm)
+/*
+ * Simulates @access in @mm, which runs @alg, or computes its stack distance,
+ * if @curve is not NULL.
+ *
+ * This is instantiated for every algorithm below, with a constant @alg, so
+ * that methods are called directly, and small ones are inlined.
+ */
+static __always_inline int mm_access_by(struct mm *mm,
+					const struct access *access,
+					struct curve *curve,
+					const struct repalg *alg)
 {
+	vpage_no_t     vpage;
+	inode_no_t     ino;
+	pgoff_t        index;
+	struct vpage  *pg;
+	struct object *object;
+	char           type;
+	char           prefix[] = "? ";
+	int            result;
+
+	vpage = access->a_page;
+	ino   = access->a_object;
+	index = access->a_index;
+	type  = access->a_type;
+
+	pg = vpage_get(mm, vpage);
+	object = object_get(mm, ino);
+	if (pg == NULL || object == NULL) {
+		fprintf(stderr, "Cannot allocate page %llu of file %llu\n",
+			vpage, ino);
+		return ENOMEM;
+	}
+	if (!(pg->v_flags & VP_SEEN)) {
+		/*
+		 * First time this page is seen.
+		 */
+		pg->v_no     = vpage;
+		pg->v_object = ino;
+		object->o_no = ino;
+		vpage_cold(mm, pg)->vc_index = index;
+		pg->v_flags |= (index << VP_ISHIFT) & VP_IMASK;
+		if (object_page_add(object, index, vpage) != 0) {
+			fprintf(stderr, "Cannot add page %llu to file %llu\n",
+				vpage, ino);
+			return ENOMEM;
+		}
+	}
+	pg->v_flags |= VP_SEEN;
+	if (pg->v_object != ino) {
+		fprintf(stderr, "Invalid ino: %x != %llx\n",
+			pg->v_object, ino);
+		return EINVAL;
+	}
 	/*
-	 * XXX add cleanup.
+	 * Page numbers are assigned per (file, index) by the trace converters.
+	 * Only the low bits of the index are checked, not to touch the cold
+	 * part of the page on every access, which is enough to catch a
+	 * converter out of step.
 	 */
+	if ((pg->v_flags ^ (index << VP_ISHIFT)) & VP_IMASK) {
+		fprintf(stderr, "Invalid index: %llx != %llx\n",
+			(unsigned long long)vpage_cold(mm, pg)->vc_index,
+			(unsigned long long)index);
+		return EINVAL;
+	}
+	assert(vpage_cold(mm, pg)->vc_index == index);
+
+	prefix[0] = type;
+	if (verbose & VERBOSE_LOG)
+		vpage_print(prefix, pg);
+	if (type != FSLOG_WRITE && type != FSLOG_PUNCH) {
+		if (pg->v_frame != NULL)
+			mm->m_hits++;
+		else
+			mm->m_misses++;
+	}
+	mm->m_total++;
+	if (curve != NULL) {
+		u_int64_t depth = 0;
+
+		if (type == FSLOG_PUNCH)
+			result = object_pages_from(mm, object, index,
+						   punch_depth, alg);
+		else {
+			result = alg->r_depth(mm, pg, type, &depth);
+			if (result == 0)
+				result = curve_add(curve, type, depth);
+		}
+		if (result == 0 && curve->c_reuse != NULL)
+			result = reuse_add(curve->c_reuse, access, depth);
+		if (result != 0)
+			fprintf(stderr, "Cannot compute curve: %d\n", result);
+		return result;
+	}
+	switch (type) {
+	case FSLOG_READ:
+		repalg_call(alg, alg->r_read, mm, pg);
+		break;
+	case FSLOG_RA:
+		repalg_call(alg, alg->r_ra, mm, pg);
+		break;
+	case FSLOG_WRITE:
+		repalg_call(alg, alg->r_write, mm, pg);
+		break;
+	case FSLOG_PFAULT:
+		repalg_call(alg, alg->r_fault, mm, pg);
+		break;
+	case FSLOG_PUNCH:
+		return object_pages_from(mm, object, index, punch_one, alg);
+	default:
+		fprintf(stderr, "Invalid access type `%c'", type);
+		return EINVAL;
+	}
+	if (pg->v_frame == NULL) {
+		fprintf(stderr, "Frame wasn't installed\n");
+		return EINVAL;
+	}
+	if (type == FSLOG_WRITE)
+		pg->v_frame->f_flags |= FR_DIRTY;
+	pg->v_frame->f_flags |= FR_REF;
+	if ((verbose & VERBOSE_PROGRESS) && mm->m_total % 1000 == 0)
+		printf(".");
+	return 0;
 }
 
-static void opt_read(struct mm *mm, struct vpage *pg)
-{
-	struct opt_access *oa;
+#define MM_ACCESS(i)							\
+static int mm_access_ ## i(struct mm *mm, const struct access *access,	\
+			   struct curve *curve)				\
+{									\
+	return mm_access_by(mm, access, curve, &algs[i]);		\
+}
 
-	if (!list_empty(&pg->v_stuff)) {
-		oa = opt_from_list(pg->v_stuff.next);
-		assert(oa->oa_turn == mm->m_total);
-		list_del_init(&oa->oa_linkage);
-		free(oa);
-	}
+MM_ACCESS(0)
+MM_ACCESS(1)
+MM_ACCESS(2)
+MM_ACCESS(3)
+MM_ACCESS(4)
+MM_ACCESS(5)
+MM_ACCESS(6)
+MM_ACCESS(7)
+MM_ACCESS(8)
+MM_ACCESS(9)
+MM_ACCESS(10)
 
-	mm->m_alg->r_alloc(mm, pg);
-	vpage_pagein(mm, pg);
+/*
+ * mm_access_by() for every entry of algs[].
+ */
+static int (*const mm_access_alg[])(struct mm *, const struct access *,
+				    struct curve *) = {
+	mm_access_0,
+	mm_access_1,
+	mm_access_2,
+	mm_access_3,
+	mm_access_4,
+	mm_access_5,
+	mm_access_6,
+	mm_access_7,
+	mm_access_8,
+	mm_access_9,
+	mm_access_10
+};
+
+_Static_assert(sizeof_array(mm_access_alg) == sizeof_array(algs) - 1,
+	       "mm_access_alg[] must match algs[]");
+
+static int mm_access(struct mm *mm, const struct access *access,
+		     struct curve *curve)
+{
+	return mm_access_alg[mm->m_alg - algs](mm, access, curve);
 }
 
 /*
- * TODO:
+ * CHECKPOINT
  *
- * LRFU: http://citeseer.ist.psu.edu/lee97implementation.html
+ * With -c <record>:<file>, the state of every configuration is saved once the
+ * first <record> records of the trace are simulated, and -R <file> resumes a
+ * run from there, giving the same results as a run that did not stop.
+ *
+ * A checkpoint holds the state of the source at the mark (struct
+ * source_mark), which is all that page and file numbering and time-stamps of
+ * the following records depend on, and then, for every configuration, its
+ * memory and miss ratio curve. Pointers are saved as page and frame numbers:
+ * list of frames are saved as sequences of frame numbers, pages as their
+ * fields, and radix trees of files are rebuilt from their pages. The file is
+ * in the native byte order, for the same build of replacement, and the run
+ * must be resumed with the same trace and options, but for -s.
+ *
+ * The reader takes the state of the source when it reads the marked record,
+ * before it hands out the following access. Configurations save their state
+ * when this access is about to be simulated, into memory, as with -j they do
+ * it at different times. The file is written once they all did.
  */
 
-struct repalg algs[] = {
-	{
-		.r_name = "random",
-		.r_init = random_init,
-		.r_fini = generic_fini,
+enum {
+	CKPT_MAGIC   = 0x6b636572, /* "reck" */
+	CKPT_VERSION = 4
+};
 
-		.r_read  = generic_read,
-		.r_ra    = generic_read,
-		.r_write = generic_write,
-		.r_fault = generic_read,
-		.r_punch = generic_punch,
-		.r_alloc = random_alloc
-	},
-	{
-		.r_name = "lru",
-		.r_init = generic_init,
-		.r_fini = generic_fini,
+/*
+ * Checkpoint being saved or restored. Saving and restoring share the code
+ * that walks the state, see ckpt_io().
+ */
+struct ckpt {
+	FILE *ck_file;
+	/*
+	 * true when restoring.
+	 */
+	int   ck_load;
+	/*
+	 * first error. Once set, ckpt_io() does nothing.
+	 */
+	int   ck_result;
+};
 
-		.r_read  = generic_read,
-		.r_ra    = generic_read,
-		.r_write = generic_write,
-		.r_fault = generic_read,
-		.r_punch = generic_punch,
-		.r_alloc = lru_alloc
-	},
-	{
-		.r_name = "fifo",
-		.r_init = generic_init,
-		.r_fini = generic_fini,
+/*
+ * Saves or restores @size bytes at @buf.
+ */
+static void ckpt_io(struct ckpt *ck, void *buf, size_t size)
+{
+	size_t done;
 
-		.r_read  = generic_read,
-		.r_ra    = generic_read,
-		.r_write = generic_write,
-		.r_fault = generic_read,
-		.r_punch = generic_punch,
-		.r_alloc = fifo_alloc
-	},
-	{
-		.r_name = "fifo2",
-		.r_init = generic_init,
-		.r_fini = generic_fini,
+	if (ck->ck_result != 0 || size == 0)
+		return;
+	done = ck->ck_load ? fread(buf, size, 1, ck->ck_file) :
+		fwrite(buf, size, 1, ck->ck_file);
+	if (done != 1)
+		ck->ck_result = ferror(ck->ck_file) ? EIO : EINVAL;
+}
 
-		.r_read  = generic_read,
-		.r_ra    = generic_read,
-		.r_write = generic_write,
-		.r_fault = generic_read,
-		.r_punch = generic_punch,
-		.r_alloc = fifo2_alloc
-	},
-	{
-		.r_name = "sfifo",
-		.r_init = generic_init,
-		.r_fini = generic_fini,
+#define CKPT(ck, field) ckpt_io((ck), &(field), sizeof (field))
 
-		.r_read  = generic_read,
-		.r_ra    = generic_read,
-		.r_write = generic_write,
-		.r_fault = generic_read,
-		.r_punch = generic_punch,
-		.r_alloc = sfifo_alloc
-	},
-	{
-		.r_name = "2q",
-		.r_init = generic_init,
-		.r_fini = generic_fini,
+/*
+ * Saves or restores array *@area of @nr elements of @size bytes, allocated
+ * on restore. NULL arrays stay NULL.
+ */
+static void ckpt_array(struct ckpt *ck, void **area, u_int64_t nr, size_t size)
+{
+	u_int8_t present;
 
-		.r_read  = generic_read,
-		.r_ra    = generic_read,
-		.r_write = generic_write,
-		.r_fault = generic_read,
-		.r_punch = generic_punch,
-		.r_alloc = q2_alloc
-	},
-	{
-		.r_name = "car",
-		.r_init = car_init,
-		.r_fini = car_fini,
+	present = *area != NULL;
+	CKPT(ck, present);
+	if (ck->ck_result != 0 || !present)
+		return;
+	if (ck->ck_load) {
+		free(*area);
+		*area = malloc(nr * size);
+		if (*area == NULL) {
+			ck->ck_result = ENOMEM;
+			return;
+		}
+	}
+	ckpt_io(ck, *area, nr * size);
+}
 
-		.r_read  = generic_read,
-		.r_ra    = generic_read,
-		.r_write = generic_write,
-		.r_fault = generic_read,
-		.r_punch = car_punch,
-		.r_alloc = car_alloc
-	},
-	{
-		.r_name = "arc",
-		.r_init = car_init,
-		.r_fini = car_fini,
+static void ckpt_idmap(struct ckpt *ck, struct idmap *map)
+{
+	CKPT(ck, map->im_size);
+	CKPT(ck, map->im_nr);
+	ckpt_array(ck, (void **)&map->im_table, map->im_size,
+		   sizeof map->im_table[0]);
+}
 
-		.r_read  = generic_read,
-		.r_ra    = generic_read,
-		.r_write = generic_write,
-		.r_fault = generic_read,
-		.r_punch = car_punch,
-		.r_alloc = arc_alloc
-	},
-	{
-		.r_name = "linux",
-		.r_init = generic_init,
-		.r_fini = generic_fini,
+static void ckpt_source(struct ckpt *ck, struct source_mark *mark)
+{
+	CKPT(ck, mark->sm_recno);
+	CKPT(ck, mark->sm_time);
+	CKPT(ck, mark->sm_time_raw);
+	CKPT(ck, mark->sm_time_set);
+	CKPT(ck, mark->sm_nr_seen);
+	ckpt_idmap(ck, &mark->sm_pages);
+	ckpt_idmap(ck, &mark->sm_files);
+	ckpt_idmap(ck, &mark->sm_sampled);
+}
 
-		.r_read  = generic_read,
-		.r_ra    = generic_read,
-		.r_write = generic_write,
-		.r_fault = generic_read,
-		.r_punch = linux_punch,
-		.r_alloc = linux_alloc
-	},
-	{
-		.r_name = "worst",
-		.r_init = generic_init,
-		.r_fini = generic_fini,
+static void source_mark_fini(struct source_mark *mark)
+{
+	idmap_fini(&mark->sm_pages);
+	idmap_fini(&mark->sm_files);
+	idmap_fini(&mark->sm_sampled);
+}
 
-		.r_read  = generic_read,
-		.r_ra    = generic_read,
-		.r_write = generic_write,
-		.r_fault = generic_read,
-		.r_punch = generic_punch,
-		.r_alloc = worst_alloc
-	},
-	{
-		.r_name = "opt",
-		.r_init = opt_init,
-		.r_fini = opt_fini,
+/*
+ * Returns the number of accesses before the mark, or ~0ULL if it is not
+ * reached (yet).
+ */
+static u_int64_t source_mark_at(const struct source_mark *mark)
+{
+	return __atomic_load_n(&mark->sm_access, __ATOMIC_SEQ_CST);
+}
 
-		.r_read  = opt_read,
-		.r_ra    = opt_read,
-		.r_write = generic_write,
-		.r_fault = opt_read,
-		.r_punch = generic_punch,
-		.r_alloc = opt_alloc
-	},
-	{
-		.r_name = NULL
+/*
+ * Generator state points into ->m_rand_state, save the offsets.
+ */
+static void ckpt_rand(struct ckpt *ck, struct mm *mm)
+{
+	int32_t   *base = (int32_t *)mm->m_rand_state;
+	u_int64_t  front;
+	u_int64_t  rear;
+
+	front = mm->m_rand.fptr - base;
+	rear  = mm->m_rand.rptr - base;
+	ckpt_io(ck, mm->m_rand_state, sizeof mm->m_rand_state);
+	CKPT(ck, front);
+	CKPT(ck, rear);
+	if (ck->ck_load && ck->ck_result == 0) {
+		if (front * sizeof *base >= sizeof mm->m_rand_state ||
+		    rear * sizeof *base >= sizeof mm->m_rand_state)
+			ck->ck_result = EINVAL;
+		else {
+			mm->m_rand.fptr = base + front;
+			mm->m_rand.rptr = base + rear;
+		}
 	}
-};
+}
 
-static void mm_fini(struct mm *mm)
-{
-	frame_no_t fno;
-	vpage_no_t vno;
-	inode_no_t ino;
+/*
+ * Frame lists, saved by frame numbers.
+ */
+static const size_t mm_lists[] = {
+	offsetof(struct mm, m_freelist),
+	offsetof(struct mm, m_lru),
+	offsetof(struct mm, m_fifo),
+	offsetof(struct mm, m_fifo2),
+	offsetof(struct mm, m_q2.am),
+	offsetof(struct mm, m_q2.a1in),
+	offsetof(struct mm, m_linux.active),
+	offsetof(struct mm, m_linux.inactive)
+};
 
-	mm->m_alg->r_fini(mm);
+#define CKPT_END (~0ULL)
 
-	if (mm->m_objects != NULL) {
-		for (ino = 0; ino < mm->m_nr_objects; ++ino)
-			object_fini(mm, &mm->m_objects[ino]);
-		free(mm->m_objects);
-		mm->m_objects = NULL;
+static void ckpt_frames(struct ckpt *ck, struct mm *mm)
+{
+	struct frame     *frame;
+	struct list_head *head;
+	struct list_head *scan;
+	frame_no_t        fno;
+	u_int64_t         no;
+	u_int64_t         i;
+
+	for (fno = 0; fno < mm->m_nr_fresh && ck->ck_result == 0; ++fno) {
+		frame = &mm->m_frames[fno];
+		no = frame->f_page != NULL ? frame->f_page->v_no + 1 : 0;
+		CKPT(ck, frame->f_flags);
+		CKPT(ck, no);
+		if (ck->ck_load) {
+			if (no > mm->m_nr_vpages) {
+				ck->ck_result = EINVAL;
+				break;
+			}
+			frame->f_no   = fno;
+			frame->f_page = no != 0 ? vpage_at(mm, no - 1) : NULL;
+			INIT_LIST_HEAD(&frame->f_linkage);
+		}
 	}
-
-	if (mm->m_frames != NULL) {
-		for (fno = 0; fno < mm->m_nr_frames; ++fno)
-			frame_fini(mm, &mm->m_frames[fno]);
-		free(mm->m_frames);
-		mm->m_frames = NULL;
+	for (i = 0; i < sizeof_array(mm_lists); ++i) {
+		head = (struct list_head *)((char *)mm + mm_lists[i]);
+		if (!ck->ck_load) {
+			list_for_each(scan, head) {
+				no = frame_from_list(scan)->f_no;
+				CKPT(ck, no);
+			}
+			no = CKPT_END;
+			CKPT(ck, no);
+			continue;
+		}
+		while (ck->ck_result == 0) {
+			CKPT(ck, no);
+			if (no == CKPT_END)
+				break;
+			if (no >= mm->m_nr_fresh)
+				ck->ck_result = EINVAL;
+			else
+				list_add_tail(&mm->m_frames[no].f_linkage, head);
+		}
 	}
-	if (mm->m_vpages != NULL) {
-		for (vno = 0; vno < mm->m_nr_vpages; ++vno)
-			vpage_fini(mm, &mm->m_vpages[vno]);
-		free(mm->m_vpages);
-		mm->m_vpages = NULL;
+}
+
+/*
+ * Pages that were never seen are zeroed, only the others are saved.
+ */
+static void ckpt_pages(struct ckpt *ck, struct mm *mm)
+{
+	struct vpage *pg;
+	vpage_no_t    vno;
+	u_int64_t     no;
+	pgoff_t       index;
+
+	for (vno = 0; ck->ck_result == 0; ++vno) {
+		if (!ck->ck_load) {
+			while (vno < mm->m_nr_vpages &&
+			       !(vpage_at(mm, vno)->v_flags & VP_SEEN))
+				++vno;
+			if (vno == mm->m_nr_vpages)
+				vno = CKPT_END;
+		}
+		CKPT(ck, vno);
+		if (vno == CKPT_END)
+			break;
+		if (ck->ck_load && vno >= mm->m_nr_vpages) {
+			ck->ck_result = EINVAL;
+			break;
+		}
+		pg = vpage_at(mm, vno);
+		no = pg->v_frame != NULL ? pg->v_frame->f_no + 1 : 0;
+		index = vpage_cold(mm, pg)->vc_index;
+		CKPT(ck, pg->v_flags);
+		CKPT(ck, pg->v_next);
+		CKPT(ck, pg->v_prev);
+		CKPT(ck, pg->v_slot);
+		CKPT(ck, pg->v_object);
+		CKPT(ck, no);
+		CKPT(ck, index);
+		if (!ck->ck_load || ck->ck_result != 0)
+			continue;
+		if (no > mm->m_nr_fresh || pg->v_object >= mm->m_nr_objects) {
+			ck->ck_result = EINVAL;
+			break;
+		}
+		pg->v_no    = vno;
+		pg->v_frame = no != 0 ? &mm->m_frames[no - 1] : NULL;
+		vpage_cold(mm, pg)->vc_index = index;
+		object_at(mm, pg->v_object)->o_no = pg->v_object;
+		if (object_page_add(object_at(mm, pg->v_object), index, vno) != 0)
+			ck->ck_result = ENOMEM;
 	}
 }
 
-static int mm_init(struct mm *mm, struct repalg *alg)
+/*
+ * Saves @mm to, or restores it from @ck. A memory is restored right after
+ * mm_init(), with the same algorithm, parameters and size.
+ */
+static void ckpt_mm(struct ckpt *ck, struct mm *mm)
 {
-	int result;
+	u_int64_t nr_frames  = mm->m_nr_frames;
+	u_int64_t nr_vpages  = mm->m_nr_vpages;
+	u_int64_t nr_objects = mm->m_nr_objects;
+
+	CKPT(ck, nr_frames);
+	CKPT(ck, nr_vpages);
+	CKPT(ck, nr_objects);
+	if (ck->ck_load && ck->ck_result == 0) {
+		if (nr_frames != mm->m_nr_frames)
+			ck->ck_result = EINVAL;
+		else if (vpages_grow(mm, nr_vpages) != 0 ||
+			 objects_grow(mm, nr_objects) != 0)
+			ck->ck_result = ENOMEM;
+	}
+	CKPT(ck, mm->m_nr_free);
+	CKPT(ck, mm->m_nr_fresh);
+	if (mm->m_nr_fresh > mm->m_nr_frames && ck->ck_result == 0)
+		ck->ck_result = EINVAL;
+	CKPT(ck, mm->m_hits);
+	CKPT(ck, mm->m_misses);
+	CKPT(ck, mm->m_total);
+	CKPT(ck, mm->m_sfifo);
+	CKPT(ck, mm->m_q2.kin);
+	CKPT(ck, mm->m_q2.kout);
+	CKPT(ck, mm->m_q2.am_nr);
+	CKPT(ck, mm->m_q2.a1in_nr);
+	CKPT(ck, mm->m_q2.a1out_nr);
+	CKPT(ck, mm->m_q2.a1out);
+	CKPT(ck, mm->m_car);
+	CKPT(ck, mm->m_arc);
+	CKPT(ck, mm->m_linux.nr_active);
+	CKPT(ck, mm->m_linux.nr_inactive);
+	CKPT(ck, mm->m_linux.refill_counter);
+	CKPT(ck, mm->m_linux.pages_scanned);
+	CKPT(ck, mm->m_linux.nr_scan_active);
+	CKPT(ck, mm->m_linux.nr_scan_inactive);
+	CKPT(ck, mm->m_linux.temp_priority);
+	CKPT(ck, mm->m_linux.prev_priority);
+	ckpt_rand(ck, mm);
+	ckpt_frames(ck, mm);
+	ckpt_pages(ck, mm);
+	if (mm->m_opt.next != NULL)
+		ckpt_io(ck, mm->m_opt.next,
+			2 * mm->m_opt.size * sizeof mm->m_opt.next[0]);
+	CKPT(ck, mm->m_stack.nr);
+	CKPT(ck, mm->m_stack.size);
+	CKPT(ck, mm->m_stack.used);
+	CKPT(ck, mm->m_stack.ghost_nr);
+	CKPT(ck, mm->m_stack.ghost_size);
+	CKPT(ck, mm->m_stack.limit);
+	ckpt_array(ck, (void **)&mm->m_stack.tree, mm->m_stack.size,
+		   sizeof mm->m_stack.tree[0]);
+	ckpt_array(ck, (void **)&mm->m_stack.key, 2 * mm->m_stack.size,
+		   sizeof mm->m_stack.key[0]);
+	ckpt_array(ck, (void **)&mm->m_stack.owner, mm->m_stack.size,
+		   sizeof mm->m_stack.owner[0]);
+	ckpt_array(ck, (void **)&mm->m_stack.ghost, mm->m_stack.ghost_size,
+		   sizeof mm->m_stack.ghost[0]);
+}
 
-	mm->m_alg = alg;
-	mm->m_nr_free = mm->m_nr_frames;
-	INIT_LIST_HEAD(&mm->m_freelist);
-	INIT_LIST_HEAD(&mm->m_lru);
-	INIT_LIST_HEAD(&mm->m_fifo);
-	INIT_LIST_HEAD(&mm->m_fifo2);
+static void ckpt_config(struct ckpt *ck, struct config *cf)
+{
+	ckpt_mm(ck, &cf->cf_mm);
+	CKPT(ck, cf->cf_series);
+	CKPT(ck, cf->cf_curve.c_total);
+	CKPT(ck, cf->cf_curve.c_hist_nr);
+	ckpt_array(ck, (void **)&cf->cf_curve.c_hist, cf->cf_curve.c_hist_nr,
+		   sizeof cf->cf_curve.c_hist[0]);
+}
 
-	INIT_LIST_HEAD(&mm->m_future);
+/*
+ * Saves the state of @cf into memory, to be written by ckpt_write().
+ */
+static int config_save(struct config *cf)
+{
+	struct ckpt ck = {0,};
+
+	ck.ck_file = open_memstream(&cf->cf_ckpt, &cf->cf_ckpt_size);
+	if (ck.ck_file == NULL)
+		return errno;
+	ckpt_config(&ck, cf);
+	if (fclose(ck.ck_file) != 0 && ck.ck_result == 0)
+		ck.ck_result = errno;
+	return ck.ck_result;
+}
 
-	INIT_LIST_HEAD(&mm->m_q2.am);
-	INIT_LIST_HEAD(&mm->m_q2.a1in);
-	INIT_LIST_HEAD(&mm->m_q2.a1out);
+/*
+ * Restores the state of @cf, initialized by mm_init(), from checkpoint
+ * @path.
+ */
+static int config_restore(struct config *cf, const char *path)
+{
+	struct ckpt ck = { .ck_load = 1 };
+
+	ck.ck_file = fopen(path, "r");
+	if (ck.ck_file == NULL)
+		return errno;
+	if (fseeko(ck.ck_file, cf->cf_ckpt_off, SEEK_SET) != 0)
+		ck.ck_result = errno;
+	ckpt_config(&ck, cf);
+	fclose(ck.ck_file);
+	return ck.ck_result;
+}
 
-	INIT_LIST_HEAD(&mm->m_linux.active);
-	INIT_LIST_HEAD(&mm->m_linux.inactive);
+/*
+ * Header: source state at the mark, then configurations, each followed by the
+ * size of its state. States follow in the same order.
+ */
+static void ckpt_header(struct ckpt *ck, struct source_mark *mark,
+			u_int64_t *total, struct config *cf, u_int64_t nr_cf)
+{
+	u_int32_t magic   = CKPT_MAGIC;
+	u_int32_t version = CKPT_VERSION;
+	u_int64_t nr      = nr_cf;
+	u_int64_t frames;
+	u_int64_t size;
+	u_int64_t len;
+	u_int64_t i;
+	char      name[256];
+
+	CKPT(ck, magic);
+	CKPT(ck, version);
+	if (ck->ck_result == 0 &&
+	    (magic != CKPT_MAGIC || version != CKPT_VERSION))
+		ck->ck_result = EINVAL;
+	CKPT(ck, *total);
+	ckpt_source(ck, mark);
+	CKPT(ck, nr);
+	if (ck->ck_result == 0 && nr != nr_cf) {
+		fprintf(stderr, "Checkpoint has %llu configurations instead "
+			"of %llu\n", (unsigned long long)nr,
+			(unsigned long long)nr_cf);
+		ck->ck_result = EINVAL;
+	}
+	for (i = 0; i < nr_cf && ck->ck_result == 0; ++i) {
+		len    = strlen(cf[i].cf_name);
+		frames = cf[i].cf_frames;
+		size   = cf[i].cf_ckpt_size;
+		CKPT(ck, len);
+		if (ck->ck_load && len >= sizeof name)
+			ck->ck_result = EINVAL;
+		ckpt_io(ck, ck->ck_load ? name : (char *)cf[i].cf_name, len);
+		CKPT(ck, frames);
+		CKPT(ck, size);
+		if (ck->ck_load && ck->ck_result == 0) {
+			name[len] = 0;
+			if (strcmp(name, cf[i].cf_name) != 0 ||
+			    frames != cf[i].cf_frames) {
+				fprintf(stderr, "Checkpoint has `%s' in %llu "
+					"frames instead of `%s' in %llu\n",
+					name, (unsigned long long)frames,
+					cf[i].cf_name,
+					(unsigned long long)cf[i].cf_frames);
+				ck->ck_result = EINVAL;
+			}
+			cf[i].cf_ckpt_size = size;
+		}
+	}
+}
 
-	mm->m_frames = calloc(mm->m_nr_frames, sizeof(struct frame));
-	mm->m_vpages = calloc(mm->m_nr_vpages, sizeof(struct vpage));
-	mm->m_objects = calloc(mm->m_nr_objects, sizeof(struct object));
+/*
+ * Writes checkpoint @path, with states saved by config_save(). @total is the
+ * number of accesses simulated before the mark.
+ */
+static int ckpt_write(const char *path, struct source_mark *mark,
+		      u_int64_t total, struct config *cf, u_int64_t nr_cf)
+{
+	struct ckpt ck = {0,};
+	u_int64_t   i;
+
+	if (mark->sm_result != 0)
+		return mark->sm_result;
+	ck.ck_file = fopen(path, "w");
+	if (ck.ck_file == NULL)
+		return errno;
+	ckpt_header(&ck, mark, &total, cf, nr_cf);
+	for (i = 0; i < nr_cf; ++i) {
+		ckpt_io(&ck, cf[i].cf_ckpt, cf[i].cf_ckpt_size);
+		free(cf[i].cf_ckpt);
+		cf[i].cf_ckpt = NULL;
+	}
+	if (fclose(ck.ck_file) != 0 && ck.ck_result == 0)
+		ck.ck_result = errno;
+	return ck.ck_result;
+}
 
-	if (mm->m_frames != NULL &&
-	    mm->m_vpages != NULL && mm->m_objects != NULL) {
-		frame_no_t fno;
-		vpage_no_t vno;
-		inode_no_t ino;
+/*
+ * Reads the header of checkpoint @path into @mark and @total, and finds the
+ * states of configurations, which must be the ones in the checkpoint, in the
+ * same order.
+ */
+static int ckpt_read(const char *path, struct source_mark *mark,
+		     u_int64_t *total, struct config *cf, u_int64_t nr_cf)
+{
+	struct ckpt ck = { .ck_load = 1 };
+	off_t       off;
+	u_int64_t   i;
+
+	ck.ck_file = fopen(path, "r");
+	if (ck.ck_file == NULL)
+		return errno;
+	ckpt_header(&ck, mark, total, cf, nr_cf);
+	off = ftello(ck.ck_file);
+	for (i = 0; i < nr_cf; ++i) {
+		cf[i].cf_ckpt_off = off;
+		off += cf[i].cf_ckpt_size;
+	}
+	fclose(ck.ck_file);
+	return ck.ck_result;
+}
 
-		for (fno = 0; fno < mm->m_nr_frames; ++fno) {
-			mm->m_frames[fno].f_no = fno;
-			frame_init(mm, &mm->m_frames[fno]);
-		}
-		for (vno = 0; vno < mm->m_nr_vpages; ++vno) {
-			mm->m_vpages[vno].v_no = vno;
-			vpage_init(mm, &mm->m_vpages[vno]);
-		}
-		for (ino = 0; ino < mm->m_nr_objects; ++ino) {
-			mm->m_objects[ino].o_no = ino;
-			object_init(mm, &mm->m_objects[ino]);
-		}
-		result = alg->r_init(mm);
-	} else
-		result = ENOMEM;
+/*
+ * Saves all configurations, simulated in lockstep, and writes checkpoint
+ * @path. @base accesses were simulated before the run started.
+ */
+static int ckpt_take(const char *path, struct source_mark *mark,
+		     u_int64_t base, struct config *cf, u_int64_t nr_cf)
+{
+	u_int64_t i;
+	int       result;
+
+	for (i = 0, result = 0; i < nr_cf && result == 0; ++i)
+		result = config_save(&cf[i]);
+	if (result == 0)
+		result = ckpt_write(path, mark, base + source_mark_at(mark),
+				    cf, nr_cf);
 	if (result != 0)
-		mm_fini(mm);
+		fprintf(stderr, "Cannot write checkpoint: %d\n", result);
 	return result;
 }
 
-static void vpage_print(const char *prefix, const struct vpage *pg)
+/*
+ * Parallel sweep (-j).
+ *
+ * The trace is decoded into memory first, then configurations are simulated
+ * independently by a pool of threads. Each thread takes the next configuration
+ * nobody has taken yet, so threads finishing early pick up the remaining ones.
+ */
+struct sweep {
+	struct config       *sw_cf;
+	u_int64_t            sw_nr;
+	/*
+	 * next configuration to simulate.
+	 */
+	u_int64_t            sw_next;
+	const struct replay *sw_replay;
+	int                  sw_mrc;
+	/*
+	 * checkpoint to save states for, and checkpoint to resume from, or
+	 * NULL.
+	 */
+	const struct source_mark *sw_mark;
+	const char          *sw_resume;
+	/*
+	 * warm-up and windows, or NULL.
+	 */
+	const struct series_param *sw_series;
+	/*
+	 * first error.
+	 */
+	int                  sw_result;
+};
+
+static void *sweep_worker(void *arg)
 {
-	struct frame *frame;
+	struct sweep *sw = arg;
+	u_int64_t     i;
+	u_int64_t     at;
+	int           result;
+
+	at = source_mark_at(sw->sw_mark);
+	while ((i = __atomic_fetch_add(&sw->sw_next, 1, __ATOMIC_SEQ_CST)) <
+	       sw->sw_nr) {
+		struct config *cf = &sw->sw_cf[i];
+		struct window  w;
+		struct access  access;
+
+		window_init(&w, NULL, sw->sw_replay);
+		cf->cf_mm.m_window = &w;
+		result = mm_init(&cf->cf_mm, cf->cf_mm.m_alg);
+		if (result == 0) {
+			if (sw->sw_resume != NULL)
+				result = config_restore(cf, sw->sw_resume);
+			while (result == 0 && access_get(&w, &access) == 0) {
+				if (access.a_no == at)
+					result = config_save(cf);
+				if (sw->sw_series != NULL)
+					series_step(sw->sw_series, cf, &access);
+				if (result == 0)
+					result = mm_access(&cf->cf_mm, &access,
+							   sw->sw_mrc ?
+							   &cf->cf_curve :
+							   NULL);
+			}
+			if (result == 0 && w.w_next == at)
+				result = config_save(cf);
+			if (result == 0 && sw->sw_series != NULL)
+				series_fini(sw->sw_series, cf);
+			mm_fini(&cf->cf_mm);
+		}
+		if (result != 0) {
+			int none = 0;
 
-	frame = pg->v_frame;
-	printf("%s%8.8llx %8.8x ", prefix, pg->v_no, pg->v_flags);
-	if (frame != NULL)
-		printf("[%16.16llx %8.8x]\n", frame->f_no, frame->f_flags);
-	else
-		printf("NR\n");
+			__atomic_compare_exchange_n(&sw->sw_result, &none,
+						    result, 0, __ATOMIC_SEQ_CST,
+						    __ATOMIC_SEQ_CST);
+			break;
+		}
+	}
+	return NULL;
+}
+
+static int sweep(struct config *cf, u_int64_t nr, const struct replay *rp,
+		 int jobs, int mrc, const struct source_mark *mark,
+		 const char *resume, const struct series_param *series)
+{
+	struct sweep sw = {
+		.sw_cf     = cf,
+		.sw_nr     = nr,
+		.sw_replay = rp,
+		.sw_mrc    = mrc,
+		.sw_mark   = mark,
+		.sw_resume = resume,
+		.sw_series = series
+	};
+	pthread_t   *thread;
+	int          i;
+
+	jobs = min_t(u_int64_t, jobs, nr);
+	thread = calloc(jobs, sizeof thread[0]);
+	if (thread == NULL)
+		return ENOMEM;
+	for (i = 0; i < jobs; ++i) {
+		if (pthread_create(&thread[i], NULL, sweep_worker, &sw) != 0)
+			break;
+	}
+	if (i == 0)
+		sw.sw_result = EAGAIN;
+	while (--i >= 0)
+		pthread_join(thread[i], NULL);
+	free(thread);
+	return sw.sw_result;
 }
 
 static void usage(void)
 {
-	struct repalg *alg;
+	const struct repalg *alg;
+	struct srcfmt *fmt;
 
 	printf("replacement [ -v <logging flags> | -h | -V <virtual pages> | "
-	       "-M <frames> | -f <files> | -r <radix> | -a <algorithm> ]\n\n"
+	       "-M <frames>,... | -f <files> | -r <radix> | "
+	       "-a <algorithm>[:<param>...] | -i <format> | "
+	       "-s <first record> | -F <field>=<values> | -S <rate> | "
+	       "-C <frames>,...|all | -j <threads> | "
+	       "-c <record>:<checkpoint> | -R <checkpoint> | "
+	       "-w <warm-up> | -W <window>:<file> | -H <file> ]\n\n"
+	       "-a and -M can be repeated: every algorithm is simulated with "
+	       "every memory size,\nover a single pass through the trace, or "
+	       "in parallel with -j.\n\n"
 	       "Available algorithms:\n\n");
 	for (alg = &algs[0]; alg->r_name != NULL; alg++)
 		printf("\t%s\n", alg->r_name);
+	printf("\nParameters: sfifo:<tail %%>, 2q:<kin %%>[:<kout %%>], "
+	       "same as -t, -k and -K.\n");
+	printf("\n-c saves the state of the simulation after the first "
+	       "<record> records of the\ntrace, -R resumes from it, with the "
+	       "same trace and options.\n");
+	printf("\n-w excludes the first <warm-up> records, or <seconds>s with "
+	       "raw input, from\nresults. -W writes hits, misses and hit ratio "
+	       "of every configuration over\nconsecutive windows of <window> "
+	       "records or <seconds>s to <file> (- for stdout):\n\n"
+	       "\t<algorithm> <frames> <start> <hits> <misses> <ratio>\n\n"
+	       "No window is written during the warm-up. The window where it "
+	       "ends restarts at\nthe first access past it, given as <start>.\n");
+	printf("\n-H writes log-binned histograms of stack distance and of "
+	       "gaps between\nreferences to a page, in records and microseconds, "
+	       "by access type, to <file>:\n\n"
+	       "\t<algorithm> distance|records|time <type> <low> <high> "
+	       "<count>\n");
+	printf("\nAvailable input formats:\n\n");
+	for (fmt = &fmts[0]; fmt->sf_name != NULL; fmt++)
+		printf("\t%s\n", fmt->sf_name);
+	printf("\nFilters (-F, can be repeated):\n\n"
+	       "\tpid=<pid>,...\n"
+	       "\tcomm=<command>,...\n"
+	       "\tdev=<device>,...\t\thex, as printed by fslog\n"
+	       "\tino=<inode>,...\t\t\thex, as printed by fslog\n"
+	       "\ttime=[<start>]-[<end>],...\tseconds since the start of the "
+	       "trace\n"
+	       "\ttype=<types>\t\t\tof R, r, W, P, T\n\n"
+	       "All filters but type need raw input.\n\n"
+	       "-C prints hits and misses for every listed memory size, or "
+	       "for every size\nwhere they change, in one pass. -C and -H "
+	       "take no -M, and need stack\nalgorithms, lru by default:\n\n");
+	for (alg = &algs[0]; alg->r_name != NULL; alg++) {
+		if (alg->r_depth != NULL)
+			printf("\t%s\n", alg->r_name);
+	}
+}
+
+/*
+ * Opens @path for output, "-" being stdout.
+ */
+static FILE *stream_open(const char *path)
+{
+	FILE *out;
+
+	if (strcmp(path, "-") != 0) {
+		out = fopen(path, "w");
+		if (out == NULL)
+			fprintf(stderr, "Cannot open `%s': %d\n", path, errno);
+		return out;
+	}
+	/*
+	 * stdout is unbuffered for results, streams are not.
+	 */
+	setvbuf(stdout, NULL, _IOFBF, BUFSIZ);
+	return stdout;
+}
+
+/*
+ * Reports peak resident set size on stderr, away from the results.
+ */
+static void rss_print(void)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		fprintf(stderr, "peak rss: %ld KB\n", usage.ru_maxrss);
 }
 
 int main(int argc, char **argv)
@@ -2051,18 +6524,58 @@ int main(int argc, char **argv)
 	int result;
 	int radix;
 	int opt;
-	struct repalg *alg;
+	struct srcfmt *fmt;
 	struct mm      mm = {0,};
+	struct source  src = {0,};
+	struct ring    ring;
+	struct window  window;
+	struct filter  filter = {0,};
+	struct sizes   frames = {0,};
+	struct sizes   curve = {0,};
+	struct config *cf;
+	int            jobs;
+	u_int64_t      nr_cf;
+	u_int64_t      i;
+	const char   **name;
+	int            nr_name;
+	int            mrc;
+	double         rate;
 	struct access  access;
+	struct future  future;
+	int            clairvoyant;
+	u_int64_t      start;
 	char          *eoc;
+	const char    *ckpt;
+	const char    *resume;
+	struct source_mark mark = { .sm_access = ~0ULL };
+	struct source_mark resumed = {0,};
+	u_int64_t      base;
+	struct series_param series = {0,};
+	const char    *out;
+	const struct series_param *sp;
+	int            stack;
+	const char    *hist;
+	FILE          *hout;
 
 	setbuf(stdout, NULL);
 
 	verbose = 0;
 	radix   = 0;
-	alg     = &algs[0];
+	fmt     = &fmts[0];
+	start   = 0;
+	rate    = 1.0;
+	mrc     = 0;
+	jobs    = 1;
+	name    = NULL;
+	nr_name = 0;
+	ckpt    = NULL;
+	resume  = NULL;
+	base    = 0;
+	out     = NULL;
+	hist    = NULL;
+	hout    = NULL;
 	do {
-		opt = getopt(argc, argv, "V:v:a:r:M:hf:t:k:K:");
+		opt = getopt(argc, argv, "V:v:a:r:M:hf:t:k:K:i:s:F:S:C:j:c:R:w:W:H:");
 		switch (opt) {
 		case -1:
 			break;
@@ -2076,8 +6589,7 @@ int main(int argc, char **argv)
 			verbose = atoi(optarg);
 			break;
 		case 'M':
-			mm.m_nr_frames = strtoull(optarg, &eoc, radix);
-			if (*eoc != 0) {
+			if (sizes_parse(&frames, optarg, radix) != 0) {
 				fprintf(stderr,
 					"Malformed nr_frames: `%s'\n", optarg);
 				return 1;
@@ -2127,118 +6639,381 @@ int main(int argc, char **argv)
 			}
 			break;
 		case 'a':
-			for (alg = &algs[0]; alg->r_name != NULL; alg++) {
-				if (!strcmp(alg->r_name, optarg))
+			name = realloc(name, (nr_name + 1) * sizeof name[0]);
+			if (name == NULL)
+				return ENOMEM;
+			name[nr_name++] = optarg;
+			break;
+		case 'i':
+			for (fmt = &fmts[0]; fmt->sf_name != NULL; fmt++) {
+				if (!strcmp(fmt->sf_name, optarg))
 					break;
 			}
-			if (alg->r_name == NULL) {
+			if (fmt->sf_name == NULL) {
+				fprintf(stderr,
+					"Unknown input format `%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'F':
+			if (filter_parse(&filter, optarg) != 0) {
+				fprintf(stderr,
+					"Malformed filter: `%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'S':
+			rate = strtod(optarg, &eoc);
+			if (*eoc != 0 || !(rate > 0.0 && rate <= 1.0)) {
+				fprintf(stderr,
+					"Malformed sampling rate: `%s'\n",
+					optarg);
+				return 1;
+			}
+			break;
+		case 'C':
+			if (strcmp(optarg, "all") != 0 &&
+			    sizes_parse(&curve, optarg, radix) != 0) {
+				fprintf(stderr,
+					"Malformed memory sizes: `%s'\n",
+					optarg);
+				return 1;
+			}
+			mrc = 1;
+			break;
+		case 'j':
+			jobs = strtol(optarg, &eoc, radix);
+			if (*eoc != 0 || jobs < 1) {
+				fprintf(stderr,
+					"Malformed number of threads: `%s'\n",
+					optarg);
+				return 1;
+			}
+			break;
+		case 's':
+			start = strtoull(optarg, &eoc, radix);
+			if (*eoc != 0) {
+				fprintf(stderr,
+					"Malformed first record: `%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'c':
+			mark.sm_recno = strtoull(optarg, &eoc, radix);
+			if (*eoc != ':' || eoc[1] == 0) {
+				fprintf(stderr,
+					"Malformed checkpoint: `%s'\n", optarg);
+				return 1;
+			}
+			ckpt = eoc + 1;
+			break;
+		case 'R':
+			resume = optarg;
+			break;
+		case 'w':
+			if (span_parse(&series.sp_warm, optarg, radix) != 0) {
+				fprintf(stderr,
+					"Malformed warm-up: `%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'W':
+			eoc = strrchr(optarg, ':');
+			if (eoc == NULL || eoc[1] == 0) {
+				fprintf(stderr,
+					"Malformed window: `%s'\n", optarg);
+				return 1;
+			}
+			*eoc = 0;
+			if (span_parse(&series.sp_window, optarg, radix) != 0) {
 				fprintf(stderr,
-					"Unknown algorithm `%s'\n", optarg);
+					"Malformed window: `%s'\n", optarg);
 				return 1;
 			}
+			out = eoc + 1;
+			break;
+		case 'H':
+			hist = optarg;
 			break;
 		}
 	} while (opt != -1);
 
-	result = mm_init(&mm, alg);
-	if (result != 0)
-		return result;
-
-	while (access_get(&mm, &access) == 0) {
-		vpage_no_t     vpage;
-		inode_no_t     ino;
-		pgoff_t        index;
-		struct vpage  *pg;
-		struct object *object;
-		char           type;
-		char           prefix[] = "? ";
-
-		vpage = access.a_page;
-		ino   = access.a_object;
-		index = access.a_index;
-		type  = access.a_type;
-
-		if (vpage >= mm.m_nr_vpages) {
-			fprintf(stderr, "Invalid page nr.: %llu >= %llu\n",
-				vpage, mm.m_nr_vpages);
+	/*
+	 * -H takes distances from the pass of -C. With either, memory sizes
+	 * are enumerated by the curve, and the default algorithm is lru, the
+	 * first stack one.
+	 */
+	stack = mrc || hist != NULL;
+	if (stack && frames.sz_nr > 0) {
+		fprintf(stderr, "-M cannot be used with -C or -H\n");
+		return 1;
+	}
+	if (nr_name == 0) {
+		name = malloc(sizeof name[0]);
+		if (name == NULL)
+			return ENOMEM;
+		name[nr_name++] = stack ? "lru" : algs[0].r_name;
+	}
+	if (frames.sz_nr == 0 && sizes_add(&frames, 0) != 0)
+		return ENOMEM;
+	nr_cf = nr_name * frames.sz_nr;
+	cf = calloc(nr_cf, sizeof cf[0]);
+	if (cf == NULL)
+		return ENOMEM;
+	for (i = 0; i < nr_cf; ++i) {
+		if (config_init(&cf[i], name[i / frames.sz_nr],
+				frames.sz_size[i % frames.sz_nr], &mm,
+				radix) != 0)
 			return 1;
-		}
-		if (ino >= mm.m_nr_objects) {
-			fprintf(stderr, "Invalid ino: %llu >= %llu\n",
-				ino, mm.m_nr_objects);
+		if (stack && cf[i].cf_mm.m_alg->r_depth == NULL) {
+			fprintf(stderr, "`%s' is not a stack algorithm\n",
+				cf[i].cf_name);
 			return 1;
 		}
-		pg = &mm.m_vpages[vpage];
-		object = &mm.m_objects[ino];
-		if (!(pg->v_flags & VP_SEEN)) {
-			/*
-			 * First time this page is seen.
-			 */
-			assert(pg->v_object == NULL);
-			pg->v_object = object;
-			list_add(&pg->v_pages, &object->o_pages);
-			pg->v_index = index;
-		}
-		pg->v_flags |= VP_SEEN;
-		if (pg->v_object->o_no != ino) {
-			fprintf(stderr, "Invalid ino: %llx != %llx\n",
-				pg->v_object->o_no, ino);
+	}
+
+	/*
+	 * A resumed run starts at the record of the checkpoint.
+	 */
+	if (resume != NULL) {
+		if (start > 0) {
+			fprintf(stderr, "-s cannot be used with -R\n");
 			return 1;
 		}
-		if (pg->v_index != index) {
-			fprintf(stderr, "Invalid index: %llx != %llx\n",
-				pg->v_index, index);
+		result = ckpt_read(resume, &resumed, &base, cf, nr_cf);
+		if (result != 0) {
+			fprintf(stderr, "Cannot read checkpoint `%s': %d\n",
+				resume, result);
 			return 1;
 		}
+		start = resumed.sm_recno;
+	}
+	if (ckpt != NULL && mark.sm_recno <= start) {
+		fprintf(stderr, "Checkpoint record %llu is not past the first "
+			"record %llu\n", (unsigned long long)mark.sm_recno,
+			(unsigned long long)start);
+		return 1;
+	}
+	if (!fmt->sf_meta && (filter.fl_fields & ~(1 << FF_TYPE))) {
+		fprintf(stderr, "Format `%s' supports only type filter\n",
+			fmt->sf_name);
+		return 1;
+	}
+	if (!fmt->sf_meta &&
+	    (series.sp_warm.sp_time || series.sp_window.sp_time)) {
+		fprintf(stderr, "Format `%s' has no time-stamps\n",
+			fmt->sf_name);
+		return 1;
+	}
+	if (stack && out != NULL) {
+		fprintf(stderr, "-W cannot be used with -C or -H\n");
+		return 1;
+	}
+	if (hist != NULL && (ckpt != NULL || resume != NULL)) {
+		fprintf(stderr, "-H cannot be used with -c or -R\n");
+		return 1;
+	}
+	if (out != NULL && (series.sp_out = stream_open(out)) == NULL)
+		return 1;
+	if (hist != NULL && (hout = stream_open(hist)) == NULL)
+		return 1;
+	series.sp_rate = rate;
+	for (i = 0; i < nr_cf; ++i) {
+		series_init(&cf[i].cf_series, &series, start);
+		if (hist != NULL) {
+			reuse_init(&cf[i].cf_reuse, start, rate, fmt->sf_meta);
+			cf[i].cf_curve.c_reuse = &cf[i].cf_reuse;
+		}
+	}
+	sp = series.sp_warm.sp_len > 0 || out != NULL ? &series : NULL;
+	result = source_init(&src, fmt, stdin);
+	if (result == 0 && start > 0)
+		result = source_seek(&src, start);
+	if (result != 0)
+		return result;
+	/*
+	 * Filter is installed after seeking: -s counts all records.
+	 */
+	if (filter.fl_fields != 0)
+		src.s_filter = &filter;
+	if (rate < 1.0) {
+		result = sample_init(&src, rate);
+		if (result != 0)
+			return result;
+		/*
+		 * Simulate proportionally smaller memory.
+		 */
+		for (i = 0; i < nr_cf; ++i)
+			cf[i].cf_mm.m_nr_frames =
+				max_t(u_int64_t,
+				      cf[i].cf_frames * rate + 0.5, 1);
+	}
+	if (resume != NULL) {
+		result = source_restore(&src, &resumed);
+		if (result != 0)
+			return result;
+	}
+	for (i = 0; i < nr_cf; ++i) {
+		struct mm *m = &cf[i].cf_mm;
 
-		prefix[0] = type;
-		if (verbose & VERBOSE_LOG)
-			vpage_print(prefix, pg);
-		if (type != FSLOG_WRITE && type != FSLOG_PUNCH) {
-			if (pg->v_frame != NULL)
-				mm.m_hits++;
-			else
-				mm.m_misses++;
+		/*
+		 * Pages and files are allocated as the trace references
+		 * them, but it is cheaper to allocate them upfront if the
+		 * binary trace header tells how many there are.
+		 */
+		if (m->m_nr_vpages == 0)
+			m->m_nr_vpages = src.s_hdr.th_nr_vpages * rate;
+		if (m->m_nr_objects == 0)
+			m->m_nr_objects = src.s_hdr.th_nr_objects;
+		/*
+		 * Histograms need every distance.
+		 */
+		if (stack)
+			m->m_stack.limit = hist != NULL ? ~0ULL :
+				curve_limit(&curve, rate);
+	}
+	/*
+	 * Clairvoyant algorithms need next reads before the simulation starts.
+	 * A seekable trace is scanned for them in a separate pass, otherwise
+	 * the whole trace is read ahead into the window below.
+	 */
+	future_init(&future);
+	future.fu_base = base;
+	for (i = 0, clairvoyant = 0; i < nr_cf; ++i) {
+		if (cf[i].cf_mm.m_alg->r_future) {
+			cf[i].cf_mm.m_future = &future;
+			clairvoyant = 1;
 		}
-		mm.m_total++;
-		switch (type) {
-		case FSLOG_READ:
-			mm.m_alg->r_read(&mm, pg);
-			break;
-		case FSLOG_RA:
-			mm.m_alg->r_ra(&mm, pg);
-			break;
-		case FSLOG_WRITE:
-			mm.m_alg->r_write(&mm, pg);
-			pg->v_frame->f_flags |= FR_DIRTY;
-			break;
-		case FSLOG_PFAULT:
-			mm.m_alg->r_fault(&mm, pg);
-			break;
-		case FSLOG_PUNCH: {
-			struct vpage *scan;
+	}
+	if (clairvoyant && src.s_start >= 0) {
+		result = future_scan(&future, &src, start);
+		/*
+		 * Rewinding lost the restored state.
+		 */
+		if (result == 0 && resume != NULL)
+			result = source_restore(&src, &resumed);
+		if (result != 0) {
+			fprintf(stderr, "Cannot scan next reads: %d\n", result);
+			return 1;
+		}
+		clairvoyant = 0;
+	}
+	if (ckpt != NULL)
+		src.s_mark = &mark;
+	/*
+	 * Decode the trace in a separate thread, overlapping with simulation.
+	 */
+	result = ring_init(&ring, &src);
+	if (result != 0)
+		return result;
 
-			list_for_each_entry(scan, &object->o_pages, v_pages) {
-				if (scan->v_index >= index)
-					mm.m_alg->r_punch(&mm, pg);
+	if (jobs > 1) {
+		struct replay rp;
+
+		result = replay_init(&rp, &ring);
+		if (result == 0 && clairvoyant) {
+			window_init(&window, NULL, &rp);
+			result = future_window(&future, &window);
+		}
+		if (result == 0)
+			result = sweep(cf, nr_cf, &rp, jobs, stack, &mark,
+				       resume, sp);
+		replay_fini(&rp);
+		if (result != 0)
+			return 1;
+		if (ckpt != NULL && source_mark_at(&mark) != ~0ULL) {
+			result = ckpt_write(ckpt, &mark,
+					    base + source_mark_at(&mark),
+					    cf, nr_cf);
+			if (result != 0) {
+				fprintf(stderr, "Cannot write checkpoint: "
+					"%d\n", result);
+				return 1;
 			}
-			continue;
 		}
-		default:
-			fprintf(stderr, "Invalid access type `%c'", type);
+	} else {
+		window_init(&window, &ring, NULL);
+		if (clairvoyant && future_window(&future, &window) != 0) {
+			fprintf(stderr, "Cannot find next reads\n");
 			return 1;
 		}
-		if (pg->v_frame == NULL) {
-			fprintf(stderr, "Frame wasn't installed\n");
+		for (i = 0; i < nr_cf; ++i) {
+			cf[i].cf_mm.m_window = &window;
+			result = mm_init(&cf[i].cf_mm, cf[i].cf_mm.m_alg);
+			if (result == 0 && resume != NULL)
+				result = config_restore(&cf[i], resume);
+			if (result != 0)
+				return result;
+		}
+		while (access_get(&window, &access) == 0) {
+			if (access.a_no == source_mark_at(&mark) &&
+			    ckpt_take(ckpt, &mark, base, cf, nr_cf) != 0)
+				return 1;
+			for (i = 0; i < nr_cf; ++i) {
+				if (sp != NULL)
+					series_step(sp, &cf[i], &access);
+				result = mm_access(&cf[i].cf_mm, &access,
+						   stack ?
+						   &cf[i].cf_curve : NULL);
+				if (result != 0)
+					return 1;
+			}
+		}
+		if (window.w_next == source_mark_at(&mark) &&
+		    ckpt_take(ckpt, &mark, base, cf, nr_cf) != 0)
 			return 1;
+		for (i = 0; i < nr_cf; ++i) {
+			if (sp != NULL)
+				series_fini(sp, &cf[i]);
+			mm_fini(&cf[i].cf_mm);
 		}
-		pg->v_frame->f_flags |= FR_REF;
-		if ((verbose & VERBOSE_PROGRESS) && mm.m_total % 1000 == 0)
-			printf(".");
+		window_fini(&window);
+	}
+	ring_fini(&ring);
+	future_fini(&future);
+	if (ckpt != NULL && source_mark_at(&mark) == ~0ULL) {
+		fprintf(stderr, "Trace ends before checkpoint record %llu\n",
+			(unsigned long long)mark.sm_recno);
+		return 1;
+	}
+	if (series.sp_out != NULL && fclose(series.sp_out) != 0) {
+		fprintf(stderr, "Cannot write windows: %d\n", errno);
+		return 1;
+	}
+	for (i = 0; i < nr_cf; ++i) {
+		struct mm  *m = &cf[i].cf_mm;
+		const char *label;
+		u_int64_t   seen;
+
+		/*
+		 * A single configuration prints just the numbers, as always.
+		 */
+		label = nr_cf > 1 ? cf[i].cf_name : NULL;
+		seen  = src.s_nr_seen - cf[i].cf_series.se_warm_seen;
+		if (mrc)
+			curve_print(&cf[i].cf_curve, label, &curve, rate, seen);
+		else if (!stack)
+			result_print(label, nr_cf > 1 ? cf[i].cf_frames : 0,
+				     m->m_hits, m->m_misses, rate, seen);
+		if (hist != NULL) {
+			reuse_print(&cf[i].cf_reuse, cf[i].cf_name, hout);
+			reuse_fini(&cf[i].cf_reuse);
+		}
+		curve_fini(&cf[i].cf_curve);
+	}
+	if (hout != NULL && fclose(hout) != 0) {
+		fprintf(stderr, "Cannot write histograms: %d\n", errno);
+		return 1;
 	}
-	printf("%12llu %12llu %f\n", mm.m_hits, mm.m_misses,
-	       mm.m_hits*100.0/(mm.m_hits + mm.m_misses));
-	mm_fini(&mm);
+	free(cf);
+	free(name);
+	sizes_fini(&frames);
+	sizes_fini(&curve);
+	source_fini(&src);
+	source_mark_fini(&mark);
+	source_mark_fini(&resumed);
+	filter_fini(&filter);
+	rss_print();
 	return result;
 }
 
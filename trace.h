@@ -0,0 +1,254 @@
+/* -*- C -*- */
+
+/* trace.h */
+
+/*
+ * Prominent copyright and license message is at the end of this file, please
+ * read it.
+ */
+
+/*
+ * On-disk formats of file system access traces, shared by "replacement" and
+ * trace conversion tools.
+ *
+ * All multi-byte fields are in host byte order: traces are produced and
+ * consumed on the same machine.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <sys/types.h>
+#include <string.h>
+
+/*
+ * Binary trace.
+ *
+ * struct trace_header followed by a sequence of fixed-width struct
+ * trace_record-s, one per access. Each record carries the same information
+ * as a line of fslog.trace produced by fslog.awk.
+ */
+
+enum {
+	/*
+	 * "FSTB" when read as a little-endian 32 bit word.
+	 */
+	TRACE_MAGIC   = 0x42545346,
+	TRACE_VERSION = 1,
+	/*
+	 * "FSTZ", compressed binary trace.
+	 */
+	TRACE_ZMAGIC  = 0x5a545346
+};
+
+struct trace_header {
+	/*
+	 * TRACE_MAGIC.
+	 */
+	u_int32_t th_magic;
+	/*
+	 * TRACE_VERSION.
+	 */
+	u_int32_t th_version;
+	/*
+	 * sizeof(struct trace_record), to catch mismatched readers.
+	 */
+	u_int32_t th_recsize;
+	u_int32_t th_pad;
+	/*
+	 * number of records in the trace, or 0 if unknown (e.g., the trace was
+	 * written to a pipe).
+	 */
+	u_int64_t th_nr_records;
+	/*
+	 * largest virtual page number in the trace plus one, or 0 if unknown.
+	 */
+	u_int64_t th_nr_vpages;
+	/*
+	 * largest file object number in the trace plus one, or 0 if unknown.
+	 */
+	u_int64_t th_nr_objects;
+};
+
+struct trace_record {
+	/*
+	 * number of accessed virtual page.
+	 */
+	u_int32_t tr_page;
+	/*
+	 * number of accessed file object.
+	 */
+	u_int32_t tr_object;
+	/*
+	 * offset of accessed page in the object.
+	 */
+	u_int32_t tr_index;
+	/*
+	 * access type, from enum fslog_rec_type.
+	 */
+	u_int8_t  tr_type;
+	u_int8_t  tr_pad[3];
+};
+
+/*
+ * Compressed binary trace.
+ *
+ * struct trace_zheader, followed by blocks of at most ->tz_block records. All
+ * blocks but the last one are full. Each block is struct trace_zblock followed
+ * by ->tb_size bytes of zlib-compressed data: records of the block stored
+ * column-wise (see trace_zpack()), which compresses much better than rows.
+ *
+ * The last block is followed by a trace_zblock with zero ->tb_nr, and by the
+ * block index: the offset of every block from the start of the trace, as a
+ * 64 bit word, and struct trace_ztrailer. The index allows jumping to the
+ * block containing any given record without decompressing the blocks before
+ * it.
+ */
+
+struct trace_zheader {
+	/*
+	 * ->th_magic is TRACE_ZMAGIC.
+	 */
+	struct trace_header tz_hdr;
+	/*
+	 * number of records in a full block.
+	 */
+	u_int32_t           tz_block;
+	u_int32_t           tz_pad;
+};
+
+struct trace_zblock {
+	/*
+	 * size of compressed data.
+	 */
+	u_int32_t tb_size;
+	/*
+	 * number of records in the block.
+	 */
+	u_int32_t tb_nr;
+};
+
+struct trace_ztrailer {
+	/*
+	 * offset of the block index from the start of the trace.
+	 */
+	u_int64_t tt_index;
+	u_int64_t tt_nr_blocks;
+	/*
+	 * TRACE_ZMAGIC.
+	 */
+	u_int32_t tt_magic;
+	u_int32_t tt_pad;
+};
+
+enum {
+	/*
+	 * default number of records in a block: 1MB before compression.
+	 */
+	TRACE_ZBLOCK = 1 << 16,
+	/*
+	 * bytes per record in a column-wise block.
+	 */
+	TRACE_ZRECSIZE = 13
+};
+
+/*
+ * Stores @nr records column-wise in @col, which must have room for
+ * @nr * TRACE_ZRECSIZE bytes.
+ */
+static inline void trace_zpack(const struct trace_record *rec, u_int32_t nr,
+			       unsigned char *col)
+{
+	u_int32_t i;
+
+	for (i = 0; i < nr; ++i) {
+		memcpy(col + 4 * i,            &rec[i].tr_page,   4);
+		memcpy(col + 4 * (nr + i),     &rec[i].tr_object, 4);
+		memcpy(col + 4 * (2 * nr + i), &rec[i].tr_index,  4);
+		col[12 * nr + i] = rec[i].tr_type;
+	}
+}
+
+static inline void trace_zunpack(const unsigned char *col, u_int32_t nr,
+				 struct trace_record *rec)
+{
+	u_int32_t i;
+
+	for (i = 0; i < nr; ++i) {
+		memcpy(&rec[i].tr_page,   col + 4 * i,            4);
+		memcpy(&rec[i].tr_object, col + 4 * (nr + i),     4);
+		memcpy(&rec[i].tr_index,  col + 4 * (2 * nr + i), 4);
+		rec[i].tr_type = col[12 * nr + i];
+	}
+}
+
+/*
+ * Raw trace.
+ *
+ * Stream of records as logged by the kernel (lib/fslog.c in fslog.patch) and
+ * copied out of the relay channel by fslog without -p.
+ */
+
+struct fslog_record {
+	/*
+	 * sequential record number, used to detect lost records.
+	 */
+	u_int32_t fr_no;
+	/*
+	 * time-stamp, in microseconds.
+	 */
+	u_int32_t fr_time;
+
+	u_int32_t fr_dev;
+	u_int32_t fr_ino;
+
+	/*
+	 * inode generation.
+	 */
+	u_int32_t fr_gen;
+	/*
+	 * offset of accessed page within the file, in pages.
+	 */
+	u_int32_t fr_index;
+
+	u_int16_t fr_pid;
+	/*
+	 * access type, from enum fslog_rec_type.
+	 */
+	u_int8_t  fr_type;
+	/*
+	 * page state bits.
+	 */
+	u_int8_t  fr_bits;
+	u_int32_t fr_pad;
+
+	char      fr_comm[16];
+	char      fr_name[16];
+};
+
+#endif /* __TRACE_H__ */
+
+/*
+ * Author: Nikita Danilov <Danilov@Gmail.COM>
+ * Keywords: VM page replacement simulation tracing
+ *
+ * Copyright (C) 2006 Nikita Danilov <Danilov@Gmail.COM>
+ *
+ * This file is a part of itself.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */